@@ -0,0 +1,986 @@
+/*
+ * bench.c - Micro-benchmarks for the tree and persistence code.
+ *
+ * Usage: ./run_bench [name|all] [max_nodes]
+ *
+ * Trees are grown the same way the game grows them: start from a single
+ * animal and repeatedly split a (pseudo-random) leaf into a question with
+ * two animals, so shapes look like real learned trees rather than perfect
+ * ones.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <stdint.h>
+#include "lab5.h"
+
+#define BENCH_FILE "bench.dat"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static unsigned long long bench_rng = 0x9E3779B97F4A7C15ull;
+
+static unsigned long long next_rand(void) {
+    /* xorshift64: deterministic so runs are comparable */
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 7;
+    bench_rng ^= bench_rng << 17;
+    return bench_rng;
+}
+
+static long bench_vocab = 0; //0: every text distinct; else texts repeat every bench_vocab splits
+
+/* Builds a full binary tree with (about) n nodes by splitting random leaves. */
+static Node *build_learned_tree(long n) {
+    char question[64], animal[64];
+    long leafCap = n / 2 + 2, leafCount = 0;
+    Node **leaves = (Node **)malloc(sizeof(Node *) * (size_t)leafCap);
+    if (!leaves) return NULL;
+
+    Node *root = create_animal_node("Animal 0");
+    leaves[leafCount++] = root;
+    long nodes = 1, serial = 1;
+
+    while (nodes + 2 <= n) {
+        long pick = (long)(next_rand() % (unsigned long long)leafCount);
+        Node *leaf = leaves[pick];
+
+        /* turn the leaf into a question in place, push its animal down */
+        long id = bench_vocab ? serial % bench_vocab : serial;
+        snprintf(question, sizeof(question), "Does it have trait %ld?", id);
+        snprintf(animal, sizeof(animal), "Animal %ld", id);
+        Node *oldAnimal = create_animal_node(leaf->text);
+        Node *newAnimal = create_animal_node(animal);
+        node_set_text(leaf, question);
+        leaf->isQuestion = 1;
+        leaf->yes = newAnimal;
+        leaf->no = oldAnimal;
+
+        leaves[pick] = oldAnimal;
+        leaves[leafCount++] = newAnimal;
+        nodes += 2;
+        serial++;
+    }
+    free(leaves);
+    return root;
+}
+
+static const char *format_name(int version) {
+    if (version == TREE_FORMAT_PREORDER) return "pre";
+    return version == TREE_FORMAT_V1 ? "v1" : "v2";
+}
+
+static long file_size(const char *name) {
+    FILE *fp = fopen(name, "rb");
+    if (!fp) return -1;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+/* Save time must grow linearly with the node count. */
+static void bench_save(long maxNodes) {
+    printf("save_tree_as\n");
+    printf("  %6s %10s %10s %12s\n", "format", "nodes", "seconds", "ns/node");
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        g_root = build_learned_tree(n);
+        int count = count_nodes(g_root);
+
+        for (int v = TREE_FORMAT_V1; v <= TREE_FORMAT_PREORDER; v++) {
+            double t0 = now_sec();
+            int ok = save_tree_as(BENCH_FILE, v);
+            double dt = now_sec() - t0;
+            printf("  %6s %10d %10.4f %12.1f%s\n", format_name(v), count, dt,
+                   dt * 1e9 / count, ok ? "" : "  (FAILED)");
+        }
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    remove(BENCH_FILE);
+}
+
+/* Time until the tree is usable, plus the cost of throwing it away. */
+static void bench_load(long maxNodes) {
+    printf("load_tree / free_tree\n");
+    printf("  %6s %10s %10s %10s %12s\n", "format", "nodes", "load s", "free s", "file bytes");
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        g_root = build_learned_tree(n);
+        int count = count_nodes(g_root);
+
+        for (int v = TREE_FORMAT_V1; v <= TREE_FORMAT_PREORDER; v++) {
+            save_tree_as(BENCH_FILE, v);
+            free_tree(g_root);
+            g_root = NULL;
+
+            double t0 = now_sec();
+            int ok = load_tree(BENCH_FILE);
+            double t1 = now_sec();
+            free_tree(g_root);
+            double t2 = now_sec();
+            g_root = NULL;
+            printf("  %6s %10d %10.4f %10.4f %12ld%s\n", format_name(v), count, t1 - t0,
+                   t2 - t1, file_size(BENCH_FILE), ok ? "" : "  (FAILED)");
+
+            load_tree(BENCH_FILE); //next format saves the same tree
+        }
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    remove(BENCH_FILE);
+}
+
+/* Plain vs LZ-compressed string pool: bytes on disk and load throughput in
+ * text bytes per second (best of a few runs, file already in page cache). */
+static void bench_compress(long maxNodes) {
+    printf("compressed pool (v2)\n");
+    printf("  %6s %10s %12s %10s %10s\n", "pool", "nodes", "file bytes", "load s", "GB/s");
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        g_root = build_learned_tree(n);
+        int count = count_nodes(g_root);
+        double textBytes = 0;
+        Node **stack = (Node **)malloc(sizeof(Node *) * (size_t)count);
+        int top = 0;
+        stack[top++] = g_root;
+        while (top > 0) { //total text, terminators included
+            Node *cur = stack[--top];
+            textBytes += (double)strlen(cur->text) + 1;
+            if (cur->yes) stack[top++] = cur->yes;
+            if (cur->no) stack[top++] = cur->no;
+        }
+        free(stack);
+
+        for (int z = 0; z <= 1; z++) {
+            int fmt = TREE_FORMAT_V2 | (z ? TREE_POOL_COMPRESSED : 0);
+            save_tree_as(BENCH_FILE, fmt);
+            double best = 1e30;
+            for (int rep = 0; rep < 3; rep++) {
+                double t0 = now_sec();
+                load_tree(BENCH_FILE);
+                double dt = now_sec() - t0;
+                if (dt < best) best = dt;
+            }
+            printf("  %6s %10d %12ld %10.4f %10.3f\n", z ? "lz" : "plain", count,
+                   file_size(BENCH_FILE), best, textBytes / best / 1e9);
+        }
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    remove(BENCH_FILE);
+}
+
+/* Time until the root question can be asked, full vs progressive load. */
+static void bench_progressive(long maxNodes) {
+    printf("time to first question (v2)\n");
+    printf("  %12s %10s %12s %10s\n", "mode", "nodes", "first q s", "wait s");
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        g_root = build_learned_tree(n);
+        int count = count_nodes(g_root);
+        save_tree_as(BENCH_FILE, TREE_FORMAT_V2);
+        free_tree(g_root);
+        g_root = NULL;
+
+        for (int progressive = 0; progressive <= 1; progressive++) {
+            set_load_progressive(progressive);
+            double t0 = now_sec();
+            int ok = load_tree(BENCH_FILE) && g_root->text[0] != '\0';
+            double t1 = now_sec();
+            ok = load_wait() && ok;
+            double t2 = now_sec();
+            printf("  %12s %10d %12.6f %10.4f%s\n", progressive ? "progressive" : "full", count,
+                   t1 - t0, t2 - t1, ok ? "" : "  (FAILED)");
+            free_tree(g_root); //not part of the next load's time
+            g_root = NULL;
+        }
+        set_load_progressive(0);
+    }
+    remove(BENCH_FILE);
+}
+
+/* Building, walking and freeing a learned tree with and without the pool
+ * (texts all distinct and not interned, so this is the pool alone). */
+static void bench_alloc(long maxNodes) {
+    printf("node allocation (%ld nodes)\n", maxNodes);
+    printf("  %6s %10s %10s %10s %10s\n", "pool", "mallocs", "build s", "walk s", "free s");
+    set_text_interning(0);
+    for (int on = 1; on >= 0; on--) {
+        set_node_pool(on);
+        bench_rng = 0x9E3779B97F4A7C15ull; //same tree both times
+        PoolStats before, after;
+        pool_stats(&before);
+        double t0 = now_sec();
+        g_root = build_learned_tree(maxNodes);
+        double t1 = now_sec();
+        pool_stats(&after);
+        double walk = 1e30;
+        for (int rep = 0; rep < 3; rep++) {
+            double w0 = now_sec();
+            count_nodes(g_root);
+            double dt = now_sec() - w0;
+            if (dt < walk) walk = dt;
+        }
+        double t2 = now_sec();
+        free_tree(g_root);
+        double t3 = now_sec();
+        g_root = NULL;
+        printf("  %6s %10ld %10.4f %10.4f %10.4f\n", on ? "on" : "off",
+               after.mallocs - before.mallocs, t1 - t0, walk, t3 - t2);
+    }
+    set_node_pool(1);
+    set_text_interning(1);
+}
+
+/* Node count by walking vs the cached subtree count (what a menu redraw
+ * pays), and the one-off recount a load does. */
+static void bench_counts(long maxNodes) {
+    printf("node counts\n");
+    printf("  %10s %12s %12s %12s\n", "nodes", "walk s", "cached s", "recount s");
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        g_root = build_learned_tree(n); //linked by hand: counts come from the recount
+        double t0 = now_sec();
+        tree_recount(g_root);
+        double t1 = now_sec();
+        int walked = count_nodes(g_root);
+        double t2 = now_sec();
+        volatile int cached = 0;
+        for (int rep = 0; rep < 1000; rep++) cached += subtree_nodes(g_root);
+        double t3 = now_sec();
+        printf("  %10d %12.6f %12.9f %12.6f%s\n", walked, t2 - t1, (t3 - t2) / 1000, t1 - t0,
+               cached == 1000 * walked ? "" : "  (MISMATCH)");
+        free_tree(g_root);
+        g_root = NULL;
+    }
+}
+
+/* Random root-to-leaf descents (games) over one tree, timed, plus how many
+ * distinct cache lines and pages a descent's nodes fall on, as a proxy for
+ * the misses it takes. */
+static void walk_games(const char *name, long games) {
+    unsigned long long lines = 0, pages = 0;
+    double dt = 1e30;
+    long visited = 0;
+    volatile int sink = 0;
+    for (int rep = 0; rep < 3; rep++) { //best of three, same descents each time
+        bench_rng = 0x2545F4914F6CDD1Dull;
+        visited = 0;
+        double t0 = now_sec();
+        for (long g = 0; g < games; g++) {
+            unsigned long long r = next_rand();
+            for (Node *n = g_root; n; n = (r >>= 1, r & 1) ? n->yes : n->no) {
+                sink += n->text[0];
+                visited++;
+                if (!r) r = next_rand();
+            }
+        }
+        double t = now_sec() - t0;
+        if (t < dt) dt = t;
+    }
+    bench_rng = 0x2545F4914F6CDD1Dull; //same descents again, untimed, to count lines
+    for (long g = 0; g < games / 10; g++) {
+        unsigned long long r = next_rand();
+        uintptr_t lastLine = 0, lastPage = 0;
+        for (Node *n = g_root; n; n = (r >>= 1, r & 1) ? n->yes : n->no) {
+            uintptr_t at = (uintptr_t)n;
+            if (at >> 6 != lastLine) { lines++; lastLine = at >> 6; }
+            if (at >> 12 != lastPage) { pages++; lastPage = at >> 12; }
+            if (!r) r = next_rand();
+        }
+    }
+    printf("  %8s %10.4f %10.1f %12.1f %12.1f\n", name, dt, dt * 1e9 / (double)visited,
+           (double)lines / (double)(games / 10), (double)pages / (double)(games / 10));
+}
+
+/* The same learned tree as built (nodes in creation order), then compacted
+ * in BFS and van Emde Boas order. Interning is off so each layout's texts
+ * follow its nodes. */
+static void bench_layout(long maxNodes) {
+    long games = 1000000;
+    printf("tree layout (%ld nodes, %ld random games)\n", maxNodes, games);
+    printf("  %8s %10s %10s %12s %12s\n", "layout", "seconds", "ns/node", "lines/game", "pages/game");
+    g_root = build_learned_tree(maxNodes);
+    tree_recount(g_root);
+    set_text_interning(0);
+    int layouts[] = { -1, LAYOUT_BFS, LAYOUT_VEB };
+    const char *names[] = { "heap", "bfs", "veb" };
+    for (int k = 0; k < 3; k++) {
+        if (layouts[k] >= 0 && !tree_compact(layouts[k])) {
+            printf("  %8s (FAILED)\n", names[k]);
+            continue;
+        }
+        walk_games(names[k], games);
+    }
+    set_text_interning(1);
+    free_tree(g_root);
+    g_root = NULL;
+}
+
+/* Bytes of text the nodes own between them (walks without recursion). */
+static size_t tree_text_bytes(Node *root) {
+    size_t bytes = 0;
+    FrameStack s;
+    fs_init(&s);
+    if (root) fs_push(&s, root, -1);
+    while (!fs_empty(&s)) {
+        Node *n = fs_pop(&s).node;
+        bytes += strlen(n->text) + 1;
+        if (n->yes) fs_push(&s, n->yes, -1);
+        if (n->no) fs_push(&s, n->no, -1);
+    }
+    fs_free(&s);
+    return bytes;
+}
+
+/* A tree whose texts repeat (a 1000-name vocabulary), built and v1-loaded
+ * with and without interning: dedup ratio and text bytes held. */
+static void bench_intern(long maxNodes) {
+    printf("text interning (%ld nodes, 1000 distinct animals/questions)\n", maxNodes);
+    printf("  %6s %6s %10s %10s %12s %12s\n", "intern", "how", "seconds", "dedup", "held bytes",
+           "saved bytes");
+    bench_vocab = 1000;
+    for (int on = 1; on >= 0; on--) {
+        set_text_interning(on);
+        bench_rng = 0x9E3779B97F4A7C15ull;
+        InternStats before, after;
+        intern_stats(&before);
+        double t0 = now_sec();
+        g_root = build_learned_tree(maxNodes);
+        double t1 = now_sec();
+        intern_stats(&after);
+        long refs = after.refs - before.refs, strings = after.strings - before.strings;
+        size_t held = after.bytes - before.bytes, saved = after.savedBytes - before.savedBytes;
+        if (!on) held = tree_text_bytes(g_root); //private copies: every node holds its own
+        printf("  %6s %6s %10.4f %10.2f %12zu %12zu\n", on ? "on" : "off", "build", t1 - t0,
+               strings ? (double)refs / (double)strings : 1.0, held, saved);
+
+        save_tree_as(BENCH_FILE, TREE_FORMAT_V1);
+        free_tree(g_root);
+        g_root = NULL;
+        intern_stats(&before);
+        t0 = now_sec();
+        int ok = load_tree(BENCH_FILE);
+        t1 = now_sec();
+        intern_stats(&after);
+        refs = after.refs - before.refs;
+        strings = after.strings - before.strings;
+        held = on ? after.bytes - before.bytes : (size_t)file_size(BENCH_FILE); //or the arena
+        printf("  %6s %6s %10.4f %10.2f %12zu %12zu%s\n", on ? "on" : "off", "v1 load", t1 - t0,
+               strings ? (double)refs / (double)strings : 1.0, held,
+               after.savedBytes - before.savedBytes, ok ? "" : "  (FAILED)");
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    bench_vocab = 0;
+    set_text_interning(1);
+    remove(BENCH_FILE);
+}
+
+/* Learned trees over shrinking vocabularies, hash-consed: time to share,
+ * nodes left stored and bytes saved, v2 file size before and after, and
+ * the time to load the shared image back. */
+static void bench_share(long maxNodes) {
+    printf("subtree sharing (%ld nodes)\n", maxNodes);
+    printf("  %6s %10s %10s %12s %12s %12s %10s\n", "vocab", "seconds", "stored", "saved bytes",
+           "v2 bytes", "shared v2", "load s");
+    long vocabs[] = { 1000, 64, 4 };
+    for (int k = 0; k < 3; k++) {
+        bench_vocab = vocabs[k];
+        bench_rng = 0x9E3779B97F4A7C15ull;
+        g_root = build_learned_tree(maxNodes);
+        tree_recount(g_root);
+        save_tree_as(BENCH_FILE, TREE_FORMAT_V2);
+        long plain = file_size(BENCH_FILE);
+        double t0 = now_sec();
+        int ok = tree_share();
+        double t1 = now_sec();
+        ShareStats ss;
+        share_stats(&ss);
+        long stored = subtree_nodes(g_root) - ss.nodesSaved;
+        ok = ok && save_tree_as(BENCH_FILE, TREE_FORMAT_V2);
+        free_tree(g_root);
+        g_root = NULL;
+        double t2 = now_sec();
+        ok = ok && load_tree(BENCH_FILE);
+        double t3 = now_sec();
+        printf("  %6ld %10.4f %10ld %12zu %12ld %12ld %10.4f%s\n", vocabs[k], t1 - t0, stored,
+               ss.bytesSaved, plain, file_size(BENCH_FILE), t3 - t2, ok ? "" : "  (FAILED)");
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    bench_vocab = 0;
+    remove(BENCH_FILE);
+}
+
+/* Differences between two trees without the hashes: every pair is compared. */
+static int full_compare(Node *a, Node *b) {
+    FrameStack s;
+    fs_init(&s);
+    fs_push(&s, a, -1);
+    fs_push(&s, b, -1);
+    int found = 0;
+    while (!fs_empty(&s)) {
+        Node *y = fs_pop(&s).node;
+        Node *x = fs_pop(&s).node;
+        if (!x && !y) continue;
+        if (!x || !y || x->isQuestion != y->isQuestion || strcmp(x->text, y->text) != 0) {
+            found++;
+            continue;
+        }
+        fs_push(&s, x->yes, -1); fs_push(&s, y->yes, -1);
+        fs_push(&s, x->no, -1);  fs_push(&s, y->no, -1);
+    }
+    fs_free(&s);
+    return found;
+}
+
+/* Two saves a few learns apart: in-memory diff with the hashes vs a full
+ * compare, and diff_files over files with and without stored hashes. */
+static void bench_diff(long maxNodes) {
+    printf("tree diff (%ld nodes, 3 learns apart)\n", maxNodes);
+    printf("  %12s %12s %12s %12s %12s\n", "hash diff s", "full s", "files s", "hashed s", "hashed bytes");
+    bench_rng = 0x9E3779B97F4A7C15ull;
+    g_root = build_learned_tree(maxNodes);
+    tree_recount(g_root);
+    save_tree_as(BENCH_FILE, TREE_FORMAT_V2);
+    save_tree_as(BENCH_FILE ".h", TREE_FORMAT_V2 | TREE_HASHES);
+    for (int i = 0; i < 3; i++) { //learn in place at the end of a random descent
+        Node *leaf = g_root;
+        for (unsigned long long r = next_rand(); leaf->isQuestion; r = (r >> 1) ? r >> 1 : next_rand()) {
+            leaf = (r & 1) ? leaf->yes : leaf->no;
+        }
+        leaf->no = create_animal_node(leaf->text);
+        leaf->yes = create_animal_node("New animal");
+        leaf->no->parent = leaf->yes->parent = leaf;
+        leaf->isQuestion = 1;
+        node_set_text(leaf, "Is it new?");
+        tree_adjust(leaf, 2, 1);
+    }
+    save_tree_as(BENCH_FILE ".2", TREE_FORMAT_V2);
+    save_tree_as(BENCH_FILE ".2h", TREE_FORMAT_V2 | TREE_HASHES);
+    Node *edited = g_root;
+    g_root = NULL;
+    load_tree(BENCH_FILE);
+    Node *before = g_root;
+    g_root = edited;
+
+    double t0 = now_sec();
+    int hashed = tree_diff(before, g_root, NULL, NULL);
+    double t1 = now_sec();
+    int full = full_compare(before, g_root);
+    double t2 = now_sec();
+    int files = diff_files(BENCH_FILE, BENCH_FILE ".2", NULL);
+    double t3 = now_sec();
+    int filesHashed = diff_files(BENCH_FILE ".h", BENCH_FILE ".2h", NULL);
+    double t4 = now_sec();
+    int ok = hashed == 3 && full == 3 && files == 3 && filesHashed == 3;
+    printf("  %12.6f %12.6f %12.4f %12.4f %12ld%s\n", t1 - t0, t2 - t1, t3 - t2, t4 - t3,
+           file_size(BENCH_FILE ".h"), ok ? "" : "  (MISMATCH)");
+    free_tree(before);
+    free_tree(g_root);
+    g_root = NULL;
+    remove(BENCH_FILE);
+    remove(BENCH_FILE ".h");
+    remove(BENCH_FILE ".2");
+    remove(BENCH_FILE ".2h");
+}
+
+/* The leaf named name by a full walk, as lookups went before the index. */
+static Node *walk_find(Node *root, const char *name) {
+    FrameStack s;
+    fs_init(&s);
+    fs_push(&s, root, -1);
+    Node *found = NULL;
+    while (!found && !fs_empty(&s)) {
+        Node *n = fs_pop(&s).node;
+        if (!n->isQuestion) {
+            if (strcmp(n->text, name) == 0) found = n;
+            continue;
+        }
+        fs_push(&s, n->no, -1);
+        fs_push(&s, n->yes, -1);
+    }
+    fs_free(&s);
+    return found;
+}
+
+/* Animal lookups: one full walk each vs the name index (built by the first
+ * lookup), and the cost of keeping it up to date while learning. */
+static void bench_index(long maxNodes) {
+    printf("animal index\n");
+    printf("  %10s %12s %12s %12s %12s\n", "nodes", "build s", "lookup us", "walk us", "learn us");
+    char name[64];
+    es_init(&g_undo); //learning records its edits and files its questions
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        bench_rng = 0x9E3779B97F4A7C15ull;
+        g_root = build_learned_tree(n);
+        tree_recount(g_root);
+        long animals = subtree_leaves(g_root);
+        double t0 = now_sec();
+        int ok = animal_index_size() == animals;
+        double t1 = now_sec();
+        long lookups = 100000;
+        for (long i = 0; i < lookups; i++) {
+            snprintf(name, sizeof(name), "Animal %ld", (long)(next_rand() % (unsigned long long)animals));
+            ok = ok && animal_lookup(name) != NULL;
+        }
+        double t2 = now_sec();
+        long walks = 20;
+        for (long i = 0; i < walks; i++) {
+            snprintf(name, sizeof(name), "Animal %ld", (long)(next_rand() % (unsigned long long)animals));
+            ok = ok && walk_find(g_root, name) != NULL;
+        }
+        double t3 = now_sec();
+        long learns = 1000;
+        for (long i = 0; i < learns; i++) { //split the leaf a lookup found, as play_game would
+            snprintf(name, sizeof(name), "Animal %ld", (long)(next_rand() % (unsigned long long)animals));
+            Node *leaf = animal_lookup(name);
+            Node *parent = leaf->parent;
+            snprintf(name, sizeof(name), "Learned %ld", i);
+            ok = ok && apply_insert_split(parent, parent && parent->yes == leaf, leaf, "Is it new?", name, 1);
+        }
+        double t4 = now_sec();
+        ok = ok && animal_index_size() == animals + learns;
+        printf("  %10ld %12.4f %12.3f %12.1f %12.3f%s\n", n, t1 - t0, (t2 - t1) * 1e6 / (double)lookups,
+               (t3 - t2) * 1e6 / (double)walks, (t4 - t3) * 1e6 / (double)learns, ok ? "" : "  (MISMATCH)");
+        es_clear(&g_undo); //the edits point into the tree freed below
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    animal_index_free();
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+}
+
+/* Common ancestor by parent links, the way find_shortest_path used to. */
+static Node *climb_lca(Node *a, Node *b) {
+    int da = 0, db = 0;
+    for (Node *x = a; x->parent; x = x->parent) da++;
+    for (Node *x = b; x->parent; x = x->parent) db++;
+    for (; da > db; da--) a = a->parent;
+    for (; db > da; db--) b = b->parent;
+    while (a != b) { a = a->parent; b = b->parent; }
+    return a;
+}
+
+/* Batched distinguishing questions: table build, find_paths vs climbing. */
+static void bench_lca(long maxNodes) {
+    printf("distinguishing questions\n");
+    printf("  %10s %12s %14s %14s\n", "nodes", "build s", "pairs/s", "climb pairs/s");
+    enum { BATCH = 1000 };
+    static char names[2 * BATCH][32];
+    PathQuery q[BATCH];
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        bench_rng = 0x9E3779B97F4A7C15ull;
+        g_root = build_learned_tree(n);
+        tree_recount(g_root);
+        long animals = subtree_leaves(g_root);
+        for (int i = 0; i < 2 * BATCH; i++)
+            snprintf(names[i], sizeof(names[i]), "Animal %ld", (long)(next_rand() % (unsigned long long)animals));
+        for (int i = 0; i < BATCH; i++) q[i] = (PathQuery){ names[2 * i], names[2 * i + 1], NULL, 0 };
+        animal_index_size(); //index build is bench index's number
+        double t0 = now_sec();
+        PathQuery first = q[0];
+        find_paths(&first, 1); //builds the tables
+        double t1 = now_sec();
+        long rounds = 100;
+        int ok = 1;
+        for (long r = 0; r < rounds; r++) find_paths(q, BATCH);
+        double t2 = now_sec();
+        for (int i = 0; i < BATCH; i++) {
+            Node *a = animal_lookup(q[i].animal1), *b = animal_lookup(q[i].animal2);
+            ok = ok && (a == b ? q[i].split == NULL : q[i].split == climb_lca(a, b));
+        }
+        double t3 = now_sec();
+        for (int i = 0; i < BATCH; i++) climb_lca(animal_lookup(q[i].animal1), animal_lookup(q[i].animal2));
+        double t4 = now_sec();
+        printf("  %10ld %12.4f %14.0f %14.0f%s\n", n, t1 - t0, (double)(rounds * BATCH) / (t2 - t1),
+               (double)BATCH / (t4 - t3), ok ? "" : "  (MISMATCH)");
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    animal_index_free();
+    lca_free();
+}
+
+/* Remaining-candidate counts from the path signatures vs walking the
+ * subtree the answers lead to. */
+static void bench_candidates(long maxNodes) {
+    printf("remaining candidates\n");
+    printf("  %10s %12s %12s %12s\n", "nodes", "build s", "scan us", "walk us");
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        bench_rng = 0x9E3779B97F4A7C15ull;
+        g_root = build_learned_tree(n);
+        tree_recount(g_root);
+        double t0 = now_sec();
+        PathSig none = { 0, 0 };
+        int ok = animal_candidates(&none, g_root) == subtree_leaves(g_root);
+        double t1 = now_sec();
+        long games = 100;
+        double scan = 0, walk = 0;
+        for (long g = 0; g < games; g++) { //the counts a game shows after its first three answers
+            PathSig answers = { 0, 0 };
+            Node *cur = g_root;
+            for (int d = 0; d < 3 && cur->isQuestion; d++) {
+                int yes = (int)(next_rand() & 1);
+                path_sig_push(&answers, yes);
+                cur = yes ? cur->yes : cur->no;
+            }
+            double a = now_sec();
+            int left = animal_candidates(&answers, cur);
+            double b = now_sec();
+            int walked = (count_nodes(cur) + 1) / 2; //a full tree has one more leaf than questions
+            double c = now_sec();
+            ok = ok && left == walked;
+            scan += b - a;
+            walk += c - b;
+        }
+        printf("  %10ld %12.4f %12.1f %12.1f%s\n", n, t1 - t0, scan * 1e6 / (double)games,
+               walk * 1e6 / (double)games, ok ? "" : "  (MISMATCH)");
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    animal_index_free();
+}
+
+/* Question-index puts and lookups from the 31 buckets initialize_tree
+ * started with: chained and grown on the load factor, chained and left
+ * fixed, open addressing, and both again with HASH_WIDE (h_hash64, 32
+ * buckets). max chain is in groups for the open table. */
+static void bench_hash(long maxNodes) {
+    printf("hash table\n");
+    printf("  %10s %8s %10s %10s %12s %10s %10s\n", "keys", "table", "put us", "get us", "max put us", "max chain", "load");
+    const char *tables[] = { "chained", "fixed", "open", "wide", "open+w" };
+    const int flags[] = { HASH_CHAINED, HASH_CHAINED, HASH_OPEN, HASH_WIDE, HASH_OPEN | HASH_WIDE };
+    char key[64];
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        for (int kind = 0; kind < 5; kind++) {
+            if (kind == 1 && n > 100000) continue; //chains of n / 31: quadratic
+            Hash h;
+            h_init_as(&h, 31, flags[kind]);
+            if (kind == 1) h_set_max_load(&h, 0);
+            double worst = 0, t0 = now_sec();
+            for (long i = 0; i < n; i++) {
+                snprintf(key, sizeof(key), "does_it_have_trait_%ld", i);
+                double a = now_sec();
+                h_put(&h, key, (int)i);
+                double b = now_sec();
+                if (b - a > worst) worst = b - a;
+            }
+            double t1 = now_sec();
+            long gets = 100000, found = 0;
+            for (long i = 0; i < gets; i++) {
+                snprintf(key, sizeof(key), "does_it_have_trait_%ld", (long)(next_rand() % (unsigned long long)n));
+                int count;
+                found += h_get_ids(&h, key, &count) != NULL;
+            }
+            double t2 = now_sec();
+            HashStats st;
+            h_stats(&h, &st);
+            printf("  %10ld %8s %10.3f %10.3f %12.1f %10d %10.2f%s\n", n, tables[kind],
+                   (t1 - t0) * 1e6 / (double)n, (t2 - t1) * 1e6 / (double)gets, worst * 1e6,
+                   st.maxChain, st.loadFactor, found == gets ? "" : "  (MISMATCH)");
+            h_free(&h);
+        }
+    }
+}
+
+/* djb2 vs h_hash64: throughput on question-length keys, and how evenly
+ * keys with a shared prefix land in 2^16 masked buckets (chi-square; about
+ * 65536 is as even as chance). */
+static void bench_hashfn(long maxNodes) {
+    printf("hash functions\n");
+    printf("  %8s %10s %12s %12s\n", "hash", "key bytes", "MB/s", "chi-square");
+    enum { BUCKETS = 1 << 16, KEYS = 200000 };
+    (void)maxNodes; //the key count is fixed: enough for the chi-square
+    int *load = (int *)malloc(sizeof(int) * BUCKETS);
+    unsigned *hv = (unsigned *)malloc(sizeof(unsigned) * KEYS);
+    char *keys = (char *)malloc((size_t)KEYS * 72);
+    for (int len = 16; len <= 64; len *= 2) {
+        for (long i = 0; i < KEYS; i++) { //padded to len after the distinguishing digits
+            char *key = keys + i * 72;
+            int n = snprintf(key, 72, "does_it_%ld_", i);
+            while (n < len) key[n++] = 'x';
+            key[len] = '\0';
+        }
+        for (int wide = 0; wide <= 1; wide++) {
+            int reps = 10;
+            double t0 = now_sec();
+            for (int r = 0; r < reps; r++) {
+                for (long i = 0; i < KEYS; i++) {
+                    const char *key = keys + i * 72;
+                    if (wide) {
+                        uint64_t x = h_hash64(key);
+                        hv[i] = (unsigned)(x ^ (x >> 32));
+                    } else {
+                        hv[i] = h_hash(key);
+                    }
+                }
+            }
+            double t = now_sec() - t0;
+            memset(load, 0, sizeof(int) * BUCKETS);
+            for (long i = 0; i < KEYS; i++) load[hv[i] & (BUCKETS - 1)]++;
+            double expect = (double)KEYS / BUCKETS, chi2 = 0;
+            for (int i = 0; i < BUCKETS; i++) chi2 += (load[i] - expect) * (load[i] - expect) / expect;
+            printf("  %8s %10d %12.0f %12.0f\n", wide ? "hash64" : "djb2", len,
+                   (double)KEYS * reps * len / t / 1e6, chi2);
+        }
+    }
+    free(keys);
+    free(hv);
+    free(load);
+}
+
+/* canonicalize() as it was before the table and SSE2 paths: ctype calls per
+ * byte, and every byte past ASCII dropped. */
+static char *canon_ctype(const char *s) {
+    size_t len = strlen(s), j = 0;
+    char *out = (char *)malloc(len + 1);
+    if (!out) return NULL;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (isalnum(c)) out[j++] = (char)tolower(c);
+        else if (isspace(c)) out[j++] = '_';
+    }
+    out[j] = '\0';
+    return out;
+}
+
+/* canonicalize throughput on question-sized keys and on one long text, for
+ * ASCII and for UTF-8 (Cyrillic and accented Latin) input. */
+static void bench_canon(long maxNodes) {
+    printf("canonicalize\n");
+    printf("  %8s %10s %12s %12s\n", "input", "bytes", "ctype MB/s", "MB/s");
+    enum { KEYS = 200000, LEN = 72, BIG = 1 << 22 };
+    (void)maxNodes; //fixed sizes: only the per-byte cost matters
+    const char *inputs[] = { "ascii", "utf8" };
+    char *keys = (char *)malloc((size_t)KEYS * LEN);
+    char *big = (char *)malloc(BIG + LEN);
+    for (int utf8 = 0; utf8 <= 1; utf8++) {
+        for (long i = 0; i < KEYS; i++) {
+            long r = (long)(next_rand() % 100000);
+            if (utf8) snprintf(keys + i * LEN, LEN, "\xD0\x96\xD0\xB8\xD0\xB2\xD1\x91\xD1\x82 \xD0\xBB\xD0\xB8 \xC3\x89l\xC3\xA9phant %ld?", r);
+            else snprintf(keys + i * LEN, LEN, "Does it have Trait %ld, or not?", r);
+        }
+        size_t bigLen = 0;
+        for (long i = 0; bigLen + LEN < BIG; i++) {
+            size_t n = strlen(keys + i * LEN);
+            memcpy(big + bigLen, keys + i * LEN, n);
+            big[bigLen + n] = ' ';
+            bigLen += n + 1;
+        }
+        big[bigLen] = '\0';
+        double keyBytes = 0;
+        for (long i = 0; i < KEYS; i++) keyBytes += (double)strlen(keys + i * LEN);
+
+        for (int whole = 0; whole <= 1; whole++) {
+            double mbs[2];
+            for (int impl = 0; impl < 2; impl++) {
+                int reps = whole ? 20 : 5;
+                double t0 = now_sec();
+                for (int r = 0; r < reps; r++) {
+                    if (whole) {
+                        free(impl ? canonicalize(big) : canon_ctype(big));
+                        continue;
+                    }
+                    for (long i = 0; i < KEYS; i++) free(impl ? canonicalize(keys + i * LEN) : canon_ctype(keys + i * LEN));
+                }
+                mbs[impl] = (whole ? (double)bigLen : keyBytes) * reps / (now_sec() - t0) / 1e6;
+            }
+            printf("  %8s %10s %12.0f %12.0f\n", inputs[utf8], whole ? "4 MB" : "key", mbs[0], mbs[1]);
+        }
+    }
+    free(big);
+    free(keys);
+}
+
+/* Index lookups by question text: canonicalize + h_get_ids + free, as
+ * play_game did, vs h_get_ids_text with no heap copy. */
+static void bench_textkeys(long maxNodes) {
+    printf("text key lookups\n");
+    printf("  %10s %8s %12s %12s %12s\n", "keys", "table", "copy us", "text us", "put us");
+    const char *tables[] = { "wide", "open+w" };
+    const int flags[] = { HASH_WIDE, HASH_OPEN | HASH_WIDE };
+    enum { GETS = 200000, LEN = 48 };
+    char *texts = (char *)malloc((size_t)GETS * LEN);
+    char text[LEN];
+    for (long n = 1000; n <= maxNodes; n *= 10) {
+        for (long i = 0; i < GETS; i++)
+            snprintf(texts + i * LEN, LEN, "Does it have Trait %ld, or not?", (long)(next_rand() % (unsigned long long)n));
+        for (int kind = 0; kind < 2; kind++) {
+            Hash h;
+            h_init_as(&h, 32, flags[kind]);
+            double put = 0;
+            for (long i = 0; i < n; i++) {
+                snprintf(text, sizeof(text), "Does it have Trait %ld, or not?", i);
+                double a = now_sec();
+                h_put_text(&h, text, (int)i);
+                put += now_sec() - a;
+            }
+            long found = 0;
+            int count;
+            double t0 = now_sec();
+            for (long i = 0; i < GETS; i++) {
+                char *key = canonicalize(texts + i * LEN);
+                found += h_get_ids(&h, key, &count) != NULL;
+                free(key);
+            }
+            double t1 = now_sec();
+            for (long i = 0; i < GETS; i++) found += h_get_ids_text(&h, texts + i * LEN, &count) != NULL;
+            double t2 = now_sec();
+            printf("  %10ld %8s %12.3f %12.3f %12.3f%s\n", n, tables[kind], (t1 - t0) * 1e6 / GETS,
+                   (t2 - t1) * 1e6 / GETS, put * 1e6 / (double)n, found == 2 * GETS ? "" : "  (MISMATCH)");
+            h_free(&h);
+        }
+    }
+    free(texts);
+}
+
+/* Node tree vs compact tree: bytes per node and full-walk time. */
+static void bench_compact(long maxNodes) {
+    printf("compact tree (%ld nodes)\n", maxNodes);
+    printf("  %8s %12s %10s %12s\n", "layout", "bytes/node", "walk s", "games/s");
+    g_root = build_learned_tree(maxNodes);
+    CompactTree t;
+    ct_init(&t);
+    ct_from_tree(&t, g_root);
+    int count = count_nodes(g_root);
+    PoolStats ps;
+    pool_stats(&ps);
+    int games = 1000000;
+
+    for (int compact = 0; compact <= 1; compact++) {
+        double walk = 1e30;
+        for (int rep = 0; rep < 3; rep++) {
+            double t0 = now_sec();
+            if (compact) ct_count_reachable(&t);
+            else count_nodes(g_root);
+            double dt = now_sec() - t0;
+            if (dt < walk) walk = dt;
+        }
+        double t0 = now_sec();
+        for (int g = 0; g < games; g++) { //random root-to-leaf walks
+            if (compact) {
+                uint32_t i = t.root;
+                while (ct_is_question(&t, i)) i = ct_child(&t, i, (int)(next_rand() & 1));
+            } else {
+                Node *cur = g_root;
+                while (cur->isQuestion) cur = (next_rand() & 1) ? cur->yes : cur->no;
+            }
+        }
+        double play = now_sec() - t0;
+        double bytes = compact ? (double)t.count * 13 + (double)t.poolLen
+                               : (double)ps.slabBytes; //pooled nodes + texts
+        printf("  %8s %12.1f %10.4f %12.0f\n", compact ? "compact" : "node", bytes / count, walk,
+               games / play);
+    }
+    ct_free(&t);
+    free_tree(g_root);
+    g_root = NULL;
+}
+
+/* Random root-to-leaf games on a tree loaded under shrinking budgets. */
+static void bench_paging(long maxNodes) {
+    int games = 10000;
+    printf("paged games (%ld nodes, %d games)\n", maxNodes, games);
+    printf("  %10s %12s %10s %10s %10s\n", "budget MB", "resident MB", "faults", "evictions", "us/game");
+    g_root = build_learned_tree(maxNodes);
+    save_tree_as(BENCH_FILE, TREE_FORMAT_V2);
+    free_tree(g_root);
+    g_root = NULL;
+
+    for (size_t mb = 64; mb >= 1; mb /= 4) {
+        set_load_budget(mb << 20);
+        PagingStats before, after;
+        paging_stats(&before);
+        load_tree(BENCH_FILE);
+        double t0 = now_sec();
+        for (int gme = 0; gme < games; gme++) {
+            Node *cur = g_root;
+            while (cur->isQuestion) cur = node_child(cur, (int)(next_rand() & 1));
+        }
+        double dt = now_sec() - t0;
+        paging_stats(&after);
+        printf("  %10zu %12.2f %10ld %10ld %10.2f\n", mb, after.residentBytes / 1048576.0,
+               after.faults - before.faults, after.evictions - before.evictions, dt * 1e6 / games);
+        free_tree(g_root);
+        g_root = NULL;
+    }
+    set_load_budget(0);
+    remove(BENCH_FILE);
+}
+
+/* Save and load time with 1..maxThreads workers, both layouts. */
+static void bench_threads(long maxNodes) {
+    int maxThreads = 8;
+    printf("parallel save_tree_as (%ld nodes)\n", maxNodes);
+    printf("  %6s %8s %10s\n", "format", "threads", "save s");
+    g_root = build_learned_tree(maxNodes);
+    tree_recount(g_root); //the save thread count follows the cached size
+    for (int v = TREE_FORMAT_V1; v <= TREE_FORMAT_V2; v++) {
+        for (int t = 1; t <= maxThreads; t *= 2) {
+            set_save_threads(t);
+            double t0 = now_sec();
+            int ok = save_tree_as(BENCH_FILE, v);
+            double dt = now_sec() - t0;
+            printf("  %6s %8d %10.4f%s\n", format_name(v), t, dt, ok ? "" : "  (FAILED)");
+        }
+    }
+    set_save_threads(0);
+    free_tree(g_root);
+    g_root = NULL;
+
+    printf("parallel load_tree (%ld nodes)\n", maxNodes);
+    printf("  %6s %8s %10s\n", "format", "threads", "load s");
+    g_root = build_learned_tree(maxNodes);
+    for (int v = TREE_FORMAT_V1; v <= TREE_FORMAT_V2; v++) {
+        save_tree_as(BENCH_FILE, v);
+        for (int t = 1; t <= maxThreads; t *= 2) {
+            set_load_threads(t);
+            double t0 = now_sec();
+            int ok = load_tree(BENCH_FILE);
+            double dt = now_sec() - t0;
+            printf("  %6s %8d %10.4f%s\n", format_name(v), t, dt, ok ? "" : "  (FAILED)");
+        }
+    }
+    set_load_threads(0);
+    free_tree(g_root);
+    g_root = NULL;
+    remove(BENCH_FILE);
+}
+
+int main(int argc, char **argv) {
+    const char *which = argc > 1 ? argv[1] : "all";
+    long maxNodes = argc > 2 ? atol(argv[2]) : 1000000;
+    int all = strcmp(which, "all") == 0;
+
+    if (all || strcmp(which, "save") == 0) bench_save(maxNodes);
+    if (all || strcmp(which, "load") == 0) bench_load(maxNodes);
+    if (all || strcmp(which, "compress") == 0) bench_compress(maxNodes);
+    if (all || strcmp(which, "threads") == 0) bench_threads(maxNodes);
+    if (all || strcmp(which, "progressive") == 0) bench_progressive(maxNodes);
+    if (all || strcmp(which, "paging") == 0) bench_paging(maxNodes);
+    if (all || strcmp(which, "alloc") == 0) bench_alloc(maxNodes);
+    if (all || strcmp(which, "intern") == 0) bench_intern(maxNodes);
+    if (all || strcmp(which, "counts") == 0) bench_counts(maxNodes);
+    if (all || strcmp(which, "layout") == 0) bench_layout(maxNodes);
+    if (all || strcmp(which, "share") == 0) bench_share(maxNodes);
+    if (all || strcmp(which, "diff") == 0) bench_diff(maxNodes);
+    if (all || strcmp(which, "index") == 0) bench_index(maxNodes);
+    if (all || strcmp(which, "lca") == 0) bench_lca(maxNodes);
+    if (all || strcmp(which, "candidates") == 0) bench_candidates(maxNodes);
+    if (all || strcmp(which, "hash") == 0) bench_hash(maxNodes);
+    if (all || strcmp(which, "hashfn") == 0) bench_hashfn(maxNodes);
+    if (all || strcmp(which, "canon") == 0) bench_canon(maxNodes);
+    if (all || strcmp(which, "textkeys") == 0) bench_textkeys(maxNodes);
+    if (all || strcmp(which, "compact") == 0) bench_compact(maxNodes);
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lab5.h"
+
+/* Compact (structure-of-arrays) tree. Every per-node field lives in its own
+ * array indexed by node id, so a walk touches 4-byte child ids instead of
+ * 8-byte pointers and the texts share one pool. See lab5.h for the layout;
+ * ct_save/ct_load live in persist.c next to the v2 image code they share. */
+
+//helpers
+int ct_reserve(CompactTree *t, uint32_t need) {
+    if (need <= t->cap) return 1;
+    uint32_t newcap = t->cap ? t->cap : 64;
+    while (newcap < need) newcap *= 2;
+    uint32_t *yes = (uint32_t *)realloc(t->yes, sizeof(uint32_t) * newcap);
+    if (yes) t->yes = yes;
+    uint32_t *no = (uint32_t *)realloc(t->no, sizeof(uint32_t) * newcap);
+    if (no) t->no = no;
+    uint32_t *off = (uint32_t *)realloc(t->textOff, sizeof(uint32_t) * newcap);
+    if (off) t->textOff = off;
+    uint8_t *flags = (uint8_t *)realloc(t->flags, newcap);
+    if (flags) t->flags = flags;
+    if (!yes || !no || !off || !flags) return 0; //grown arrays stay valid for the old cap
+    t->cap = newcap;
+    return 1;
+}
+
+static int pool_append(CompactTree *t, const char *text, uint32_t *offset) {
+    size_t len = strlen(text) + 1;
+    if (t->poolLen + len > UINT32_MAX) return 0; //offsets are 32-bit
+    if (t->poolLen + len > t->poolCap) {
+        size_t newcap = t->poolCap ? t->poolCap : 1024;
+        while (newcap < t->poolLen + len) newcap *= 2;
+        char *tmp = (char *)realloc(t->pool, newcap);
+        if (!tmp) return 0;
+        t->pool = tmp;
+        t->poolCap = newcap;
+    }
+    memcpy(t->pool + t->poolLen, text, len);
+    *offset = (uint32_t)t->poolLen;
+    t->poolLen += len;
+    return 1;
+}
+
+static int edit_push(CtEdit **edits, int *count, int *cap, CtEdit e) {
+    if (*count == *cap) {
+        int newcap = *cap ? *cap * 2 : 16;
+        CtEdit *tmp = (CtEdit *)realloc(*edits, sizeof(CtEdit) * (size_t)newcap);
+        if (!tmp) return 0;
+        *edits = tmp;
+        *cap = newcap;
+    }
+    (*edits)[(*count)++] = e;
+    return 1;
+}
+
+/* Points the slot an edit happened at (a parent link or the root) at node. */
+static void set_slot(CompactTree *t, const CtEdit *e, uint32_t node) {
+    if (e->parent == CT_NONE) t->root = node;
+    else if (e->wasYesChild) t->yes[e->parent] = node;
+    else t->no[e->parent] = node;
+}
+
+/* Drops the redo stack. Nodes of undone splits are reclaimed when they are
+ * still the newest ones (the usual undo-then-learn case). */
+static void redo_clear(CompactTree *t) {
+    for (int i = 0; i < t->redoCount; i++) { //oldest redo entry holds the newest nodes
+        const CtEdit *e = &t->redo[i];
+        if (t->count >= 2 && e->newLeaf == t->count - 1 && e->newQuestion == t->count - 2) {
+            t->poolLen = t->textOff[e->newQuestion];
+            t->count -= 2;
+        }
+    }
+    t->redoCount = 0;
+}
+
+void ct_init(CompactTree *t) {
+    memset(t, 0, sizeof(*t));
+    t->root = CT_NONE;
+}
+
+void ct_free(CompactTree *t) {
+    free(t->yes);
+    free(t->no);
+    free(t->textOff);
+    free(t->flags);
+    free(t->pool);
+    free(t->undo);
+    free(t->redo);
+    ct_init(t);
+}
+
+uint32_t ct_add(CompactTree *t, const char *text, int isQuestion) {
+    if (!text || t->count == CT_NONE || !ct_reserve(t, t->count + 1)) return CT_NONE;
+    uint32_t i = t->count;
+    if (!pool_append(t, text, &t->textOff[i])) return CT_NONE;
+    t->yes[i] = CT_NONE;
+    t->no[i] = CT_NONE;
+    t->flags[i] = isQuestion ? CT_QUESTION : 0;
+    t->count++;
+    if (t->root == CT_NONE) t->root = i; //first node is the root
+    return i;
+}
+
+/* Copies a Node tree in BFS order (root gets id 0), like save_tree numbers it. */
+int ct_from_tree(CompactTree *t, Node *root) {
+    ct_free(t);
+    if (!root) return 1;
+    size_t cap = 64, head = 0, tail = 0;
+    Node **queue = (Node **)malloc(sizeof(Node *) * cap);
+    if (!queue) return 0;
+    queue[tail++] = node_ready(root);
+    int ok = ct_add(t, root->text, root->isQuestion) != CT_NONE;
+    while (ok && head < tail) {
+        Node *cur = queue[head];
+        uint32_t id = (uint32_t)head++;
+        for (int side = 1; ok && side >= 0; side--) { //yes, then no
+            Node *child = node_child(cur, side);
+            if (!child) continue;
+            if (tail == cap) {
+                Node **tmp = (Node **)realloc(queue, sizeof(Node *) * cap * 2);
+                if (!tmp) { ok = 0; break; }
+                queue = tmp;
+                cap *= 2;
+            }
+            queue[tail++] = child;
+            uint32_t cid = ct_add(t, child->text, child->isQuestion);
+            if (cid == CT_NONE) { ok = 0; break; }
+            if (side) t->yes[id] = cid;
+            else t->no[id] = cid;
+        }
+    }
+    free(queue);
+    if (!ok) ct_free(t);
+    return ok;
+}
+
+uint32_t ct_child(const CompactTree *t, uint32_t i, int yes) {
+    return yes ? t->yes[i] : t->no[i];
+}
+
+const char *ct_text(const CompactTree *t, uint32_t i) {
+    return t->pool + t->textOff[i];
+}
+
+int ct_is_question(const CompactTree *t, uint32_t i) {
+    return (t->flags[i] & CT_QUESTION) != 0;
+}
+
+/* Nodes reachable from the root (undone splits are not). */
+uint32_t ct_count_reachable(const CompactTree *t) {
+    if (t->root == CT_NONE) return 0;
+    uint32_t *stack = (uint32_t *)malloc(sizeof(uint32_t) * ((size_t)t->count + 1));
+    if (!stack) return 0;
+    uint32_t top = 0, seen = 0;
+    stack[top++] = t->root;
+    while (top > 0) { //a full binary tree never holds more than count + 1 entries
+        uint32_t i = stack[--top];
+        seen++;
+        if (t->no[i] != CT_NONE) stack[top++] = t->no[i];
+        if (t->yes[i] != CT_NONE) stack[top++] = t->yes[i];
+    }
+    free(stack);
+    return seen;
+}
+
+/* Same contract as apply_insert_split: oldLeaf (the child of parent on the
+ * wasYesChild side, or the root) moves under a new question whose newYes
+ * side is the new animal. Both texts must be non-empty and oldLeaf must be
+ * a leaf sitting in that slot. Returns the new question's id. */
+uint32_t ct_insert_split(CompactTree *t, uint32_t parent, int wasYesChild, uint32_t oldLeaf,
+                         const char *question, const char *animal, int newYes) {
+    if (!question || !animal || !question[0] || !animal[0]) return CT_NONE;
+    if (oldLeaf >= t->count || (parent != CT_NONE && parent >= t->count)) return CT_NONE;
+    if (ct_is_question(t, oldLeaf)) return CT_NONE; //only a leaf can be split
+    uint32_t slot = parent == CT_NONE ? t->root : ct_child(t, parent, wasYesChild);
+    if (slot != oldLeaf) return CT_NONE; //oldLeaf is not where the edit says
+    redo_clear(t); //before adding, so reclaimed ids are reused
+    uint32_t first = t->count;
+    size_t poolLen = t->poolLen;
+    uint32_t q = ct_add(t, question, 1);
+    uint32_t a = q == CT_NONE ? CT_NONE : ct_add(t, animal, 0);
+    CtEdit e = { parent, wasYesChild, oldLeaf, q, a };
+    if (a == CT_NONE || !edit_push(&t->undo, &t->undoCount, &t->undoCap, e)) {
+        t->count = first; //nothing links to the new nodes yet
+        t->poolLen = poolLen;
+        return CT_NONE;
+    }
+    t->yes[q] = newYes ? a : oldLeaf;
+    t->no[q] = newYes ? oldLeaf : a;
+    set_slot(t, &e, q);
+    return q;
+}
+
+int ct_undo(CompactTree *t) {
+    if (t->undoCount == 0) return 0;
+    CtEdit e = t->undo[t->undoCount - 1];
+    if (!edit_push(&t->redo, &t->redoCount, &t->redoCap, e)) return 0;
+    t->undoCount--;
+    set_slot(t, &e, e.oldLeaf); //the question keeps its link to oldLeaf for redo
+    return 1;
+}
+
+int ct_redo(CompactTree *t) {
+    if (t->redoCount == 0) return 0;
+    CtEdit e = t->redo[t->redoCount - 1];
+    if (!edit_push(&t->undo, &t->undoCount, &t->undoCap, e)) return 0;
+    t->redoCount--;
+    set_slot(t, &e, e.newQuestion);
+    return 1;
+}
+
+/* Same rules as check_integrity, plus ids must be in range and no node may be
+ * reached twice (indices make cycles and shared subtrees possible). */
+int ct_check_integrity(const CompactTree *t) {
+    if (t->root == CT_NONE) return 1; //empty is valid
+    if (t->root >= t->count) return 0;
+    uint8_t *seen = (uint8_t *)calloc(t->count, 1);
+    uint32_t *queue = (uint32_t *)malloc(sizeof(uint32_t) * t->count);
+    if (!seen || !queue) { free(seen); free(queue); return 0; }
+
+    uint32_t head = 0, tail = 0;
+    int valid = 1;
+    queue[tail++] = t->root;
+    seen[t->root] = 1;
+    while (valid && head < tail) {
+        uint32_t i = queue[head++];
+        uint32_t y = t->yes[i], n = t->no[i];
+        if (!ct_is_question(t, i)) {
+            valid = y == CT_NONE && n == CT_NONE; //leaves have no kids
+            continue;
+        }
+        if (y >= t->count || n >= t->count || seen[y] || seen[n] || y == n) {
+            valid = 0;
+            break;
+        }
+        seen[y] = seen[n] = 1;
+        queue[tail++] = y;
+        queue[tail++] = n;
+    }
+    free(seen);
+    free(queue);
+    return valid;
+}
@@ -1,13 +1,19 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE  /* MAP_ANONYMOUS */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <limits.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "lab5.h"
 
 static int edit_is_applied(const Edit *e) {
     if (e->newQuestion == NULL) return 0; //if no new node, it just returns nothing
     if (e->parent == NULL) return g_root == e->newQuestion; //compares it with the root if there is no parent
+    node_ready(e->parent);
     if (e->wasYesChild)    return e->parent->yes == e->newQuestion; //if it was a yes side child, compares it with that
     return e->parent->no  == e->newQuestion; //all other cases covered so compares no-child
 }
@@ -19,17 +25,309 @@ static void free_detached_edit(Edit *e) {
         if (e->newQuestion) { //frees the newQuestion subtree
             // its other child (newLeaf) is ours to free explicitly
             if (e->newLeaf) { //frees the new created leaf
-                if (e->newLeaf->text) free(e->newLeaf->text);
-                free(e->newLeaf); //frees every edited part of new leaf and the the leaf node itself
+                free_node(e->newLeaf); //frees every edited part of new leaf and the the leaf node itself
                 e->newLeaf = NULL;
             }
-            if (e->newQuestion->text) free(e->newQuestion->text); //goes back and frees the question
-            free(e->newQuestion);
+            free_node(e->newQuestion); //goes back and frees the question
             e->newQuestion = NULL;
         }
     }
 }
 
+/* ========== Bulk Node Blocks ========== */
+
+/* Every block that still has live nodes, sorted by node address so that
+ * freeing a node finds its block by binary search. tb_discard() only clears
+ * a slot; cleared ones are swept out when a block is added or when they make
+ * up half the slots, so freeing a tree of many blocks stays O(log) a node. */
+typedef struct {
+    uintptr_t start;  //the block's node array
+    TreeBlock *block; //NULL once discarded
+} BlockSlot;
+
+static BlockSlot *g_blocks = NULL;
+static int g_block_count = 0, g_block_cap = 0, g_block_dead = 0;
+static int g_intern_on = 1;         //see String Interning
+static NodeMap g_share = { NULL, 0, 0 };  //link counts of NODE_SHARED nodes, see Subtree Sharing
+static int share_unlink(Node *n);
+static void animal_index_forget(const Node *root);
+
+static void blocks_sweep(void) {
+    int j = 0;
+    for (int i = 0; i < g_block_count; i++) {
+        if (g_blocks[i].block) g_blocks[j++] = g_blocks[i];
+    }
+    g_block_count = j;
+    g_block_dead = 0;
+}
+
+/* Number of slots whose node array starts at or below p. */
+static int blocks_upper(uintptr_t p) {
+    int lo = 0, hi = g_block_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (g_blocks[mid].start <= p) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int blocks_add(TreeBlock *b) {
+    if (g_block_dead) blocks_sweep(); //a new block may reuse a discarded one's address
+    if (g_block_count == g_block_cap) {
+        int newcap = g_block_cap ? g_block_cap * 2 : 16;
+        BlockSlot *tmp = (BlockSlot *)realloc(g_blocks, sizeof(BlockSlot) * (size_t)newcap);
+        if (!tmp) return 0;
+        g_blocks = tmp;
+        g_block_cap = newcap;
+    }
+    uintptr_t start = (uintptr_t)b->nodes;
+    int i = blocks_upper(start);
+    memmove(g_blocks + i + 1, g_blocks + i, sizeof(BlockSlot) * (size_t)(g_block_count - i));
+    g_blocks[i].start = start;
+    g_blocks[i].block = b;
+    g_block_count++;
+    return 1;
+}
+
+/* The live block holding n, or NULL. */
+static TreeBlock *blocks_find(const Node *n) {
+    uintptr_t p = (uintptr_t)n;
+    int i = blocks_upper(p) - 1;
+    if (i < 0 || !g_blocks[i].block) return NULL;
+    TreeBlock *b = g_blocks[i].block;
+    return p < (uintptr_t)(b->nodes + b->count) ? b : NULL;
+}
+
+static void blocks_remove(TreeBlock *b) {
+    int i = blocks_upper((uintptr_t)b->nodes) - 1;
+    if (i < 0 || g_blocks[i].block != b) return;
+    g_blocks[i].block = NULL;
+    if (++g_block_dead * 2 > g_block_count) blocks_sweep();
+}
+
+/* Allocates and registers a block without touching its nodes, so reserving
+ * a huge block costs the same as a small one. */
+TreeBlock *tb_reserve(int count) {
+    if (count <= 0) return NULL;
+    TreeBlock *b = (TreeBlock *)calloc(1, sizeof(TreeBlock));
+    if (!b) return NULL;
+    b->nodes = (Node *)calloc((size_t)count, sizeof(Node)); //one allocation for every node
+    if (!b->nodes || !blocks_add(b)) { //registers so free_node can find it
+        free(b->nodes);
+        free(b);
+        return NULL;
+    }
+    b->count = count;
+    b->live = count;
+    return b;
+}
+
+/* Like tb_reserve, but the nodes are an anonymous mapping of their own
+ * instead of malloc memory, so a pager may drop their pages (they read
+ * back as zeroes) without pulling memory from under the allocator. */
+TreeBlock *tb_reserve_pages(int count) {
+    if (count <= 0) return NULL;
+    TreeBlock *b = (TreeBlock *)calloc(1, sizeof(TreeBlock));
+    if (!b) return NULL;
+    size_t bytes = (size_t)count * sizeof(Node);
+    void *nodes = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (nodes == MAP_FAILED) { free(b); return NULL; }
+    b->nodes = (Node *)nodes;
+    b->nodesMapped = bytes;
+    if (!blocks_add(b)) {
+        munmap(nodes, bytes);
+        free(b);
+        return NULL;
+    }
+    b->count = count;
+    b->live = count;
+    return b;
+}
+
+/* Allocates a block with room for count nodes, all flagged NODE_IN_BLOCK.
+ * The caller fills text/children and may attach the text storage. */
+TreeBlock *tb_create(int count) {
+    TreeBlock *b = tb_reserve(count);
+    if (!b) return NULL;
+    for (int i = 0; i < count; i++) b->nodes[i].flags = NODE_IN_BLOCK;
+    return b;
+}
+
+void tb_attach_memory(TreeBlock *b, void *mem, size_t len,
+                      void (*release_mem)(void *mem, size_t len)) {
+    b->mem = mem;
+    b->memLen = len;
+    b->release_mem = release_mem;
+}
+
+/* Unlinks and releases the block regardless of how many nodes are live. */
+void tb_discard(TreeBlock *b) {
+    if (!b) return;
+    blocks_remove(b); //unlinks from the registry
+    if (b->release_mem) b->release_mem(b->mem, b->memLen);
+    if (b->nodesMapped) munmap(b->nodes, b->nodesMapped);
+    else free(b->nodes);
+    free(b);
+}
+
+/* One block node has been freed; the block goes away with its last node.
+ * An interned text is the node's own reference and goes with it. */
+static void tb_release_node(Node *n) {
+    if (n->flags & NODE_INTERNED) str_release(n->text);
+    TreeBlock *b = blocks_find(n);
+    if (b && --b->live == 0) tb_discard(b);
+}
+
+/* ========== Lazy Children ========== */
+
+static void (*g_resolve_node)(Node *n) = NULL;
+
+void set_node_resolver(void (*resolve)(Node *n)) {
+    g_resolve_node = resolve;
+}
+
+Node *node_ready(Node *n) {
+    if (n && g_resolve_node) g_resolve_node(n); //blocks until n is filled in
+    return n;
+}
+
+Node *node_child(Node *n, int yes) {
+    node_ready(n); //n itself may have been paged out since it was reached
+    return node_ready(yes ? n->yes : n->no);
+}
+
+/* ========== Node Pool ==========
+ * Nodes come from 64 KiB slabs of Node-sized cells and texts from slabs of
+ * 16..256-byte cells, so building a tree costs one malloc per slab instead
+ * of two per node, and nodes made together sit together. Freed cells go on
+ * per-size free lists for the next constructor; slabs are kept until exit.
+ * Texts longer than the biggest class are malloc'd. */
+#define POOL_SLAB_BYTES (64 * 1024)
+#define POOL_TEXT_CLASSES 5
+#define POOL_MAX_TEXT (16 << (POOL_TEXT_CLASSES - 1))
+
+typedef struct PoolCell {
+    struct PoolCell *next;
+} PoolCell;
+
+static int g_pool_on = 1;
+static PoolCell *g_pool_slabs = NULL;   //every slab, first cell links them
+static PoolCell *g_free_nodes = NULL;
+static PoolCell *g_free_texts[POOL_TEXT_CLASSES];
+static PoolStats g_pool = { 0, 0, 0, 0 };
+
+void set_node_pool(int on) {
+    g_pool_on = on ? 1 : 0;
+}
+
+void pool_stats(PoolStats *out) {
+    *out = g_pool;
+}
+
+static int text_class(size_t bytes) {
+    int c = 0;
+    while ((size_t)(16 << c) < bytes) c++;
+    return c;
+}
+
+/* Cuts a new slab into cells, lowest address handed out first. */
+static int pool_refill(PoolCell **list, size_t cell) {
+    char *slab = (char *)malloc(POOL_SLAB_BYTES);
+    if (!slab) return 0;
+    g_pool.mallocs++;
+    g_pool.slabBytes += POOL_SLAB_BYTES;
+    PoolCell *head = (PoolCell *)slab; //first cell keeps the slab reachable
+    head->next = g_pool_slabs;
+    g_pool_slabs = head;
+    size_t first = cell > sizeof(PoolCell) ? cell : sizeof(PoolCell);
+    first = (first + cell - 1) / cell * cell;
+    for (size_t off = POOL_SLAB_BYTES / cell * cell; off > first; ) {
+        off -= cell;
+        PoolCell *c = (PoolCell *)(slab + off);
+        c->next = *list;
+        *list = c;
+    }
+    return 1;
+}
+
+static void *pool_take(PoolCell **list, size_t cell) {
+    if (!*list && !pool_refill(list, cell)) return NULL;
+    PoolCell *c = *list;
+    *list = c->next;
+    return c;
+}
+
+static void pool_give(PoolCell **list, void *p) {
+    PoolCell *c = (PoolCell *)p;
+    c->next = *list;
+    *list = c;
+}
+
+static Node *node_alloc(void) {
+    Node *n;
+    if (g_pool_on) {
+        n = (Node *)pool_take(&g_free_nodes, sizeof(Node));
+    } else {
+        n = (Node *)malloc(sizeof(Node));
+        if (n) g_pool.mallocs++;
+    }
+    if (!n) return NULL;
+    n->flags = g_pool_on ? NODE_POOLED : 0;
+    g_pool.nodesLive++;
+    return n;
+}
+
+void set_text_interning(int on) {
+    g_intern_on = on ? 1 : 0;
+}
+
+/* Copies text into storage matching how n was allocated, or takes a
+ * reference to the shared copy when interning is on (and flags n so). */
+static char *text_copy(Node *n, const char *text) {
+    if (g_intern_on) {
+        char *t = (char *)str_intern(text);
+        if (t) n->flags |= NODE_INTERNED;
+        return t;
+    }
+    n->flags &= ~NODE_INTERNED;
+    size_t bytes = strlen(text) + 1;
+    char *t;
+    if ((n->flags & NODE_POOLED) && bytes <= POOL_MAX_TEXT) {
+        int c = text_class(bytes);
+        t = (char *)pool_take(&g_free_texts[c], (size_t)16 << c);
+    } else {
+        t = (char *)malloc(bytes);
+        if (t) g_pool.mallocs++;
+    }
+    if (!t) return NULL;
+    memcpy(t, text, bytes);
+    g_pool.textsLive++;
+    return t;
+}
+
+/* interned says how the text was taken: text_copy may have changed n's flag since. */
+static void text_release(const Node *n, char *text, int interned) {
+    if (!text) return;
+    if (interned) {
+        str_release(text);
+        return;
+    }
+    size_t bytes = strlen(text) + 1; //texts never change length, so this is the class
+    if ((n->flags & NODE_POOLED) && bytes <= POOL_MAX_TEXT) {
+        pool_give(&g_free_texts[text_class(bytes)], text);
+    } else {
+        free(text);
+    }
+    g_pool.textsLive--;
+}
+
+static void node_release(Node *n) {
+    if (n->flags & NODE_POOLED) pool_give(&g_free_nodes, n);
+    else free(n);
+    g_pool.nodesLive--;
+}
+
 /* ========== Node Functions ========== */
 
 /* TODO 1: Implement create_question_node
@@ -42,16 +340,20 @@ static void free_detached_edit(Edit *e) {
 Node *create_question_node(const char *question) {
     // TODO: Implement this function
     if (!question) return NULL;  //First check to see if valid question
-    Node *n = (Node *)malloc(sizeof(Node)); //allocate size for a node
+    Node *n = node_alloc(); //pooled (or malloc'd) node
     if (!n) return NULL; //if malloc fails, returns NULL
-    n->text = strdup(question); //copies question into the text of the node
+    n->text = text_copy(n, question); //copies question into the text of the node
     if (!n->text) { //if text ptr doesn't exist it frees the node to avoid errors in empty pointers
-        free(n);
+        node_release(n);
         return NULL;
     }
     n->isQuestion = 1; //sets the node to question mode
     n->yes = NULL; //initialize yes and no ptrs and returns the node
     n->no = NULL;
+    n->parent = NULL;
+    n->nodes = 1; //childless until linked, which counts as a leaf
+    n->leaves = 1;
+    node_rehash(n);
     return n;
 }
 
@@ -62,47 +364,843 @@ Node *create_question_node(const char *question) {
 Node *create_animal_node(const char *animal) {
     // TODO: Implement this function
     if (!animal) return NULL;
-    Node *n = (Node *)malloc(sizeof(Node)); //allocates memory
+    Node *n = node_alloc(); //allocates memory
     if (!n) return NULL;
-    n->text = strdup(animal); //puts the animal input into the text of the node
+    n->text = text_copy(n, animal); //puts the animal input into the text of the node
     if (!n->text) {
-        free(n); //if strdup fails it frees it so nomemory leaks
+        node_release(n); //if the copy fails it frees it so nomemory leaks
         return NULL;
     }
     n->isQuestion = 0; //sets it to animal node
     n->yes = NULL; //initializes its children
     n->no = NULL;
+    n->parent = NULL;
+    n->nodes = 1; //a subtree of just itself
+    n->leaves = 1;
+    node_rehash(n);
     return n;
 }
 
-/* TODO 3: Implement free_tree (recursive)
- * - This is one of the few recursive functions allowed
+/* Releases a single node (not its children). Constructor nodes return
+ * their text and struct to the pool (or heap); block nodes are handed back
+ * to their TreeBlock. A shared node only loses one of its links. */
+void free_node(Node *node) {
+    if (!node_ready(node)) return; //a paged-out node reads as zero until rebuilt
+    animal_index_forget(node); //its address may come back as another tree's root
+    if ((node->flags & NODE_SHARED) && share_unlink(node) > 0) return;
+    if (node->flags & NODE_IN_BLOCK) {
+        tb_release_node(node);
+        return;
+    }
+    text_release(node, node->text, (node->flags & NODE_INTERNED) != 0);
+    node_release(node);
+}
+
+/* Swaps in a copy of text; block nodes keep theirs (it lives in the block).
+ * The hashes of n and its ancestors follow. */
+int node_set_text(Node *n, const char *text) {
+    if (!n || !text || (n->flags & NODE_IN_BLOCK)) return 0;
+    int wasInterned = (n->flags & NODE_INTERNED) != 0;
+    char *t = text_copy(n, text);
+    if (!t) return 0;
+    text_release(n, n->text, wasInterned);
+    n->text = t;
+    tree_adjust(n, 0, 0);
+    if (!n->isQuestion) animal_index_invalidate(); //renamed animal
+    return 1;
+}
+
+/* free_tree() without a stack, for when the stack cannot grow: rotating the
+ * yes child up until there is none turns the subtree into a chain down the
+ * no links, freed as it goes. n's own link must already be dropped. */
+static void free_tree_rotating(Node *n) {
+    while (n) {
+        Node *yes = node_child(n, 1);
+        if (yes && (yes->flags & NODE_SHARED) && share_unlink(yes) > 0) { //other parents keep it
+            n->yes = NULL;
+            continue;
+        }
+        if (yes) { //yes comes up, n goes down its no side
+            n->yes = node_child(yes, 0);
+            yes->no = n;
+            n = yes;
+            continue;
+        }
+        Node *no = node_child(n, 0);
+        if (no && (no->flags & NODE_SHARED) && share_unlink(no) > 0) no = NULL;
+        free_node(n);
+        n = no;
+    }
+}
+
+/* TODO 3: Implement free_tree
  * - Base case: if node is NULL, return
- * - Recursively free left subtree (yes)
- * - Recursively free right subtree (no)
- * - Free the text string
- * - Free the node itself
- * IMPORTANT: Free children before freeing the parent!
+ * - Free the yes subtree, the no subtree, then the node itself
+ * - Iterative (FrameStack): learning grows long one-sided chains, and a
+ *   recursive walk overflows the C stack on those
+ * - A shared subtree is only walked when its last link goes
+ * - Out of memory for the stack, the rest of a subtree is freed by rotation
+ * IMPORTANT: read the children before freeing the parent!
  */
 void free_tree(Node *node) {
     // TODO: Implement this function
     if (!node) return; //base case if node doesn't exist
-    free_tree(node->yes); //frees children, then the text, then the node itself
-    free_tree(node->no);
-    free(node->text);
-    free(node);
+    FrameStack st;
+    fs_init(&st);
+    if (!fs_push(&st, node, -1)) { //no stack at all
+        if (!(node->flags & NODE_SHARED) || share_unlink(node) == 0) free_tree_rotating(node);
+    }
+    while (!fs_empty(&st)) { //pops a node, pushes its kids, then frees the text and the node itself
+        Node *n = fs_pop(&st).node;
+        if ((n->flags & NODE_SHARED) && share_unlink(n) > 0) continue; //other parents still link it
+        Node *yes = node_child(n, 1), *no = node_child(n, 0);
+        int before = st.size;
+        if ((no && !fs_push(&st, no, -1)) || (yes && !fs_push(&st, yes, -1))) {
+            st.size = before; //the stack could not grow: n's subtree goes without it
+            free_tree_rotating(n);
+            continue;
+        }
+        free_node(n);
+    }
+    fs_free(&st);
 }
 
-/* TODO 4: Implement count_nodes (recursive)
- * - Base case: if root is NULL, return 0
- * - Return 1 + count of left subtree + count of right subtree
+/* TODO 4: Implement count_nodes
+ * - Return 0 for NULL, else the number of nodes under (and including) root
+ * - Walks the tree (iteratively); subtree_nodes() is the O(1) cached count
+ * - Returns -1 if the stack cannot grow, rather than a short count
  */
 int count_nodes(Node *root) {
     // TODO: Implement this function
-    //recursively counts the nodes going down the yes first and then the nos
+    //counts the nodes going down the yes first and then the nos
     if (!root) return 0;
-    return 1 + count_nodes(root->yes) + count_nodes(root->no);
-    return 0;
+    int count = 0;
+    FrameStack st;
+    fs_init(&st);
+    if (!fs_push(&st, root, -1)) count = -1;
+    while (!fs_empty(&st)) {
+        Node *n = fs_pop(&st).node;
+        count++;
+        Node *yes = node_child(n, 1), *no = node_child(n, 0);
+        if ((no && !fs_push(&st, no, -1)) || (yes && !fs_push(&st, yes, -1))) {
+            count = -1; //out of memory
+            break;
+        }
+    }
+    fs_free(&st);
+    return count;
+}
+
+/* ========== Subtree Counts ==========
+ * Every node keeps the node and leaf counts of its subtree and a link to its
+ * parent, so the size of any subtree is O(1). Edits keep them right in
+ * O(depth) with tree_adjust(); trees linked up by hand (or loaded) get them
+ * from one O(n) pass. The subtree hash rides along: an edit changes exactly
+ * the hashes on the path above it, which tree_adjust() walks anyway. */
+int subtree_nodes(const Node *n) {
+    return n ? n->nodes : 0;
+}
+
+int subtree_leaves(const Node *n) {
+    return n ? n->leaves : 0;
+}
+
+uint64_t node_hash(const Node *n) {
+    return n ? n->hash : 0;
+}
+
+/* Folds v into h through a 64-bit finalizer, so the order of the parts matters. */
+static uint64_t hash_step(uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* FNV-1a over the text, then the type and both children's hashes. */
+void node_rehash(Node *n) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)n->text; p && *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    h = hash_step(h, n->isQuestion ? 1u : 0u);
+    h = hash_step(h, node_hash(n->yes));
+    n->hash = hash_step(h, node_hash(n->no));
+}
+
+/* Adds the deltas to n and every ancestor of n, rehashing each on the way
+ * up (the links below must already be in place). */
+void tree_adjust(Node *n, int dNodes, int dLeaves) {
+    for (; n; n = n->parent) {
+        n->nodes += dNodes;
+        n->leaves += dLeaves;
+        node_rehash(n);
+    }
+}
+
+/* Iterative postorder: a frame is pushed with answeredYes 0 on the way down
+ * and revisited with 1 once both children are counted. Returns 0 if the
+ * stack could not grow, leaving counts above the missed subtrees wrong. */
+int tree_recount(Node *root) {
+    if (!node_ready(root)) return 1;
+    animal_index_forget(root); //linked up by hand, so its leaves may have changed
+    root->parent = NULL;
+    FrameStack st;
+    fs_init(&st);
+    int ok = fs_push(&st, root, 0);
+    while (!fs_empty(&st)) {
+        Frame f = fs_pop(&st);
+        Node *n = node_ready(f.node);
+        Node *yes = node_child(n, 1), *no = node_child(n, 0);
+        if (f.answeredYes) {
+            n->nodes = 1 + subtree_nodes(yes) + subtree_nodes(no);
+            n->leaves = (yes || no) ? subtree_leaves(yes) + subtree_leaves(no) : 1;
+            node_rehash(n);
+            continue;
+        }
+        fs_push(&st, n, 1); //fits where f was
+        if (no) { no->parent = n; if (!fs_push(&st, no, 0)) ok = 0; }
+        if (yes) { yes->parent = n; if (!fs_push(&st, yes, 0)) ok = 0; }
+    }
+    fs_free(&st);
+    return ok;
+}
+
+/* Same as tree_recount over a freshly built block rooted at nodes[0], in
+ * one backwards sweep over the array when children always come after
+ * their parents (BFS and preorder files both do). A file numbered any
+ * other way is still a tree, so it gets tree_recount instead. Without
+ * rehash the nodes keep the hashes they were loaded with. Returns 0 if the
+ * links are not a tree (a node linked twice, or the root linked), or if
+ * tree_recount runs out of memory. */
+int tb_count_subtrees(TreeBlock *b, int rehash) {
+    Node *root = &b->nodes[0];
+    int ordered = 1;
+    for (int i = b->count - 1; i >= 0; i--) {
+        Node *n = &b->nodes[i];
+        Node *kids[2] = { n->yes, n->no };
+        for (int k = 0; k < 2; k++) {
+            if (!kids[k]) continue;
+            if (kids[k] == root || kids[k]->parent) return 0; //a second parent: not a tree
+            kids[k]->parent = n;
+            if (kids[k] <= n) ordered = 0; //counted below before it was reached
+        }
+        n->nodes = 1 + subtree_nodes(n->yes) + subtree_nodes(n->no);
+        n->leaves = (n->yes || n->no) ? subtree_leaves(n->yes) + subtree_leaves(n->no) : 1;
+        if (rehash) node_rehash(n);
+    }
+    if (!ordered) return tree_recount(root); //every node has one parent, so the walk ends
+    return 1;
+}
+
+/* ========== Relayout ==========
+ * tree_compact() copies the live tree into one TreeBlock in an order that
+ * puts the nodes a game visits together next to each other, then frees the
+ * scattered originals. BFS keeps each level together, which suits shallow
+ * trees; van Emde Boas order splits the tree at half its height and lays
+ * out the top half, then each bottom subtree, the same way recursively, so
+ * any root-to-leaf path crosses O(log_B n) blocks of B nodes however deep
+ * the tree is. Edits that point at moved nodes are remapped. */
+#define LAYOUT_BFS_HEIGHT 20  /* auto: deeper trees get van Emde Boas order */
+
+typedef struct {
+    Node *node;
+    int height;  /* levels of this subtree to lay out (vEB) or depth (walks) */
+} LayoutItem;
+
+typedef struct {
+    LayoutItem *items;
+    int size;
+    int capacity;
+} LayoutStack;
+
+static int ls_push(LayoutStack *s, Node *node, int height) {
+    if (s->size == s->capacity) {
+        int newcap = s->capacity ? s->capacity * 2 : 64;
+        LayoutItem *tmp = (LayoutItem *)realloc(s->items, sizeof(LayoutItem) * (size_t)newcap);
+        if (!tmp) return 0;
+        s->items = tmp;
+        s->capacity = newcap;
+    }
+    s->items[s->size++] = (LayoutItem){ node, height };
+    return 1;
+}
+
+static void free_mem(void *mem, size_t len) {
+    (void)len;
+    free(mem);
+}
+
+/* Node count and height (in levels) of the tree under root. */
+static int measure_tree(Node *root, int *height) {
+    LayoutStack st = { NULL, 0, 0 };
+    int count = 0;
+    *height = 0;
+    if (!ls_push(&st, root, 1)) return -1;
+    while (st.size > 0) {
+        LayoutItem it = st.items[--st.size];
+        count++;
+        if (it.height > *height) *height = it.height;
+        Node *yes = node_child(it.node, 1), *no = node_child(it.node, 0);
+        if ((no && !ls_push(&st, no, it.height + 1)) || (yes && !ls_push(&st, yes, it.height + 1))) {
+            count = -1;
+            break;
+        }
+    }
+    free(st.items);
+    return count;
+}
+
+static int layout_bfs(Node *root, Node **out) {
+    int head = 0, tail = 0;
+    out[tail++] = root;
+    while (head < tail) { //out doubles as the queue
+        Node *n = out[head++];
+        if (n->yes) out[tail++] = n->yes;
+        if (n->no) out[tail++] = n->no;
+    }
+    return tail;
+}
+
+/* Items are (subtree root, levels to lay out). A subtree of h > 1 levels is
+ * replaced by its top h/2 levels followed by the subtrees hanging below them,
+ * left to right; the top is pushed last so it comes out first. */
+static int layout_veb(Node *root, int height, Node **out) {
+    LayoutStack work = { NULL, 0, 0 }, walk = { NULL, 0, 0 };
+    int count = 0, ok = ls_push(&work, root, height);
+    while (ok && work.size > 0) {
+        LayoutItem it = work.items[--work.size];
+        if (it.height == 1) {
+            out[count++] = it.node;
+            continue;
+        }
+        int top = it.height / 2;
+        int first = work.size;
+        // the roots `top` levels down, found yes-first and pushed in that order
+        walk.size = 0;
+        ok = ls_push(&walk, it.node, 0);
+        while (ok && walk.size > 0) {
+            LayoutItem w = walk.items[--walk.size];
+            if (w.height == top) {
+                ok = ls_push(&work, w.node, it.height - top);
+                continue;
+            }
+            if (w.node->no) ok = ls_push(&walk, w.node->no, w.height + 1);
+            if (ok && w.node->yes) ok = ls_push(&walk, w.node->yes, w.height + 1);
+        }
+        for (int i = first, j = work.size - 1; i < j; i++, j--) { //reverse: leftmost pops first
+            LayoutItem tmp = work.items[i];
+            work.items[i] = work.items[j];
+            work.items[j] = tmp;
+        }
+        if (ok) ok = ls_push(&work, it.node, top);
+    }
+    free(work.items);
+    free(walk.items);
+    return ok ? count : -1;
+}
+
+static Node *forwarded(Node *n) {
+    return (n && (n->flags & NODE_MOVED)) ? n->parent : n;
+}
+
+static void remap_edits(EditStack *s) {
+    for (int i = 0; i < s->size; i++) {
+        Edit *e = &s->edits[i];
+        e->parent = forwarded(e->parent);
+        e->oldLeaf = forwarded(e->oldLeaf);
+        e->newQuestion = forwarded(e->newQuestion);
+        e->newLeaf = forwarded(e->newLeaf);
+    }
+}
+
+int tree_compact(int layout) {
+    load_wait(); //every link final and nothing paged out
+    if (!g_root) return 1;
+    if (tree_is_shared()) return 0; //the layouts would copy a shared subtree once per link
+    int height, count = measure_tree(g_root, &height);
+    if (count <= 0) return 0;
+    if (layout == LAYOUT_AUTO) layout = height <= LAYOUT_BFS_HEIGHT ? LAYOUT_BFS : LAYOUT_VEB;
+
+    Node **order = (Node **)malloc(sizeof(Node *) * (size_t)count);
+    if (!order) return 0;
+    int laid = layout == LAYOUT_VEB ? layout_veb(g_root, height, order) : layout_bfs(g_root, order);
+    TreeBlock *b = laid == count ? tb_create(count) : NULL;
+    char *arena = NULL;
+    if (b && !g_intern_on) { //private copies: one arena, texts in node order
+        size_t bytes = 0;
+        for (int i = 0; i < count; i++) bytes += strlen(order[i]->text) + 1;
+        arena = (char *)malloc(bytes);
+        if (arena) tb_attach_memory(b, arena, bytes, free_mem);
+    }
+    if (!b || (!g_intern_on && !arena)) {
+        tb_discard(b);
+        free(order);
+        return 0;
+    }
+
+    // texts first: the old nodes stay untouched until nothing can fail
+    char *at = arena;
+    for (int i = 0; i < count; i++) {
+        Node *old = order[i], *n = &b->nodes[i];
+        if (g_intern_on) {
+            const char *t = str_intern(old->text);
+            if (!t) { //out of memory: undo the references taken so far
+                while (i-- > 0) str_release(b->nodes[i].text);
+                tb_discard(b);
+                free(order);
+                return 0;
+            }
+            n->text = (char *)t;
+            n->flags |= NODE_INTERNED;
+        } else {
+            size_t len = strlen(old->text) + 1;
+            memcpy(at, old->text, len);
+            n->text = at;
+            at += len;
+        }
+        n->isQuestion = old->isQuestion;
+        n->hash = old->hash;
+    }
+    for (int i = 0; i < count; i++) {
+        order[i]->parent = &b->nodes[i]; //forwarding address until the old node is freed
+        order[i]->flags |= NODE_MOVED;
+    }
+    for (int i = 0; i < count; i++) {
+        Node *n = &b->nodes[i];
+        n->yes = forwarded(order[i]->yes);
+        n->no = forwarded(order[i]->no);
+    }
+    tb_count_subtrees(b, 0); //copied from a tree, in an order with parents first
+
+    remap_edits(&g_undo);
+    remap_edits(&g_redo);
+    for (int i = 0; i < count; i++) free_node(order[i]);
+    free(order);
+    g_root = &b->nodes[0];
+    return 1;
+}
+
+/* ========== Node Map ========== */
+
+static size_t nm_hash(const Node *n) {
+    uint64_t x = (uint64_t)(uintptr_t)n; //mixed so nodes from one block spread out
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+NodeMapSlot *nm_get(const NodeMap *m, const Node *n) {
+    if (m->count == 0) return NULL;
+    size_t mask = m->cap - 1;
+    for (size_t i = nm_hash(n) & mask; m->slots[i].node; i = (i + 1) & mask) {
+        if (m->slots[i].node == n) return &m->slots[i];
+    }
+    return NULL;
+}
+
+int nm_reserve(NodeMap *m, size_t count) {
+    if (count * 2 <= m->cap) return 1;
+    size_t cap = m->cap ? m->cap : 16;
+    while (cap < count * 2) cap *= 2;
+    NodeMapSlot *slots = (NodeMapSlot *)calloc(cap, sizeof(NodeMapSlot));
+    if (!slots) return 0;
+    for (size_t i = 0; i < m->cap; i++) { //rehash into the bigger table
+        if (!m->slots[i].node) continue;
+        size_t j = nm_hash(m->slots[i].node) & (cap - 1);
+        while (slots[j].node) j = (j + 1) & (cap - 1);
+        slots[j] = m->slots[i];
+    }
+    free(m->slots);
+    m->slots = slots;
+    m->cap = cap;
+    return 1;
+}
+
+NodeMapSlot *nm_put(NodeMap *m, Node *n) {
+    NodeMapSlot *s = nm_get(m, n);
+    if (s) return s;
+    if (!nm_reserve(m, m->count + 1)) return NULL;
+    size_t mask = m->cap - 1, i = nm_hash(n) & mask;
+    while (m->slots[i].node) i = (i + 1) & mask;
+    m->slots[i].node = n;
+    m->slots[i].val = 0;
+    m->count++;
+    return &m->slots[i];
+}
+
+/* Backward-shift delete: entries further along the probe run move up into
+ * the hole unless that would put them before their home slot, so lookups
+ * never need tombstones. */
+void nm_remove(NodeMap *m, const Node *n) {
+    NodeMapSlot *s = nm_get(m, n);
+    if (!s) return;
+    size_t mask = m->cap - 1, hole = (size_t)(s - m->slots);
+    for (size_t i = (hole + 1) & mask; m->slots[i].node; i = (i + 1) & mask) {
+        size_t home = nm_hash(m->slots[i].node) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            m->slots[hole] = m->slots[i];
+            hole = i;
+        }
+    }
+    m->slots[hole].node = NULL;
+    m->count--;
+}
+
+void nm_free(NodeMap *m) {
+    free(m->slots);
+    m->slots = NULL;
+    m->cap = m->count = 0;
+}
+
+/* ========== Subtree Sharing ==========
+ * Only nodes with two or more links have an entry in g_share (the count);
+ * every other node has exactly one and no entry. A shared node's parent
+ * pointer is whichever parent linked it last, so only nodes reached through
+ * single links all the way from the root (node_is_private) may have their
+ * counts adjusted in place. When a shared node drops back to one link its
+ * entry stays until a walk that knows the remaining parent settles it. */
+
+static int share_refs(const Node *n) {
+    if (!(n->flags & NODE_SHARED)) return 1;
+    NodeMapSlot *s = nm_get(&g_share, n);
+    return s ? s->val : 1;
+}
+
+/* One more parent links n. The caller has reserved room in g_share. */
+static void share_link(Node *n) {
+    NodeMapSlot *s = nm_put(&g_share, n);
+    if (!s) return;
+    if (!(n->flags & NODE_SHARED)) {
+        s->val = 1;
+        n->flags |= NODE_SHARED;
+    }
+    s->val++;
+}
+
+/* One parent let go of n; returns the links left (0: n is the caller's to free). */
+static int share_unlink(Node *n) {
+    if (!(n->flags & NODE_SHARED)) return 0;
+    NodeMapSlot *s = nm_get(&g_share, n);
+    int left = s ? --s->val : 0;
+    if (left <= 0) {
+        nm_remove(&g_share, n);
+        n->flags &= ~NODE_SHARED;
+        left = 0;
+    }
+    return left;
+}
+
+/* n is down to one link, and it is known to come from parent. */
+static void share_settle(Node *n, Node *parent) {
+    nm_remove(&g_share, n);
+    n->flags &= ~NODE_SHARED;
+    n->parent = parent;
+}
+
+int tree_is_shared(void) {
+    return g_share.count > 0;
+}
+
+int node_is_private(const Node *n) {
+    for (; n; n = n->parent) {
+        if (n->flags & NODE_SHARED) return 0;
+    }
+    return 1;
+}
+
+void share_stats(ShareStats *out) {
+    ShareStats st = { 0, 0, 0 };
+    for (size_t i = 0; i < g_share.cap; i++) { //every extra link repeats its whole subtree
+        const NodeMapSlot *s = &g_share.slots[i];
+        if (!s->node || s->val < 2) continue;
+        st.sharedNodes++;
+        st.nodesSaved += (long)(s->val - 1) * s->node->nodes;
+    }
+    st.bytesSaved = (size_t)st.nodesSaved * sizeof(Node);
+    *out = st;
+}
+
+/* Hash-consing table: every distinct (text, isQuestion, yes, no) seen so far,
+ * children already being the kept copies, so equal keys mean equal subtrees. */
+typedef struct {
+    Node *node;
+    unsigned hash;
+} ConsSlot;
+
+static unsigned cons_hash(const Node *n) {
+    unsigned h = h_hash(n->text) ^ (unsigned)n->isQuestion;
+    h = h * 31u + (unsigned)nm_hash(n->yes);
+    return h * 31u + (unsigned)nm_hash(n->no);
+}
+
+/* The node already in the table with n's key, or NULL; *at gets the free slot. */
+static Node *cons_find(ConsSlot *t, size_t mask, const Node *n, unsigned hash, size_t *at) {
+    size_t i = hash & mask;
+    for (; t[i].node; i = (i + 1) & mask) {
+        const Node *c = t[i].node;
+        if (t[i].hash == hash && c->isQuestion == n->isQuestion && c->yes == n->yes &&
+            c->no == n->no && (c->text == n->text || strcmp(c->text, n->text) == 0)) {
+            return t[i].node;
+        }
+    }
+    if (at) *at = i;
+    return NULL;
+}
+
+/* Sets or clears NODE_PINNED from every node an edit points at up to the root. */
+static void pin_edits(const EditStack *s, int on) {
+    for (int i = 0; i < s->size; i++) {
+        const Edit *e = &s->edits[i];
+        Node *ends[4] = { e->parent, e->oldLeaf, e->newQuestion, e->newLeaf };
+        for (int k = 0; k < 4; k++) {
+            for (Node *n = ends[k]; n && ((n->flags & NODE_PINNED) != 0) != on; n = n->parent) {
+                if (on) n->flags |= NODE_PINNED;
+                else n->flags &= ~NODE_PINNED;
+            }
+        }
+    }
+}
+
+/* A duplicate's last link is gone: its children (the kept copies, which
+ * its twin links too) lose a link and the node itself is freed. */
+static void free_duplicate(Node *x) {
+    Node *keep = x->parent;
+    Node *kids[2] = { x->yes, x->no };
+    for (int k = 0; k < 2; k++) {
+        if (!kids[k]) continue;
+        if (kids[k]->parent == x) kids[k]->parent = keep;
+        share_unlink(kids[k]);
+    }
+    x->flags &= ~NODE_MOVED;
+    free_node(x);
+}
+
+/* Points n's links at the kept copies of its children. */
+static void relink_children(Node *n) {
+    for (int side = 1; side >= 0; side--) {
+        Node **link = side ? &n->yes : &n->no;
+        Node *c = *link;
+        if (!c) continue;
+        Node *keep = forwarded(c);
+        if (keep != c) {
+            share_link(keep);
+            *link = keep;
+            if (share_unlink(c) == 0) free_duplicate(c);
+        }
+        if (!(keep->flags & NODE_SHARED)) keep->parent = n;
+        else if (share_refs(keep) == 1) share_settle(keep, n);
+    }
+}
+
+/* Postorder over the stored nodes (LayoutItem.height 0 on the way down, 1
+ * on the way up). Going up, a node's links are moved to the kept copies of
+ * its children, then the node is either kept (added to the table) or marked
+ * NODE_MOVED toward its twin; its parents relink it when they go up, and the
+ * last one frees it. A node reached again through a second link is skipped:
+ * it is then in the table itself, or already moved. */
+int tree_share(void) {
+    load_wait(); //every link final and nothing paged out
+    if (!g_root) return 1;
+    int height, count = measure_tree(g_root, &height);
+    if (count <= 0) return 0;
+
+    size_t cap = 16;
+    while (cap < (size_t)count * 2) cap *= 2;
+    ConsSlot *table = (ConsSlot *)calloc(cap, sizeof(ConsSlot));
+    // the walk never holds more than a node and a sibling per level, and at
+    // most one node in two can end up shared: nothing below can fail
+    LayoutStack st = { NULL, 0, 2 * height + 2 };
+    st.items = (LayoutItem *)malloc(sizeof(LayoutItem) * (size_t)st.capacity);
+    if (!table || !st.items || !nm_reserve(&g_share, g_share.count + (size_t)count / 2 + 1)) {
+        free(table);
+        free(st.items);
+        return 0;
+    }
+    size_t mask = cap - 1;
+    pin_edits(&g_undo, 1);
+    pin_edits(&g_redo, 1);
+
+    ls_push(&st, g_root, 0);
+    while (st.size > 0) {
+        LayoutItem it = st.items[--st.size];
+        Node *n = it.node;
+        if (!it.height) {
+            if (n->flags & NODE_MOVED) continue;
+            if ((n->flags & NODE_SHARED) && cons_find(table, mask, n, cons_hash(n), NULL) == n) continue;
+            ls_push(&st, n, 1);
+            if (n->no) ls_push(&st, n->no, 0);
+            if (n->yes) ls_push(&st, n->yes, 0);
+            continue;
+        }
+        relink_children(n);
+        if (n->flags & NODE_PINNED) continue; //an edit may relink it: stays private
+        size_t at;
+        unsigned hash = cons_hash(n);
+        Node *twin = cons_find(table, mask, n, hash, &at);
+        if (twin) {
+            n->parent = twin; //forwarding address until the last link is moved
+            n->flags |= NODE_MOVED;
+        } else {
+            table[at].node = n;
+            table[at].hash = hash;
+        }
+    }
+
+    pin_edits(&g_undo, 0);
+    pin_edits(&g_redo, 0);
+    free(st.items);
+    free(table);
+    animal_index_invalidate(); //merged leaves were freed
+    return 1;
+}
+
+/* Copy-on-write before an edit. frames[0] is g_root and frames[i].answeredYes
+ * says which side of frames[i - 1] frames[i] hangs on. From the first node
+ * with another parent down, every node on the path is replaced by a private
+ * copy (the frames are updated); links the copies take to the nodes beside
+ * the path make those shared. Also settles shared nodes that are down to the
+ * link the path came through. */
+int tree_unshare(FrameStack *path) {
+    if (!tree_is_shared() || path->size == 0) return 1;
+    int first = -1;
+    for (int i = 1; i < path->size; i++) { //the root has no parent to share it
+        Node *n = path->frames[i].node;
+        if (!(n->flags & NODE_SHARED)) continue;
+        if (share_refs(n) > 1) { first = i; break; }
+        share_settle(n, path->frames[i - 1].node);
+    }
+    if (first < 0) return 1;
+
+    int len = path->size - first;
+    Node **copy = (Node **)calloc((size_t)len, sizeof(Node *));
+    int ok = copy && nm_reserve(&g_share, g_share.count + (size_t)len + 1);
+    for (int k = 0; ok && k < len; k++) {
+        Node *orig = path->frames[first + k].node;
+        copy[k] = orig->isQuestion ? create_question_node(orig->text) : create_animal_node(orig->text);
+        ok = copy[k] != NULL;
+    }
+    if (!ok) {
+        for (int k = 0; copy && k < len; k++) free_node(copy[k]);
+        free(copy);
+        return 0;
+    }
+
+    for (int k = 0; k < len; k++) {
+        Node *orig = path->frames[first + k].node, *c = copy[k];
+        c->yes = orig->yes;
+        c->no = orig->no;
+        c->nodes = orig->nodes;
+        c->leaves = orig->leaves;
+        c->hash = orig->hash;
+        c->parent = k ? copy[k - 1] : path->frames[first - 1].node;
+        if (k + 1 < len) { //the path goes on through the copy below
+            int yes = path->frames[first + k + 1].answeredYes == 1;
+            if (yes) c->yes = copy[k + 1];
+            else c->no = copy[k + 1];
+            Node *beside = yes ? orig->no : orig->yes;
+            if (beside) share_link(beside);
+        } else {
+            if (c->yes) share_link(c->yes);
+            if (c->no) share_link(c->no);
+        }
+    }
+    Node *above = path->frames[first - 1].node;
+    if (path->frames[first].answeredYes == 1) above->yes = copy[0];
+    else above->no = copy[0];
+    share_unlink(path->frames[first].node); //still linked from elsewhere
+    for (int k = 0; k < len; k++) path->frames[first + k].node = copy[k];
+    free(copy);
+    animal_index_invalidate(); //the path's leaf is a new node now
+    return 1;
+}
+
+/* Walks every stored node once (NodeMap value: links seen * 2, plus 1 while
+ * the node is on the walk's path) and compares the shared ones' links with
+ * g_share. */
+int share_check(Node *root) {
+    if (!root) return 1;
+    NodeMap seen = { NULL, 0, 0 };
+    LayoutStack st = { NULL, 0, 0 };
+    int valid = (root->flags & NODE_SHARED) == 0 && ls_push(&st, root, 0);
+    while (valid && st.size > 0) {
+        LayoutItem it = st.items[--st.size];
+        if (it.height) {
+            nm_get(&seen, it.node)->val &= ~1;
+            continue;
+        }
+        NodeMapSlot *s = nm_put(&seen, it.node);
+        if (!s) { valid = 0; break; }
+        if (s->val) { //second link: fine only for a shared node, never into its own path
+            valid = (it.node->flags & NODE_SHARED) && !(s->val & 1);
+            s->val += 2;
+            continue;
+        }
+        s->val = 3;
+        Node *yes = node_child(it.node, 1), *no = node_child(it.node, 0);
+        valid = ls_push(&st, it.node, 1) && (!no || ls_push(&st, no, 0)) &&
+                (!yes || ls_push(&st, yes, 0));
+    }
+    for (size_t i = 0; valid && i < seen.cap; i++) { //other trees may hold shared nodes too
+        NodeMapSlot *s = &seen.slots[i];
+        if (s->node && (s->node->flags & NODE_SHARED)) valid = s->val / 2 == share_refs(s->node);
+    }
+    nm_free(&seen);
+    free(st.items);
+    return valid;
+}
+
+/* Loads of shared images: counts every node's links, marks the ones linked
+ * more than once and fills the subtree counts (and hashes, with rehash)
+ * with a postorder walk that visits each node once. Fails, leaving g_share
+ * alone, unless the links form one DAG rooted at node 0 that reaches every
+ * node. */
+int tb_share_links(TreeBlock *b, int rehash) {
+    int *links = (int *)calloc((size_t)b->count, sizeof(int));
+    unsigned char *state = (unsigned char *)calloc((size_t)b->count, 1); //1 on the path, 2 counted
+    LayoutStack st = { NULL, 0, 0 };
+    long shared = 0;
+    int ok = links && state && ls_push(&st, &b->nodes[0], 0);
+    for (int i = 0; ok && i < b->count; i++) {
+        Node *n = &b->nodes[i];
+        if (n->yes && links[n->yes - b->nodes]++ == 1) shared++;
+        if (n->no && links[n->no - b->nodes]++ == 1) shared++;
+    }
+    ok = ok && links[0] == 0 && nm_reserve(&g_share, g_share.count + (size_t)shared);
+    while (ok && st.size > 0) {
+        LayoutItem it = st.items[--st.size];
+        Node *n = it.node;
+        int i = (int)(n - b->nodes);
+        if (it.height) {
+            n->nodes = 1 + subtree_nodes(n->yes) + subtree_nodes(n->no);
+            n->leaves = (n->yes || n->no) ? subtree_leaves(n->yes) + subtree_leaves(n->no) : 1;
+            if (n->yes) n->yes->parent = n;
+            if (n->no) n->no->parent = n;
+            if (rehash) node_rehash(n);
+            state[i] = 2;
+            continue;
+        }
+        if (state[i] == 2) continue; //counted through another link
+        if (state[i] == 1) { ok = 0; break; } //a cycle
+        state[i] = 1;
+        ok = ls_push(&st, n, 1) && (!n->no || ls_push(&st, n->no, 0)) &&
+             (!n->yes || ls_push(&st, n->yes, 0));
+    }
+    for (int i = 0; ok && i < b->count; i++) ok = state[i] == 2;
+    for (int i = 0; ok && i < b->count; i++) {
+        if (links[i] < 2) continue;
+        NodeMapSlot *s = nm_put(&g_share, &b->nodes[i]);
+        s->val = links[i];
+        b->nodes[i].flags |= NODE_SHARED;
+    }
+    if (ok) b->nodes[0].parent = NULL;
+    free(links);
+    free(state);
+    free(st.items);
+    return ok;
 }
 
 /* ========== Frame Stack (for iterative tree traversal) ========== */
@@ -117,6 +1215,7 @@ void fs_init(FrameStack *s) {
     s->capacity = 16; //initializes capacity to 16
     s->size = 0; //initializes to empty stack
     s->frames = (Frame *)malloc(sizeof(Frame) * s->capacity); //allocates memory for the stack
+    if (!s->frames) s->capacity = 0; //the first push tries again
 }
 
 /* TODO 6: Implement fs_push
@@ -124,15 +1223,16 @@ void fs_init(FrameStack *s) {
  *   - If so, double the capacity and reallocate the array
  * - Store the node and answeredYes in frames[size]
  * - Increment size
+ * - Returns 1, or 0 (frame not pushed) if the array cannot grow
  */
-void fs_push(FrameStack *s, Node *node, int answeredYes) {
+int fs_push(FrameStack *s, Node *node, int answeredYes) {
     // TODO: Implement this function
     if (s->size >= s->capacity) { //if it needs to grow, it can
-        int newcap = s->capacity * 2; //allocating twice capacity if needed
+        int newcap = s->capacity ? s->capacity * 2 : 16; //allocating twice capacity if needed
         Frame *newframes = (Frame *)realloc(s->frames, sizeof(Frame) * newcap);
         if (!newframes) { //if it doesn't allocate then just return
             // Allocation failed; do not change state
-            return;
+            return 0;
         }
         s->frames = newframes; //change to the new allocated memory and capacity
         s->capacity = newcap;
@@ -140,6 +1240,7 @@ void fs_push(FrameStack *s, Node *node, int answeredYes) {
     s->frames[s->size].node = node; //sets the node
     s->frames[s->size].answeredYes = answeredYes; //sets the flag
     s->size += 1; //grows the size of the stack
+    return 1;
 }
 
 /* TODO 7: Implement fs_pop
@@ -288,124 +1389,883 @@ void q_enqueue(Queue *q, Node *node, int id) {
     qn->id = id; //sets the id
     qn->next = NULL; //added to the back of queue so next pointer is null
 
-    if (q->rear == NULL) { //if its empty
-        q->front = qn; //the head is the new node
-        q->rear = qn; //the tail is the new node
-    } else {
-        q->rear->next = qn; //if not it is linked at the tail 
-        q->rear = qn; //the tail to this node
+    if (q->rear == NULL) { //if its empty
+        q->front = qn; //the head is the new node
+        q->rear = qn; //the tail is the new node
+    } else {
+        q->rear->next = qn; //if not it is linked at the tail 
+        q->rear = qn; //the tail to this node
+    }
+    q->size += 1; //increase size of the queue
+}
+
+/* TODO 17: Implement q_dequeue
+ * - If queue is empty (front == NULL), return 0
+ * - Save the front node's data to output parameters (*node, *id)
+ * - Save front in a temp variable
+ * - Move front to front->next
+ * - If front is now NULL, set rear to NULL too
+ * - Free the temp node
+ * - Decrement size
+ * - Return 1
+ */
+int q_dequeue(Queue *q, Node **node, int *id) {
+    // TODO: Implement this function
+
+    //takes the head temporarily, outputs the node, outputs the id, advances the hea
+    //checks if queue is empty and clears the tail if so, then frees the old head, decreases the size
+    //and returns 1 if it succeeds
+    if (q->front == NULL) return 0;
+    QueueNode *tmp = q->front;
+    if (node) *node = tmp->treeNode;
+    if (id) *id = tmp->id;
+    q->front = tmp->next;
+    if (q->front == NULL) {
+        q->rear = NULL;
+    }
+    free(tmp);
+    q->size -= 1;
+    return 1;
+}
+
+/* TODO 18: Implement q_empty
+ * Return 1 if size == 0, otherwise 0
+ */
+int q_empty(Queue *q) {
+    // TODO: Implement this function
+    return q->size == 0 ? 1 : 0; //1 if empty
+    
+}
+
+/* TODO 19: Implement q_free
+ * - Dequeue all remaining nodes
+ * - Use a loop with q_dequeue until queue is empty
+ */
+void q_free(Queue *q) {
+    // TODO: Implement this function
+    Node *n = NULL; //temporary node pointer
+    int id = 0; //id to set all of the queue to
+    while (q_dequeue(q, &n, &id)) { //dequeues everything with NULL and id=0
+        /* nothing else to do */
+    }
+}
+
+/* ========== Hash Table ========== */
+
+/* TODO 20: Implement canonicalize
+ * Convert a string to canonical form for hashing:
+ * - Convert to lowercase
+ * - Keep only alphanumeric characters
+ * - Replace spaces with underscores
+ * - Remove punctuation
+ * Example: "Does it meow?" -> "does_it_meow"
+ * 
+ * Steps:
+ * - Allocate result buffer (strlen(s) + 1)
+ * - Iterate through input string
+ * - For each character:
+ *   - If alphanumeric: add lowercase version to result
+ *   - If whitespace: add underscore
+ *   - Otherwise: skip it
+ * - Null-terminate result
+ * - Return the new string
+ */
+/* What canonicalize() writes for ASCII byte c: itself lowercased, '_' for
+ * whitespace, or 0 for a byte it drops. The answers isalnum, tolower and
+ * isspace give, without a locale lookup per byte. */
+static const unsigned char canon_ascii[128] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, '_', '_', '_', '_', '_', 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    '_', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 0, 0, 0, 0, 0, 0,
+    0, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', 0, 0, 0, 0, 0,
+    0, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', 0, 0, 0, 0, 0,
+};
+
+/* The same for a code point past ASCII: its lowercase if it is a letter,
+ * '_' for a space, 0 to drop it. Not all of Unicode: it knows the cases of
+ * Latin-1, Latin Extended-A, Greek, Cyrillic and fullwidth Latin, drops the
+ * punctuation and symbol blocks, and keeps anything else as it is (most of
+ * the rest are caseless letters, CJK included). */
+static uint32_t canon_fold(uint32_t c) {
+    if (c < 0x80) return canon_ascii[c];
+    if (c < 0x100) {
+        if (c == 0x85 || c == 0xA0) return '_'; //next line, no-break space
+        if (c == 0xAA || c == 0xB5 || c == 0xBA) return c;
+        if (c < 0xC0 || c == 0xD7 || c == 0xF7) return 0; //controls, signs, x and divide
+        return c <= 0xDE ? c + 0x20 : c;
+    }
+    if (c < 0x180) { //Latin Extended-A: capital, then small
+        if (c == 0x130) return 'i';
+        if (c == 0x178) return 0xFF;
+        if ((c < 0x138 || (c >= 0x14A && c < 0x178)) && !(c & 1)) return c + 1;
+        if (((c >= 0x139 && c < 0x149) || c >= 0x179) && c < 0x17F && (c & 1)) return c + 1;
+        return c;
+    }
+    if (c >= 0x370 && c < 0x400) { //Greek
+        if (c == 0x37E || c == 0x387 || c == 0x384 || c == 0x385) return 0; //question mark, ano teleia, tonos
+        if (c == 0x386) return 0x3AC;
+        if (c >= 0x388 && c <= 0x38A) return c + 0x25;
+        if (c == 0x38C) return 0x3CC;
+        if (c == 0x38E || c == 0x38F) return c + 0x3F;
+        if (c >= 0x391 && c <= 0x3AB && c != 0x3A2) return c + 0x20;
+        return c;
+    }
+    if (c >= 0x400 && c < 0x500) { //Cyrillic
+        if (c < 0x410) return c + 0x50;
+        if (c < 0x430) return c + 0x20;
+        if (c == 0x482) return 0; //thousands sign
+        if (c == 0x4C0) return 0x4CF;
+        if (((c >= 0x460 && c < 0x482) || (c >= 0x48A && c < 0x4C0) || c >= 0x4D0) && !(c & 1)) return c + 1;
+        if (c >= 0x4C1 && c < 0x4CF && (c & 1)) return c + 1;
+        return c;
+    }
+    if (c == 0x1680 || c == 0x3000) return '_';
+    if (c >= 0x2000 && c < 0x2070) { //general punctuation
+        if (c <= 0x200A || c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F) return '_';
+        return 0;
+    }
+    if (c >= 0x20A0 && c < 0x2100) return 0; //currency
+    if (c >= 0x2190 && c < 0x2C00) return 0; //arrows, maths, shapes, dingbats
+    if (c > 0x3000 && c < 0x3040 && (c < 0x3005 || c > 0x3007)) return 0; //CJK punctuation
+    if ((c >= 0xE000 && c < 0xF900) || (c >= 0xFE00 && c < 0xFE10) || c == 0xFEFF) return 0;
+    if (c >= 0xFF01 && c <= 0xFF5E) { //fullwidth ASCII
+        uint32_t a = canon_ascii[c - 0xFEE0];
+        return a ? a + 0xFEE0 : 0;
+    }
+    if (c >= 0xFF5F && c < 0xFF66) return 0;
+    if ((c >= 0x1F000 && c < 0x1FB00) || c >= 0xE0000) return 0; //emoji, tags
+    return c;
+}
+
+/* Decodes the UTF-8 sequence at p into *c and returns its length, or 0 if it
+ * is malformed (truncated, overlong, a surrogate or past U+10FFFF). Never
+ * reads past the terminator, which is not a continuation byte. */
+static int utf8_decode(const unsigned char *p, uint32_t *c) {
+    int n;
+    uint32_t min;
+    if (p[0] >= 0xC2 && p[0] < 0xE0) { n = 2; *c = p[0] & 0x1F; min = 0x80; }
+    else if (p[0] >= 0xE0 && p[0] < 0xF0) { n = 3; *c = p[0] & 0x0F; min = 0x800; }
+    else if (p[0] >= 0xF0 && p[0] < 0xF5) { n = 4; *c = p[0] & 0x07; min = 0x10000; }
+    else return 0;
+    for (int i = 1; i < n; i++) {
+        if ((p[i] & 0xC0) != 0x80) return 0;
+        *c = (*c << 6) | (p[i] & 0x3F);
+    }
+    if (*c < min || *c > 0x10FFFF || (*c >= 0xD800 && *c < 0xE000)) return 0;
+    return n;
+}
+
+static int utf8_encode(uint32_t c, unsigned char *out) {
+    if (c < 0x80) { out[0] = (unsigned char)c; return 1; }
+    if (c < 0x800) {
+        out[0] = (unsigned char)(0xC0 | (c >> 6));
+        out[1] = (unsigned char)(0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = (unsigned char)(0xE0 | (c >> 12));
+        out[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+        out[2] = (unsigned char)(0x80 | (c & 0x3F));
+        return 3;
+    }
+    out[0] = (unsigned char)(0xF0 | (c >> 18));
+    out[1] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+    out[2] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+    out[3] = (unsigned char)(0x80 | (c & 0x3F));
+    return 4;
+}
+
+/* Canonical bytes of the character at p into out (*n of them, at most as
+ * many as it read); returns the bytes read. A malformed byte is dropped on
+ * its own and the next one is tried as a fresh character. */
+static int canon_char(const unsigned char *p, unsigned char *out, int *n) {
+    if (*p < 0x80) {
+        out[0] = canon_ascii[*p];
+        *n = out[0] != 0;
+        return 1;
+    }
+    uint32_t c;
+    int used = 2;
+    if (p[0] >= 0xC2 && p[0] < 0xE0 && (p[1] & 0xC0) == 0x80) c = ((uint32_t)(p[0] & 0x1F) << 6) | (p[1] & 0x3F); //Latin, Greek, Cyrillic
+    else used = utf8_decode(p, &c);
+    if (!used) { *n = 0; return 1; }
+    c = canon_fold(c);
+    *n = c ? utf8_encode(c, out) : 0;
+    return used;
+}
+
+#ifdef __SSE2__
+/* Sixteen ASCII bytes at once: letters lowered and whitespace made '_' in
+ * *v. Returns a bit per byte canonicalize() keeps. */
+static unsigned canon_block(__m128i *v) {
+    __m128i x = *v;
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1)));
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                 _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('\t' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('\r' + 1))));
+    x = _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+    *v = _mm_or_si128(_mm_andnot_si128(space, x), _mm_and_si128(space, _mm_set1_epi8('_')));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, space)));
+}
+#endif
+
+/* canonicalize(s), len bytes, into dst with room for cap bytes counting the
+ * terminator. Returns the length, or -1 if it does not fit (it is never
+ * longer than s). Sixteen ASCII bytes go per step; a block holding anything
+ * else is taken a character at a time. */
+static long canon_write(char *dst, size_t cap, const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    unsigned char *out = (unsigned char *)dst, c[4];
+    size_t i = 0, j = 0;
+    while (i < len) {
+        size_t end = len;
+#ifdef __SSE2__
+        if (len - i >= 16 && j + 16 < cap) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            if (!_mm_movemask_epi8(v)) { //all ASCII
+                unsigned kept = canon_block(&v);
+                _mm_storeu_si128((__m128i *)(out + j), v);
+                if (kept == 0xFFFF) j += 16; //the usual case: nothing dropped
+                else { //squeeze the dropped bytes out, in place
+                    unsigned char *q = out + j;
+                    int n = 0;
+                    for (int k = 0; k < 16; k++) {
+                        q[n] = q[k];
+                        n += (kept >> k) & 1;
+                    }
+                    j += (size_t)n;
+                }
+                i += 16;
+                continue;
+            }
+            end = i + 16;
+        }
+#endif
+        while (i < end) {
+            int n;
+            if (p[i] < 0x80) { //ASCII in a mixed block or the tail
+                unsigned char a = canon_ascii[p[i++]];
+                if (!a) continue;
+                if (j + 1 >= cap) return -1;
+                out[j++] = a;
+            } else if (j + 4 < cap) { //room for any character: write in place
+                i += canon_char(p + i, out + j, &n);
+                j += (size_t)n;
+            } else {
+                i += canon_char(p + i, c, &n);
+                if (j + n >= cap) return -1;
+                for (int k = 0; k < n; k++) out[j++] = c[k];
+            }
+        }
+    }
+    out[j] = '\0'; //terminator
+    return (long)j;
+}
+
+char *canonicalize(const char *s) {
+    // TODO: Implement this function
+    if (!s) return NULL;
+    size_t len = strlen(s);
+    char *out = (char *)malloc(len + 1); //worst-case memory allocation
+    if (!out) return NULL;
+    //keeps letters and digits lowercased, maps whitespace to underscore, skips the rest
+    canon_write(out, len + 1, s, len);
+    return out;
+}
+
+/* ---- canonical form on the fly: the same bytes canonicalize() would
+ * write, read straight from the text with no copy ---- */
+typedef struct {
+    const unsigned char *p;
+    unsigned char buf[4]; //canonical bytes of the current character
+    int n, at;
+} CanonReader;
+
+static void canon_open(CanonReader *r, const char *text) {
+    r->p = (const unsigned char *)text;
+    r->n = r->at = 0;
+}
+
+/* Next canonical byte, or -1 at the end of the text. */
+static int canon_getc(CanonReader *r) {
+    while (r->at == r->n) {
+        if (!*r->p) return -1;
+        r->at = 0;
+        r->p += canon_char(r->p, r->buf, &r->n);
+    }
+    return r->buf[r->at++];
+}
+
+static size_t canon_len(const char *text) {
+    CanonReader r;
+    size_t n = 0;
+    canon_open(&r, text);
+    while (canon_getc(&r) >= 0) n++;
+    return n;
+}
+
+/* Next n canonical bytes into dst. */
+static void canon_fill(CanonReader *r, unsigned char *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) dst[i] = (unsigned char)canon_getc(r);
+}
+
+/* strcmp(stored, canonicalize(text)) == 0, without the copy. */
+static int canon_equal(const char *stored, const char *text) {
+    const unsigned char *k = (const unsigned char *)stored;
+    CanonReader r;
+    canon_open(&r, text);
+    for (;;) {
+        int c = canon_getc(&r);
+        if (c < 0) return *k == '\0';
+        if (c != *k++) return 0;
+    }
+}
+
+/* canonicalize(text) into buf in one pass when it is under CANON_STACK
+ * bytes (questions read by play_game always are); NULL if it is longer,
+ * and the caller hashes and compares the text itself, canonicalizing as it
+ * goes. Either way no heap copy is made. */
+#define CANON_STACK 256
+
+static const char *canon_stack(const char *text, char *buf) {
+    return canon_write(buf, CANON_STACK, text, strlen(text)) < 0 ? NULL : buf;
+}
+
+/* Writes canonicalize(text) into dst (size: canon_len(text) + 1 bytes). */
+static void canon_copy(char *dst, size_t size, const char *text) {
+    canon_write(dst, size, text, strlen(text));
+}
+
+/* TODO 21: Implement h_hash (djb2 algorithm)
+ * unsigned hash = 5381;
+ * For each character c in the string:
+ *   hash = ((hash << 5) + hash) + c;  // hash * 33 + c
+ * Return hash
+ */
+unsigned h_hash(const char *s) {
+    // TODO: Implement this function
+    unsigned hash = 5381u; //this is the seed
+    if (!s) return hash;
+    for (const unsigned char *p = (const unsigned char *)s; *p; ++p) {
+        hash = ((hash << 5) + hash) + *p; //hash *33 +c
+    }
+    return hash;
+}
+
+/* h_hash(canonicalize(text)) with no copy. */
+static unsigned h_hash_canon(const char *text) {
+    unsigned hash = 5381u;
+    CanonReader r;
+    canon_open(&r, text);
+    for (int c; (c = canon_getc(&r)) >= 0;) hash = ((hash << 5) + hash) + (unsigned)c;
+    return hash;
+}
+
+/* 64-bit string hash in the style of wyhash: eight bytes per multiply
+ * instead of one, and every output bit depends on every input bit, so keys
+ * that differ only after a long shared "does_it_" prefix still spread. Read
+ * in host byte order; the values are only ever used in memory. */
+#define WY0 0xa0761d6478bd642full
+#define WY1 0xe7037ed1a0b428dbull
+#define WY2 0x8ebc6af09c88c6e3ull
+
+/* Both halves of the 128-bit product, folded. */
+static uint64_t wy_mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __extension__ unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+    return lo ^ hi;
+#endif
+}
+
+static uint64_t wy_read8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint64_t wy_read4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t wy_seed(size_t len) {
+    return WY0 ^ wy_mix(WY0 ^ (uint64_t)len, WY1);
+}
+
+/* A key of at most 16 bytes: two overlapping reads from each end. */
+static uint64_t wy_short(const unsigned char *p, size_t len, uint64_t seed) {
+    uint64_t a = 0, b = 0;
+    if (len >= 4) {
+        size_t mid = (len >> 3) << 2;
+        a = (wy_read4(p) << 32) | wy_read4(p + mid);
+        b = (wy_read4(p + len - 4) << 32) | wy_read4(p + len - 4 - mid);
+    } else if (len > 0) {
+        a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+    }
+    return wy_mix(WY1 ^ (uint64_t)len, wy_mix(a ^ WY1, b ^ seed) ^ WY2);
+}
+
+/* Longer keys: 16 bytes per step, then the last 16 (overlapping). */
+static uint64_t wy_block(const unsigned char *p, uint64_t seed) {
+    return wy_mix(wy_read8(p) ^ WY1, wy_read8(p + 8) ^ seed);
+}
+
+static uint64_t wy_tail(const unsigned char *last16, size_t len, uint64_t seed) {
+    return wy_mix(WY1 ^ (uint64_t)len, wy_mix(wy_read8(last16) ^ WY1, wy_read8(last16 + 8) ^ seed) ^ WY2);
+}
+
+uint64_t h_hash64(const char *s) {
+    if (!s) return 0;
+    const unsigned char *p = (const unsigned char *)s;
+    size_t len = strlen(s), i = len;
+    uint64_t seed = wy_seed(len);
+    if (len <= 16) return wy_short(p, len, seed);
+    for (; i > 16; i -= 16, p += 16) seed = wy_block(p, seed);
+    return wy_tail(p + i - 16, len, seed);
+}
+
+/* h_hash64(canonicalize(text)) with no copy: the canonical bytes are made
+ * 16 at a time into buf, which keeps the last block for the tail read. */
+static uint64_t h_hash64_canon(const char *text) {
+    CanonReader r;
+    unsigned char buf[32];
+    size_t len = canon_len(text), i = len;
+    canon_open(&r, text);
+    uint64_t seed = wy_seed(len);
+    if (len <= 16) {
+        canon_fill(&r, buf, len);
+        return wy_short(buf, len, seed);
+    }
+    for (; i > 16; i -= 16) {
+        canon_fill(&r, buf, 16);
+        seed = wy_block(buf, seed);
+    }
+    canon_fill(&r, buf + 16, i); //buf[0..16) still holds the last block
+    return wy_tail(buf + i, len, seed);
+}
+
+//helpers
+/* The 32 bits a table stores and indexes with: h_hash, or h_hash64 folded.
+ * raw: key is text still to be canonicalized (the h_*_text calls). */
+static unsigned h_key_hash(const Hash *h, const char *key, int raw) {
+    if (!(h->flags & HASH_WIDE)) return raw ? h_hash_canon(key) : h_hash(key);
+    uint64_t x = raw ? h_hash64_canon(key) : h_hash64(key);
+    return (unsigned)(x ^ (x >> 32));
+}
+
+static int h_key_equal(const char *stored, const char *key, int raw) {
+    return raw ? canon_equal(stored, key) : strcmp(stored, key) == 0;
+}
+
+/* Bucket of hash among n; HASH_WIDE tables are powers of two and mask. */
+static unsigned h_slot(const Hash *h, unsigned hash, int n) {
+    return (h->flags & HASH_WIDE) ? hash & ((unsigned)n - 1) : hash % (unsigned)n;
+}
+
+/* ========== String Interning ==========
+ * One shared copy per distinct text, found through h_hash. Node texts and
+ * index keys take a reference with str_intern() and give it back with
+ * str_release(); the copy goes when its last reference does. The text sits
+ * right after its entry header, so releasing needs no lookup by content.
+ * Entries come from the text pool classes when they fit. */
+typedef struct InternEntry {
+    struct InternEntry *next;
+    unsigned hash;
+    unsigned refs;
+    unsigned len;
+    char text[];
+} InternEntry;
+
+static InternEntry **g_intern = NULL;
+static size_t g_intern_buckets = 0;  //power of two, at least one per string
+static InternStats g_intern_stats = { 0, 0, 0, 0 };
+
+void intern_stats(InternStats *out) {
+    *out = g_intern_stats;
+}
+
+static int intern_reserve(size_t strings) {
+    if (strings <= g_intern_buckets) return 1;
+    size_t n = g_intern_buckets ? g_intern_buckets : 1024;
+    while (n < strings) n *= 2;
+    InternEntry **b = (InternEntry **)calloc(n, sizeof(InternEntry *));
+    if (!b) return 0;
+    for (size_t i = 0; i < g_intern_buckets; i++) { //rehash with the stored hashes
+        InternEntry *e = g_intern[i];
+        while (e) {
+            InternEntry *next = e->next;
+            e->next = b[e->hash & (n - 1)];
+            b[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    free(g_intern);
+    g_intern = b;
+    g_intern_buckets = n;
+    return 1;
+}
+
+const char *str_intern(const char *s) {
+    if (!s) return NULL;
+    unsigned hash = h_hash(s);
+    if (g_intern) {
+        for (InternEntry *e = g_intern[hash & (g_intern_buckets - 1)]; e; e = e->next) {
+            if (e->hash == hash && strcmp(e->text, s) == 0) {
+                e->refs++;
+                g_intern_stats.refs++;
+                g_intern_stats.savedBytes += e->len + 1; //a copy that was not made
+                return e->text;
+            }
+        }
+    }
+    if (!intern_reserve((size_t)g_intern_stats.strings + 1)) return NULL;
+
+    size_t len = strlen(s);
+    size_t size = sizeof(InternEntry) + len + 1;
+    InternEntry *e;
+    if (size <= POOL_MAX_TEXT) {
+        int c = text_class(size);
+        e = (InternEntry *)pool_take(&g_free_texts[c], (size_t)16 << c);
+    } else {
+        e = (InternEntry *)malloc(size);
+        if (e) g_pool.mallocs++;
+    }
+    if (!e) return NULL;
+    g_pool.textsLive++;
+    memcpy(e->text, s, len + 1);
+    e->hash = hash;
+    e->refs = 1;
+    e->len = (unsigned)len;
+    e->next = g_intern[hash & (g_intern_buckets - 1)];
+    g_intern[hash & (g_intern_buckets - 1)] = e;
+    g_intern_stats.strings++;
+    g_intern_stats.refs++;
+    g_intern_stats.bytes += len + 1;
+    return e->text;
+}
+
+void str_release(const char *s) {
+    if (!s) return;
+    InternEntry *e = (InternEntry *)(s - offsetof(InternEntry, text));
+    g_intern_stats.refs--;
+    if (--e->refs > 0) {
+        g_intern_stats.savedBytes -= e->len + 1;
+        return;
+    }
+    for (InternEntry **pp = &g_intern[e->hash & (g_intern_buckets - 1)]; *pp; pp = &(*pp)->next) {
+        if (*pp == e) {
+            *pp = e->next;
+            break;
+        }
+    }
+    g_intern_stats.strings--;
+    g_intern_stats.bytes -= e->len + 1;
+    size_t size = sizeof(InternEntry) + e->len + 1;
+    if (size <= POOL_MAX_TEXT) pool_give(&g_free_texts[text_class(size)], e);
+    else free(e);
+    g_pool.textsLive--;
+}
+
+/* Points every node of a fully built block at the interned copy of its text
+ * and releases the block's text storage. Interning costs a lookup per node
+ * and only pays when texts repeat, so a block whose first INTERN_SAMPLE
+ * nodes are mostly new texts is left alone. All or nothing: returns 0 and
+ * the nodes keep their block texts if it skips or runs out of memory. */
+#define INTERN_SAMPLE 4096
+
+int tb_intern_texts(TreeBlock *b) {
+    if (!g_intern_on) return 0; //texts stay in the block
+    char **texts = (char **)malloc(sizeof(char *) * (size_t)b->count);
+    if (!texts) return 0;
+    long before = g_intern_stats.strings;
+    int ok = 1, i;
+    for (i = 0; ok && i < b->count; i++) {
+        if (i == INTERN_SAMPLE) {
+            long fresh = g_intern_stats.strings - before;
+            if (fresh * 2 > INTERN_SAMPLE) ok = 0; //under 2 nodes per new text
+            else ok = intern_reserve((size_t)(before + fresh * (b->count / INTERN_SAMPLE + 1)));
+            if (!ok) break;
+        }
+        texts[i] = (char *)str_intern(b->nodes[i].text);
+        if (!texts[i]) ok = 0;
+    }
+    if (!ok) {
+        while (i-- > 0) if (texts[i]) str_release(texts[i]);
+        free(texts);
+        return 0;
+    }
+    for (i = 0; i < b->count; i++) {
+        b->nodes[i].text = texts[i];
+        b->nodes[i].flags |= NODE_INTERNED;
+    }
+    free(texts);
+    if (b->release_mem) b->release_mem(b->mem, b->memLen);
+    tb_attach_memory(b, NULL, 0, NULL);
+    return 1;
+}
+
+/* ========== Open-Addressing Hash (HASH_OPEN) ==========
+ * Control bytes: CTRL_EMPTY, CTRL_DELETED, or 0..127, the slot's tag. A
+ * probe visits whole aligned groups (group g, g+1, g+3, g+6, ... covers
+ * every group of a power-of-two table) and stops at the first group with an
+ * empty slot, so a removal can leave an empty slot instead of a tombstone
+ * whenever its group still has one. */
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+/* 32-bit finalizer, so tag and group come from well-mixed bits of h_hash. */
+static unsigned oh_mix(unsigned x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/* Bit i set where group byte i equals b. */
+static unsigned oh_match(const unsigned char *group, unsigned char b) {
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < H_GROUP; i++) mask |= (unsigned)(group[i] == b) << i;
+    return mask;
+#endif
+}
+
+/* Bit i set where group byte i is empty or deleted (the top bit). */
+static unsigned oh_match_free(const unsigned char *group) {
+#ifdef __SSE2__
+    return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < H_GROUP; i++) mask |= (unsigned)(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static int lowest_bit(unsigned mask) {
+    int i = 0;
+    while (!(mask & 1u)) { mask >>= 1; i++; }
+    return i;
+}
+
+static int *oh_ids(OpenSlot *s) {
+    return s->capacity ? s->ids.heap : s->ids.inline_;
+}
+
+/* Slot holding key, or -1; *groups gets the groups probed. */
+static int oh_find(const OpenTable *t, const char *key, int raw, unsigned hash, int *groups) {
+    if (!t->ctrl) return -1;
+    unsigned m = oh_mix(hash), mask = (unsigned)t->capacity / H_GROUP - 1;
+    unsigned char tag = (unsigned char)(m & 0x7F);
+    unsigned g = (m >> 7) & mask;
+    for (unsigned step = 1; step <= mask + 1; g = (g + step++) & mask) {
+        const unsigned char *ctrl = t->ctrl + g * H_GROUP;
+        for (unsigned hits = oh_match(ctrl, tag); hits; hits &= hits - 1) {
+            int i = (int)(g * H_GROUP) + lowest_bit(hits);
+            const OpenSlot *s = &t->slots[i];
+            if (s->hash == hash && h_key_equal(t->arena + s->keyOff, key, raw)) {
+                if (groups) *groups = (int)step;
+                return i;
+            }
+        }
+        if (oh_match(ctrl, CTRL_EMPTY)) break; //nothing was ever pushed past this group
     }
-    q->size += 1; //increase size of the queue
+    return -1;
 }
 
-/* TODO 17: Implement q_dequeue
- * - If queue is empty (front == NULL), return 0
- * - Save the front node's data to output parameters (*node, *id)
- * - Save front in a temp variable
- * - Move front to front->next
- * - If front is now NULL, set rear to NULL too
- * - Free the temp node
- * - Decrement size
- * - Return 1
- */
-int q_dequeue(Queue *q, Node **node, int *id) {
-    // TODO: Implement this function
+/* First empty or deleted slot on hash's probe sequence (there always is one). */
+static int oh_free_slot(const OpenTable *t, unsigned hash) {
+    unsigned m = oh_mix(hash), mask = (unsigned)t->capacity / H_GROUP - 1;
+    unsigned g = (m >> 7) & mask;
+    for (unsigned step = 1;; g = (g + step++) & mask) {
+        unsigned free_ = oh_match_free(t->ctrl + g * H_GROUP);
+        if (free_) return (int)(g * H_GROUP) + lowest_bit(free_);
+    }
+}
 
-    //takes the head temporarily, outputs the node, outputs the id, advances the hea
-    //checks if queue is empty and clears the tail if so, then frees the old head, decreases the size
-    //and returns 1 if it succeeds
-    if (q->front == NULL) return 0;
-    QueueNode *tmp = q->front;
-    if (node) *node = tmp->treeNode;
-    if (id) *id = tmp->id;
-    q->front = tmp->next;
-    if (q->front == NULL) {
-        q->rear = NULL;
+/* Copies key, canonicalized on the way in when raw, to the arena's end. */
+static int arena_append(OpenTable *t, const char *key, int raw, uint32_t *off) {
+    size_t len = (raw ? canon_len(key) : strlen(key)) + 1;
+    if (t->arenaLen + len > UINT32_MAX) return 0; //offsets are 32-bit
+    if (t->arenaLen + len > t->arenaCap) {
+        size_t newcap = t->arenaCap ? t->arenaCap : 1024;
+        while (newcap < t->arenaLen + len) newcap *= 2;
+        char *tmp = (char *)realloc(t->arena, newcap);
+        if (!tmp) return 0;
+        t->arena = tmp;
+        t->arenaCap = newcap;
     }
-    free(tmp);
-    q->size -= 1;
+    if (raw) canon_copy(t->arena + t->arenaLen, len, key);
+    else memcpy(t->arena + t->arenaLen, key, len);
+    *off = (uint32_t)t->arenaLen;
+    t->arenaLen += len;
     return 1;
 }
 
-/* TODO 18: Implement q_empty
- * Return 1 if size == 0, otherwise 0
- */
-int q_empty(Queue *q) {
-    // TODO: Implement this function
-    return q->size == 0 ? 1 : 0; //1 if empty
-    
+/* Moves every live slot into a table of capacity slots, copying the keys
+ * into a fresh arena so removed ones are dropped. */
+static int oh_rehash(OpenTable *t, int capacity) {
+    OpenTable n;
+    memset(&n, 0, sizeof(n));
+    n.capacity = capacity;
+    n.ctrl = (unsigned char *)malloc((size_t)capacity);
+    n.slots = (OpenSlot *)malloc(sizeof(OpenSlot) * (size_t)capacity);
+    size_t live = t->arenaLen - t->arenaDead;
+    n.arenaCap = live > 1024 ? live : 1024;
+    n.arena = (char *)malloc(n.arenaCap);
+    if (!n.ctrl || !n.slots || !n.arena) {
+        free(n.ctrl);
+        free(n.slots);
+        free(n.arena);
+        return 0;
+    }
+    memset(n.ctrl, CTRL_EMPTY, (size_t)capacity);
+    for (int i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] & 0x80) continue; //empty or deleted
+        OpenSlot s = t->slots[i];
+        arena_append(&n, t->arena + s.keyOff, 0, &s.keyOff); //fits: sized for the live keys
+        int j = oh_free_slot(&n, s.hash);
+        n.ctrl[j] = t->ctrl[i];
+        n.slots[j] = s;
+    }
+    free(t->ctrl);
+    free(t->slots);
+    free(t->arena);
+    *t = n;
+    return 1;
 }
 
-/* TODO 19: Implement q_free
- * - Dequeue all remaining nodes
- * - Use a loop with q_dequeue until queue is empty
- */
-void q_free(Queue *q) {
-    // TODO: Implement this function
-    Node *n = NULL; //temporary node pointer
-    int id = 0; //id to set all of the queue to
-    while (q_dequeue(q, &n, &id)) { //dequeues everything with NULL and id=0
-        /* nothing else to do */
+static void oh_init(Hash *h, int nbuckets) {
+    int capacity = H_GROUP;
+    while (capacity < nbuckets && capacity <= INT_MAX / 2) capacity *= 2;
+    memset(&h->open, 0, sizeof(h->open));
+    h->open.capacity = capacity;
+    h->open.ctrl = (unsigned char *)malloc((size_t)capacity);
+    h->open.slots = (OpenSlot *)malloc(sizeof(OpenSlot) * (size_t)capacity);
+    if (!h->open.ctrl || !h->open.slots) {
+        free(h->open.ctrl);
+        free(h->open.slots);
+        memset(&h->open, 0, sizeof(h->open));
+        return;
     }
+    memset(h->open.ctrl, CTRL_EMPTY, (size_t)capacity);
 }
 
-/* ========== Hash Table ========== */
+static int oh_put(Hash *h, const char *key, int raw, int animalId) {
+    OpenTable *t = &h->open;
+    if (!t->ctrl) return 0;
+    unsigned hash = h_key_hash(h, key, raw);
+    int i = oh_find(t, key, raw, hash, NULL);
+    if (i >= 0) {
+        OpenSlot *s = &t->slots[i];
+        int *ids = oh_ids(s);
+        for (int k = 0; k < s->count; k++) {
+            if (ids[k] == animalId) return 0; //no change
+        }
+        int cap = s->capacity ? s->capacity : H_INLINE_IDS;
+        if (s->count == cap) { //inline ids move out, heap ones double
+            int *grown = (int *)malloc(sizeof(int) * (size_t)cap * 2);
+            if (!grown) return 0;
+            memcpy(grown, ids, sizeof(int) * (size_t)s->count);
+            if (s->capacity) free(s->ids.heap);
+            s->ids.heap = grown;
+            s->capacity = cap * 2;
+        }
+        oh_ids(s)[s->count++] = animalId;
+        return 1;
+    }
 
-/* TODO 20: Implement canonicalize
- * Convert a string to canonical form for hashing:
- * - Convert to lowercase
- * - Keep only alphanumeric characters
- * - Replace spaces with underscores
- * - Remove punctuation
- * Example: "Does it meow?" -> "does_it_meow"
- * 
- * Steps:
- * - Allocate result buffer (strlen(s) + 1)
- * - Iterate through input string
- * - For each character:
- *   - If alphanumeric: add lowercase version to result
- *   - If whitespace: add underscore
- *   - Otherwise: skip it
- * - Null-terminate result
- * - Return the new string
- */
-char *canonicalize(const char *s) {
-    // TODO: Implement this function
-    if (!s) return NULL;
-    size_t len = strlen(s);
-    char *out = (char *)malloc(len + 1); //worst-case memory allocation
-    if (!out) return NULL;
-    //writes the index, scans the input, reads the bytes and keeps letters and digits
-    //makes a lowercase copy and maps spaces with underscore
-    size_t j = 0;
-    for (size_t i = 0; i < len; ++i) {
-        unsigned char c = (unsigned char)s[i];
-        if (isalnum(c)) {
-            out[j++] = (char)tolower(c);
-        } else if (isspace(c)) {
-            out[j++] = '_';
+    //new key: room first (at most 7/8 full, tombstones included), and an
+    //arena that is mostly removed keys is compacted
+    int full = (long)(h->size + t->tombstones + 1) * 8 > (long)t->capacity * 7;
+    if (full || (t->arenaDead > 4096 && t->arenaDead * 2 > t->arenaLen)) {
+        int grow = (long)(h->size + 1) * 16 > (long)t->capacity * 7; //over half of 7/8 live: double
+        if (grow && t->capacity > INT_MAX / 2) return 0;
+        if (!oh_rehash(t, grow ? t->capacity * 2 : t->capacity)) return 0;
+    }
+    uint32_t off;
+    if (!arena_append(t, key, raw, &off)) return 0; //the only allocation a new key makes
+    i = oh_free_slot(t, hash);
+    if (t->ctrl[i] == CTRL_DELETED) t->tombstones--;
+    t->ctrl[i] = (unsigned char)(oh_mix(hash) & 0x7F);
+    OpenSlot *s = &t->slots[i];
+    s->hash = hash;
+    s->keyOff = off;
+    s->count = 1;
+    s->capacity = 0;
+    s->ids.inline_[0] = animalId;
+    h->size += 1;
+    return 1;
+}
+
+static int oh_remove(Hash *h, const char *key, int raw, int animalId) {
+    OpenTable *t = &h->open;
+    int i = oh_find(t, key, raw, h_key_hash(h, key, raw), NULL);
+    if (i < 0) return 0;
+    OpenSlot *s = &t->slots[i];
+    int *ids = oh_ids(s);
+    for (int k = 0; k < s->count; k++) {
+        if (ids[k] != animalId) continue;
+        ids[k] = ids[--s->count]; //order of the ids is not kept
+        if (s->count > 0) return 1;
+        if (s->capacity) free(s->ids.heap);
+        t->arenaDead += strlen(t->arena + s->keyOff) + 1;
+        const unsigned char *group = t->ctrl + (i & ~(H_GROUP - 1));
+        if (oh_match(group, CTRL_EMPTY)) {
+            t->ctrl[i] = CTRL_EMPTY; //no probe ever went past this group
         } else {
-            /* skip punctuation and other symbols */
+            t->ctrl[i] = CTRL_DELETED;
+            t->tombstones++;
         }
+        h->size -= 1;
+        return 1;
     }
-    out[j] = '\0'; //terminator
-    return out;
+    return 0;
 }
 
-/* TODO 21: Implement h_hash (djb2 algorithm)
- * unsigned hash = 5381;
- * For each character c in the string:
- *   hash = ((hash << 5) + hash) + c;  // hash * 33 + c
- * Return hash
- */
-unsigned h_hash(const char *s) {
-    // TODO: Implement this function
-    unsigned hash = 5381u; //this is the seed
-    if (!s) return hash;
-    for (const unsigned char *p = (const unsigned char *)s; *p; ++p) {
-        hash = ((hash << 5) + hash) + *p; //hash *33 +c
+static void oh_stats(const Hash *h, HashStats *out) {
+    const OpenTable *t = &h->open;
+    out->entries = h->size;
+    out->buckets = t->capacity;
+    for (int i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] & 0x80) {
+            if (t->ctrl[i] == CTRL_EMPTY) out->emptyBuckets++;
+            continue;
+        }
+        int groups = 0;
+        oh_find(t, t->arena + t->slots[i].keyOff, 0, t->slots[i].hash, &groups);
+        out->probes[groups < H_PROBE_HIST ? groups - 1 : H_PROBE_HIST - 1]++;
+        if (groups > out->maxChain) out->maxChain = groups;
     }
-    return hash;
+}
+
+static void oh_free(Hash *h) {
+    OpenTable *t = &h->open;
+    for (int i = 0; t->ctrl && i < t->capacity; i++) {
+        if (!(t->ctrl[i] & 0x80) && t->slots[i].capacity) free(t->slots[i].ids.heap);
+    }
+    free(t->ctrl);
+    free(t->slots);
+    free(t->arena);
+    memset(t, 0, sizeof(*t));
+    h->size = 0;
 }
 
 /* TODO 22: Implement h_init
@@ -418,6 +2278,99 @@ void h_init(Hash *h, int nbuckets) {
     h->nbuckets = nbuckets > 0 ? nbuckets : 1; //bucket counts
     h->size = 0; //initializes it
     h->buckets = (Entry **)calloc((size_t)h->nbuckets, sizeof(Entry *)); //zeroes the buckets
+    h->old = NULL; //not resizing
+    h->oldBuckets = 0;
+    h->moved = 0;
+    h->maxLoad = H_DEFAULT_LOAD;
+    h->flags = HASH_CHAINED;
+    memset(&h->open, 0, sizeof(h->open));
+}
+
+void h_init_as(Hash *h, int nbuckets, int flags) {
+    if (!(flags & HASH_OPEN)) {
+        int n = 1;
+        while ((flags & HASH_WIDE) && n < nbuckets && n <= INT_MAX / 2) n *= 2; //masked, not divided
+        h_init(h, (flags & HASH_WIDE) ? n : nbuckets);
+        h->flags = flags;
+        return;
+    }
+    memset(h, 0, sizeof(*h)); //no buckets: only the open table is used
+    h->maxLoad = H_DEFAULT_LOAD;
+    h->flags = flags;
+    oh_init(h, nbuckets);
+}
+
+void h_set_max_load(Hash *h, double maxLoad) {
+    h->maxLoad = maxLoad > 0 ? maxLoad : 0;
+}
+
+//helpers
+/* Moves up to steps old buckets into the new table; frees old once empty. */
+static void h_rehash_steps(Hash *h, int steps) {
+    for (; h->old && steps > 0; steps--) {
+        Entry *e = h->old[h->moved];
+        while (e) { //stored hashes: no key is read
+            Entry *next = e->next;
+            unsigned idx = h_slot(h, e->hash, h->nbuckets);
+            e->next = h->buckets[idx];
+            h->buckets[idx] = e;
+            e = next;
+        }
+        h->old[h->moved++] = NULL;
+        if (h->moved == h->oldBuckets) {
+            free(h->old);
+            h->old = NULL;
+            h->oldBuckets = 0;
+            h->moved = 0;
+        }
+    }
+}
+
+/* Starts a resize once the table is past its load factor. One still under
+ * way is finished first; that only happens with maxLoad under
+ * 1 / H_REHASH_STEP, as the move takes oldBuckets / H_REHASH_STEP puts and
+ * the next doubling maxLoad * oldBuckets. */
+static void h_maybe_grow(Hash *h) {
+    if (h->maxLoad <= 0 || h->size <= h->maxLoad * h->nbuckets || h->nbuckets > INT_MAX / 2) return;
+    if (h->old) h_rehash_steps(h, h->oldBuckets - h->moved);
+    int n = h->nbuckets * 2;
+    Entry **b = (Entry **)calloc((size_t)n, sizeof(Entry *));
+    if (!b) return; //keeps the longer chains
+    h->old = h->buckets;
+    h->oldBuckets = h->nbuckets;
+    h->moved = 0;
+    h->buckets = b;
+    h->nbuckets = n;
+}
+
+/* The link that points at key's entry (at the chain's end if it has none),
+ * in whichever table holds it. */
+static Entry **h_find(const Hash *h, const char *key, int raw, unsigned hash) {
+    Entry **link;
+    if (h->old) {
+        unsigned oi = h_slot(h, hash, h->oldBuckets);
+        if ((int)oi >= h->moved) {
+            for (link = &h->old[oi]; *link; link = &(*link)->next) {
+                if ((*link)->hash == hash && h_key_equal((*link)->key, key, raw)) return link;
+            }
+        }
+    }
+    for (link = &h->buckets[h_slot(h, hash, h->nbuckets)]; *link; link = &(*link)->next) {
+        if ((*link)->hash == hash && h_key_equal((*link)->key, key, raw)) return link;
+    }
+    return link;
+}
+
+/* Interned canonicalize(text), for a put of a long text key (shorter ones
+ * arrive canonical, see canon_stack). */
+static const char *intern_canon(const char *text) {
+    size_t size = canon_len(text) + 1;
+    char *buf = (char *)malloc(size);
+    if (!buf) return NULL;
+    canon_copy(buf, size, text);
+    const char *key = str_intern(buf);
+    free(buf);
+    return key;
 }
 
 /* TODO 23: Implement h_put
@@ -438,59 +2391,94 @@ void h_init(Hash *h, int nbuckets) {
  *    - Increment h->size
  *    - Return 1
  */
-int h_put(Hash *h, const char *key, int animalId) {
+static int h_put_key(Hash *h, const char *key, int raw, int animalId) {
     // TODO: Implement this function
     if (!h || !key) return 0;
-    unsigned idx = h_hash(key) % (unsigned)h->nbuckets;
-
-    Entry *e = h->buckets[idx]; //head of chain
-    while (e) { //searches chain for key, if present no change
-        if (strcmp(e->key, key) == 0) {
-            // check for duplicate
-            for (int i = 0; i < e->vals.count; ++i) {
-                if (e->vals.ids[i] == animalId) {
-                    return 0; // no change
-                }
-            }
-            // add new id and checks if need more memory
-            if (e->vals.count >= e->vals.capacity) {
-                int newcap = e->vals.capacity > 0 ? e->vals.capacity * 2 : 4;
-                int *newids = (int *)realloc(e->vals.ids, sizeof(int) * newcap);
-                if (!newids) return 0;
-                e->vals.ids = newids;
-                e->vals.capacity = newcap;
+    if (h->flags & HASH_OPEN) return oh_put(h, key, raw, animalId);
+    h_rehash_steps(h, H_REHASH_STEP);
+    unsigned hash = h_key_hash(h, key, raw);
+
+    Entry *e = *h_find(h, key, raw, hash); //searches both tables for key, if present no change
+    if (e) {
+        // check for duplicate
+        for (int i = 0; i < e->vals.count; ++i) {
+            if (e->vals.ids[i] == animalId) {
+                return 0; // no change
             }
-            e->vals.ids[e->vals.count++] = animalId; //adds id
-            return 1;
         }
-        e = e->next; //next entry
+        // add new id and checks if need more memory
+        if (e->vals.count >= e->vals.capacity) {
+            int newcap = e->vals.capacity > 0 ? e->vals.capacity * 2 : 4;
+            int inl = e->vals.ids == e->inlineIds; //the first ids live in the entry
+            int *newids = (int *)realloc(inl ? NULL : e->vals.ids, sizeof(int) * newcap);
+            if (!newids) return 0;
+            if (inl) memcpy(newids, e->inlineIds, sizeof(e->inlineIds));
+            e->vals.ids = newids;
+            e->vals.capacity = newcap;
+        }
+        e->vals.ids[e->vals.count++] = animalId; //adds id
+        return 1;
     }
 
     // not found, create new entry
     //copies the key, sets capacity and stores id
     Entry *ne = (Entry *)malloc(sizeof(Entry));
     if (!ne) return 0;
-    ne->key = strdup(key);
+    ne->key = (char *)(raw ? intern_canon(key) : str_intern(key)); //shares the copy with node texts
     if (!ne->key) {
         free(ne);
         return 0;
     }
-    ne->vals.ids = (int *)malloc(sizeof(int) * 4);
-    if (!ne->vals.ids) {
-        free(ne->key);
-        free(ne);
-        return 0;
-    }
-    ne->vals.capacity = 4;
+    ne->vals.ids = ne->inlineIds; //no second allocation until the ids outgrow it
+    ne->hash = hash;
+    ne->vals.capacity = H_INLINE_IDS;
     ne->vals.count = 1;
     ne->vals.ids[0] = animalId;
-    //inserts at the head, updates bucket, adds to size
+    //inserts at the head of the new table's bucket, adds to size
+    unsigned idx = h_slot(h, hash, h->nbuckets);
     ne->next = h->buckets[idx];
     h->buckets[idx] = ne;
     h->size += 1;
+    h_maybe_grow(h);
     return 1;
 }
 
+int h_put(Hash *h, const char *key, int animalId) {
+    return h_put_key(h, key, 0, animalId);
+}
+
+int h_put_text(Hash *h, const char *text, int animalId) {
+    char buf[CANON_STACK];
+    const char *key = canon_stack(text, buf);
+    return key ? h_put_key(h, key, 0, animalId) : h_put_key(h, text, 1, animalId);
+}
+
+/* Entry or slot ids for key, whichever backend holds it. */
+static int *h_ids_key(const Hash *h, const char *key, int raw, int *outCount) {
+    if (outCount) *outCount = 0;
+    if (!h || !key) return NULL;
+    if (h->flags & HASH_OPEN) {
+        int i = oh_find(&h->open, key, raw, h_key_hash(h, key, raw), NULL);
+        if (i < 0) return NULL;
+        if (outCount) *outCount = h->open.slots[i].count;
+        return oh_ids(&h->open.slots[i]);
+    }
+    if (!h->buckets) return NULL;
+    Entry *e = *h_find(h, key, raw, h_key_hash(h, key, raw));
+    if (!e) return NULL; //not found
+    if (outCount) *outCount = e->vals.count;
+    return e->vals.ids;
+}
+
+static int h_contains_key(const Hash *h, const char *key, int raw, int animalId) {
+    int count;
+    int *ids = h_ids_key(h, key, raw, &count);
+    for (int i = 0; i < count; ++i) {
+        if (ids[i] == animalId) return 1; //if found
+    }
+    return 0; //key or id not found
+}
+
 /* TODO 24: Implement h_contains
  * Check if the hash table contains the given key-animalId pair
  * 
@@ -502,19 +2490,13 @@ int h_put(Hash *h, const char *key, int animalId) {
  */
 int h_contains(const Hash *h, const char *key, int animalId) {
     // TODO: Implement this function
-    if (!h || !key) return 0; //bucketindex below
-    unsigned idx = h_hash(key) % (unsigned)h->nbuckets;
-    Entry *e = h->buckets[idx];
-    while (e) {
-        if (strcmp(e->key, key) == 0) {
-            for (int i = 0; i < e->vals.count; ++i) {
-                if (e->vals.ids[i] == animalId) return 1; //if found
-            }
-            return 0; //key found, id not found
-        }
-        e = e->next;
-    }
-    return 0; //not found
+    return h_contains_key(h, key, 0, animalId);
+}
+
+int h_contains_text(const Hash *h, const char *text, int animalId) {
+    char buf[CANON_STACK];
+    const char *key = canon_stack(text, buf);
+    return key ? h_contains_key(h, key, 0, animalId) : h_contains_key(h, text, 1, animalId);
 }
 
 /* TODO 25: Implement h_get_ids
@@ -534,18 +2516,81 @@ int h_contains(const Hash *h, const char *key, int animalId) {
  */
 int *h_get_ids(const Hash *h, const char *key, int *outCount) {
     // TODO: Implement this function
-   if (outCount) *outCount = 0;
-    if (!h || !key) return NULL;
-    unsigned idx = h_hash(key) % (unsigned)h->nbuckets;
-    Entry *e = h->buckets[idx];
-    while (e) { //scans the table, if key matches returns the array
-        if (strcmp(e->key, key) == 0) {
-            if (outCount) *outCount = e->vals.count;
-            return e->vals.ids;
+    return h_ids_key(h, key, 0, outCount);
+}
+
+int *h_get_ids_text(const Hash *h, const char *text, int *outCount) {
+    char buf[CANON_STACK];
+    const char *key = canon_stack(text, buf);
+    return key ? h_ids_key(h, key, 0, outCount) : h_ids_key(h, text, 1, outCount);
+}
+
+/* Takes animalId off key's list, dropping the entry once the list is
+ * empty. 1 if the pair was there. */
+static int h_remove_key(Hash *h, const char *key, int raw, int animalId) {
+    if (!h || !key) return 0;
+    if (h->flags & HASH_OPEN) return oh_remove(h, key, raw, animalId);
+    if (!h->buckets) return 0;
+    h_rehash_steps(h, H_REHASH_STEP);
+    Entry **link = h_find(h, key, raw, h_key_hash(h, key, raw));
+    Entry *e = *link;
+    if (!e) return 0;
+    for (int i = 0; i < e->vals.count; ++i) {
+        if (e->vals.ids[i] != animalId) continue;
+        e->vals.ids[i] = e->vals.ids[--e->vals.count]; //order of the ids is not kept
+        if (e->vals.count == 0) { //last id: unlink the entry
+            *link = e->next;
+            str_release(e->key);
+            if (e->vals.ids != e->inlineIds) free(e->vals.ids);
+            free(e);
+            h->size -= 1;
+        }
+        return 1;
+    }
+    return 0; //key found, id not found
+}
+
+int h_remove(Hash *h, const char *key, int animalId) {
+    return h_remove_key(h, key, 0, animalId);
+}
+
+int h_remove_text(Hash *h, const char *text, int animalId) {
+    char buf[CANON_STACK];
+    const char *key = canon_stack(text, buf);
+    return key ? h_remove_key(h, key, 0, animalId) : h_remove_key(h, text, 1, animalId);
+}
+
+/* Chain lengths and, per entry, how many keys a lookup compares before it
+ * (its place in the chain). */
+static void h_stats_table(Entry **buckets, int from, int to, HashStats *out) {
+    for (int i = from; i < to; i++) {
+        int len = 0;
+        for (Entry *e = buckets[i]; e; e = e->next) {
+            len++;
+            out->probes[len < H_PROBE_HIST ? len - 1 : H_PROBE_HIST - 1]++;
         }
-        e = e->next;
+        if (len == 0) out->emptyBuckets++;
+        if (len > out->maxChain) out->maxChain = len;
+    }
+}
+
+void h_stats(const Hash *h, HashStats *out) {
+    memset(out, 0, sizeof(*out));
+    if (h && (h->flags & HASH_OPEN) && h->open.ctrl) {
+        oh_stats(h, out);
+        out->loadFactor = (double)out->entries / out->buckets;
+        return;
     }
-    return NULL; //not found
+    if (!h || !h->buckets) return;
+    out->entries = h->size;
+    out->buckets = h->nbuckets;
+    h_stats_table(h->buckets, 0, h->nbuckets, out);
+    if (h->old) {
+        out->resizing = 1;
+        out->buckets += h->oldBuckets - h->moved;
+        h_stats_table(h->old, h->moved, h->oldBuckets, out);
+    }
+    out->loadFactor = (double)out->entries / out->buckets;
 }
 
 /* TODO 26: Implement h_free
@@ -563,16 +2608,21 @@ int *h_get_ids(const Hash *h, const char *key, int *outCount) {
  */
 void h_free(Hash *h) {
     // TODO: Implement this function
+    if (h && (h->flags & HASH_OPEN)) {
+        oh_free(h);
+        return;
+    }
     if (!h || !h->buckets) {
         return;
     }
+    if (h->old) h_rehash_steps(h, h->oldBuckets - h->moved); //one table left to free
     for (int i = 0; i < h->nbuckets; ++i) { //walks through the chain, saves the next to keep going, frees the key
         //frees id buffer, and entry
         Entry *e = h->buckets[i];
         while (e) {
             Entry *next = e->next;
-            free(e->key);
-            free(e->vals.ids);
+            str_release(e->key);
+            if (e->vals.ids != e->inlineIds) free(e->vals.ids);
             free(e);
             e = next;
         }
@@ -582,3 +2632,269 @@ void h_free(Hash *h) {
     h->size = 0;
     h->nbuckets = 0;
 }
+
+/* ========== Animal Index ==========
+ * names maps a canonical animal name to slot ids and slots[id] is the leaf.
+ * Freed ids are reused, so the slots never outgrow the most leaves the
+ * tree has had. root is the tree the index describes; NULL means it is
+ * rebuilt by the next lookup. version counts rebuilds and drops.
+ * pathBits/pathDepth are the leaf's answer-path signature, kept in arrays of
+ * their own so animal_candidates() scans nothing else; a free id has depth
+ * -1 and matches no answers. */
+static struct {
+    Hash names;
+    Node **slots;
+    uint64_t *pathBits;  /* same capacity as slots */
+    int *pathDepth;
+    int *freeIds;     /* same capacity as slots */
+    int slotCount;    /* ids handed out so far */
+    int slotCap;
+    int freeCount;
+    Node *root;
+    unsigned version;
+} g_animals;
+
+static void animal_index_forget(const Node *root) {
+    if (root && root == g_animals.root) animal_index_invalidate();
+}
+
+void animal_index_invalidate(void) {
+    g_animals.root = NULL;
+    g_animals.version++;
+}
+
+unsigned animal_index_version(void) {
+    return g_animals.version;
+}
+
+void animal_index_free(void) {
+    unsigned version = g_animals.version;
+    h_free(&g_animals.names);
+    free(g_animals.slots);
+    free(g_animals.pathBits);
+    free(g_animals.pathDepth);
+    free(g_animals.freeIds);
+    memset(&g_animals, 0, sizeof(g_animals));
+    g_animals.version = version + 1;
+}
+
+void path_sig_push(PathSig *s, int yes) {
+    if (s->depth < PATH_SIG_BITS && yes) s->bits |= (uint64_t)1 << s->depth;
+    s->depth++;
+}
+
+/* Signature from parent links, for the leaves an edit moved. */
+static PathSig path_of(const Node *leaf) {
+    PathSig sig = { 0, 0 };
+    for (const Node *n = leaf; n->parent; n = n->parent) sig.depth++;
+    int d = sig.depth;
+    for (const Node *n = leaf; n->parent; n = n->parent) {
+        d--;
+        if (d < PATH_SIG_BITS && n->parent->yes == n) sig.bits |= (uint64_t)1 << d;
+    }
+    return sig;
+}
+
+/* Slot id of leaf, or -1. */
+static int animal_slot(const Node *leaf) {
+    int count = 0, *ids = h_get_ids_text(&g_animals.names, leaf->text, &count);
+    for (int i = 0; i < count; i++) {
+        if (g_animals.slots[ids[i]] == leaf) return ids[i];
+    }
+    return -1;
+}
+
+static int animal_put(Node *leaf, PathSig sig) {
+    int id;
+    if (g_animals.freeCount > 0) {
+        id = g_animals.freeIds[--g_animals.freeCount];
+    } else {
+        if (g_animals.slotCount == g_animals.slotCap) {
+            int newcap = g_animals.slotCap ? g_animals.slotCap * 2 : 64;
+            Node **slots = (Node **)realloc(g_animals.slots, sizeof(Node *) * (size_t)newcap);
+            if (slots) g_animals.slots = slots;
+            uint64_t *bits = (uint64_t *)realloc(g_animals.pathBits, sizeof(uint64_t) * (size_t)newcap);
+            if (bits) g_animals.pathBits = bits;
+            int *depths = (int *)realloc(g_animals.pathDepth, sizeof(int) * (size_t)newcap);
+            if (depths) g_animals.pathDepth = depths;
+            int *ids = (int *)realloc(g_animals.freeIds, sizeof(int) * (size_t)newcap);
+            if (ids) g_animals.freeIds = ids;
+            if (!slots || !bits || !depths || !ids) return 0; //grown arrays stay valid for the old cap
+            g_animals.slotCap = newcap;
+        }
+        id = g_animals.slotCount++;
+    }
+    if (!h_put_text(&g_animals.names, leaf->text, id)) {
+        g_animals.freeIds[g_animals.freeCount++] = id;
+        return 0;
+    }
+    g_animals.slots[id] = leaf;
+    g_animals.pathBits[id] = sig.bits;
+    g_animals.pathDepth[id] = sig.depth;
+    return 1;
+}
+
+static int animal_drop(Node *leaf) {
+    int count = 0, *ids = h_get_ids_text(&g_animals.names, leaf->text, &count);
+    int found = 0;
+    for (int i = 0; i < count && !found; i++) {
+        int id = ids[i];
+        if (g_animals.slots[id] != leaf) continue; //another leaf with the same name
+        h_remove_text(&g_animals.names, leaf->text, id);
+        g_animals.slots[id] = NULL;
+        g_animals.pathDepth[id] = -1;
+        g_animals.freeIds[g_animals.freeCount++] = id;
+        found = 1;
+    }
+    return found;
+}
+
+typedef struct {
+    Node *node;
+    PathSig sig;  /* answers leading to node */
+} SigFrame;
+
+/* One walk over g_root; a shared leaf gets one slot however many parents
+ * link it, and the signature of the first path that reached it. */
+static int animal_index_build(void) {
+    load_wait(); //parent links and leaves must be final
+    animal_index_free();
+    int leaves = subtree_leaves(g_root);
+    h_init_as(&g_animals.names, leaves > 32 ? leaves : 32, HASH_WIDE); //about one name per bucket
+    if (!g_animals.names.buckets) return 0;
+
+    NodeMap seen = { NULL, 0, 0 };
+    int top = 0, cap = 64;
+    SigFrame *st = (SigFrame *)malloc(sizeof(SigFrame) * (size_t)cap);
+    int ok = st != NULL;
+    if (ok) st[top++] = (SigFrame){ g_root, { 0, 0 } };
+    while (ok && top > 0) {
+        SigFrame f = st[--top];
+        Node *n = f.node;
+        if (n->flags & NODE_SHARED) {
+            NodeMapSlot *s = nm_put(&seen, n);
+            if (!s) { ok = 0; break; }
+            if (s->val) continue; //reached through another parent already
+            s->val = 1;
+        }
+        if (!n->isQuestion) {
+            ok = animal_put(n, f.sig);
+            continue;
+        }
+        if (top + 2 > cap) {
+            SigFrame *tmp = (SigFrame *)realloc(st, sizeof(SigFrame) * (size_t)cap * 2);
+            if (!tmp) { ok = 0; break; }
+            st = tmp;
+            cap *= 2;
+        }
+        for (int side = 0; side <= 1; side++) { //no first, so yes comes out first
+            Node *child = side ? n->yes : n->no;
+            if (!child) continue;
+            st[top] = (SigFrame){ child, f.sig };
+            path_sig_push(&st[top++].sig, side);
+        }
+    }
+    free(st);
+    nm_free(&seen);
+    if (!ok) {
+        animal_index_free();
+        return 0;
+    }
+    g_animals.root = g_root;
+    g_animals.version++;
+    return 1;
+}
+
+/* An edit that keeps the tree the index describes (before is g_root as it
+ * was) only adds or removes single leaves and moves one up or down; any
+ * other tree is left alone. */
+void animal_index_update(Node *before, Node *added, Node *removed, Node *moved) {
+    if (!g_animals.root || g_animals.root != before) return;
+    int id = moved && !moved->isQuestion ? animal_slot(moved) : -1;
+    if ((moved && id < 0) || (removed && !animal_drop(removed)) ||
+        (added && !animal_put(added, path_of(added)))) { //a moved subtree moves every leaf in it
+        animal_index_invalidate(); //out of step: rebuilt by the next lookup
+        return;
+    }
+    if (id >= 0) {
+        PathSig sig = path_of(moved);
+        g_animals.pathBits[id] = sig.bits;
+        g_animals.pathDepth[id] = sig.depth;
+    }
+    g_animals.root = g_root; //a split at the root moves it
+}
+
+int animal_find(const char *name, AnimalRef *out, int max) {
+    if (!name || !g_root) return 0;
+    if (g_animals.root != g_root && !animal_index_build()) return -1;
+    int count = 0, *ids = h_get_ids_text(&g_animals.names, name, &count);
+    for (int i = 0; i < count && i < max; i++) {
+        Node *leaf = g_animals.slots[ids[i]];
+        out[i].leaf = leaf;
+        out[i].parent = leaf->parent;
+    }
+    return count;
+}
+
+Node *animal_lookup(const char *name) {
+    AnimalRef ref;
+    return animal_find(name, &ref, 1) > 0 ? ref.leaf : NULL;
+}
+
+/* First PATH_SIG_BITS answers from the signature; a deeper leaf also has
+ * to sit below at, the node the answers lead to. */
+static int path_matches(int id, const PathSig *answers, const Node *at) {
+    if (g_animals.pathDepth[id] < answers->depth) return 0;
+    int d = answers->depth < PATH_SIG_BITS ? answers->depth : PATH_SIG_BITS;
+    uint64_t mask = d < 64 ? ((uint64_t)1 << d) - 1 : ~(uint64_t)0;
+    if ((g_animals.pathBits[id] ^ answers->bits) & mask) return 0;
+    if (answers->depth <= PATH_SIG_BITS) return 1;
+    if (!at) return 0;
+    const Node *n = g_animals.slots[id];
+    for (int up = g_animals.pathDepth[id] - answers->depth; up > 0; up--) n = n->parent;
+    return n == at;
+}
+
+int animal_path(const Node *leaf, PathSig *out) {
+    if (!leaf || !g_root || tree_is_shared()) return 0;
+    if (g_animals.root != g_root && !animal_index_build()) return 0;
+    int id = animal_slot(leaf);
+    if (id < 0) return 0;
+    out->bits = g_animals.pathBits[id];
+    out->depth = g_animals.pathDepth[id];
+    return 1;
+}
+
+int animal_consistent(const Node *leaf, const PathSig *answers, const Node *at) {
+    if (!leaf || !g_root || tree_is_shared()) return 0;
+    if (g_animals.root != g_root && !animal_index_build()) return 0;
+    int id = animal_slot(leaf);
+    return id >= 0 && path_matches(id, answers, at);
+}
+
+/* A branch-free pass over the two signature arrays, then the slow check for
+ * the few survivors of a path longer than the signatures. */
+int animal_candidates(const PathSig *answers, const Node *at) {
+    if (!g_root) return 0;
+    if (tree_is_shared()) return -1; //a shared leaf sits on more than one path
+    if (g_animals.root != g_root && !animal_index_build()) return -1;
+    const uint64_t *bits = g_animals.pathBits;
+    const int *depth = g_animals.pathDepth;
+    int d = answers->depth < PATH_SIG_BITS ? answers->depth : PATH_SIG_BITS;
+    uint64_t mask = d < 64 ? ((uint64_t)1 << d) - 1 : ~(uint64_t)0, want = answers->bits & mask;
+    int count = 0, n = g_animals.slotCount;
+    if (answers->depth <= PATH_SIG_BITS) {
+        for (int i = 0; i < n; i++) count += (depth[i] >= answers->depth) & ((bits[i] & mask) == want);
+        return count;
+    }
+    for (int i = 0; i < n; i++) {
+        if (depth[i] >= answers->depth && (bits[i] & mask) == want) count += path_matches(i, answers, at);
+    }
+    return count;
+}
+
+int animal_index_size(void) {
+    if (!g_root) return 0;
+    if (g_animals.root != g_root && !animal_index_build()) return -1;
+    return g_animals.slotCount - g_animals.freeCount;
+}
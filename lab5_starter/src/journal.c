@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lab5.h"
+
+extern Node *g_root;
+extern EditStack g_undo;
+extern EditStack g_redo;
+
+#define JOURNAL_MAGIC 0x4A544C35  /* "JTL5" */
+#define JOURNAL_VERSION 1
+#define MAX_TEXT_LEN 10000
+
+/* Journal file: JournalHeader, then one record per edit:
+ *   op (1 byte), newYes (1 byte), depth (4 bytes), path bits ((depth+7)/8
+ *   bytes, bit i set = yes at level i), qLen (4), question, aLen (4), animal
+ * The path leads from the root to the slot the edit happened at, so records
+ * stay meaningful across restarts. The header pins the snapshot the records
+ * apply to; a journal for any other snapshot is ignored. */
+typedef struct {
+    int32_t magic;
+    int32_t version;
+    int64_t snapshotBytes;
+    int64_t snapshotMtimeSec;
+    int64_t snapshotMtimeNsec;
+} JournalHeader;
+
+typedef struct {
+    uint8_t *bits;
+    uint32_t depth;
+    uint32_t cap;   /* in bytes */
+} Path;
+
+static FILE *g_journal = NULL;       //open for append while a session is live
+static char *g_snapshotName = NULL;
+static char *g_journalName = NULL;
+
+//helpers
+static void path_set(Path *p, uint32_t i, int yes) {
+    if (yes) p->bits[i / 8] |= (uint8_t)(1u << (i % 8));
+    else     p->bits[i / 8] &= (uint8_t)~(1u << (i % 8));
+}
+
+static int path_push(Path *p, int yes) {
+    if (p->depth / 8 >= p->cap) { //grows the bit buffer
+        uint32_t newcap = p->cap ? p->cap * 2 : 16;
+        uint8_t *tmp = (uint8_t *)realloc(p->bits, newcap);
+        if (!tmp) return 0;
+        memset(tmp + p->cap, 0, newcap - p->cap);
+        p->bits = tmp;
+        p->cap = newcap;
+    }
+    path_set(p, p->depth++, yes);
+    return 1;
+}
+
+static int path_bit(const Path *p, uint32_t i) {
+    return (p->bits[i / 8] >> (i % 8)) & 1;
+}
+
+/* Root-to-slot answers for an edit, read off the cached parent links from
+ * e->parent up, so a record costs the slot's depth rather than a tree walk.
+ * 0 if the climb does not end at g_root: a shared node keeps no parent
+ * link, and a detached one leads elsewhere. */
+static int path_to(const Edit *e, Path *out) {
+    out->depth = 0;
+    if (!g_root) return 0;
+    if (!e->parent) return 1; //the root slot
+    Node *cur = node_ready(e->parent);
+    if (!path_push(out, e->wasYesChild)) return 0;
+    while (cur != g_root) {
+        Node *up = cur->parent;
+        if (!up || (cur->flags & NODE_SHARED)) return 0;
+        node_ready(up);
+        if (up->yes != cur && up->no != cur) return 0; //stale link
+        if (!path_push(out, up->yes == cur)) return 0;
+        cur = up;
+    }
+    for (uint32_t i = 0, j = out->depth - 1; i < j; i++, j--) { //pushed slot first
+        int bi = path_bit(out, i);
+        path_set(out, i, path_bit(out, j));
+        path_set(out, j, bi);
+    }
+    return 1;
+}
+
+/* Follows a path from the root; *parent gets the last question passed.
+ * Every record edits where the path ends, so shared nodes on it are copied
+ * first (tree_unshare). */
+static Node *walk_path(const Path *p, Node **parent) {
+    Node *cur = g_root;
+    *parent = NULL;
+    int cow = tree_is_shared();
+    FrameStack trail = { NULL, 0, 0 };
+    if (cow) {
+        fs_init(&trail);
+        fs_push(&trail, cur, -1);
+    }
+    for (uint32_t i = 0; i < p->depth; i++) {
+        if (!cur || !cur->isQuestion) { fs_free(&trail); return NULL; }
+        *parent = cur;
+        cur = node_child(cur, path_bit(p, i));
+        if (cow) fs_push(&trail, cur, path_bit(p, i));
+    }
+    if (cow && cur) {
+        if (trail.size != (int)p->depth + 1 || !tree_unshare(&trail)) cur = NULL; //out of memory
+        else {
+            cur = trail.frames[trail.size - 1].node;
+            *parent = trail.size > 1 ? trail.frames[trail.size - 2].node : NULL;
+        }
+    }
+    fs_free(&trail);
+    return cur;
+}
+
+static int snapshot_header(JournalHeader *h) {
+    struct stat st;
+    if (stat(g_snapshotName, &st) != 0) return 0;
+    h->magic = JOURNAL_MAGIC;
+    h->version = JOURNAL_VERSION;
+    h->snapshotBytes = (int64_t)st.st_size;
+    h->snapshotMtimeSec = (int64_t)st.st_mtim.tv_sec;
+    h->snapshotMtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+    return 1;
+}
+
+/* Starts an empty journal bound to the current snapshot file. */
+static int journal_reset(void) {
+    JournalHeader h;
+    if (g_journal) { fclose(g_journal); g_journal = NULL; }
+    memset(&h, 0, sizeof(h));
+    if (!snapshot_header(&h)) return 0;
+    FILE *fp = fopen(g_journalName, "wb");
+    if (!fp) return 0;
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 || fflush(fp) != 0) {
+        fclose(fp);
+        return 0;
+    }
+    g_journal = fp;
+    return 1;
+}
+
+static int read_text(FILE *fp, char **out) {
+    int32_t len;
+    *out = NULL;
+    if (fread(&len, sizeof(int32_t), 1, fp) != 1 || len < 0 || len > MAX_TEXT_LEN) return 0;
+    char *text = (char *)malloc((size_t)len + 1);
+    if (!text) return 0;
+    if (fread(text, 1, (size_t)len, fp) != (size_t)len) { free(text); return 0; }
+    text[len] = '\0';
+    *out = text;
+    return 1;
+}
+
+/* Applies one record to the live tree and edit stacks. */
+static int replay_record(int op, int newYes, const Path *p, const char *q, const char *a) {
+    Node *parent = NULL;
+    Node *slot = walk_path(p, &parent);
+    int wasYes = p->depth ? path_bit(p, p->depth - 1) : 0;
+    if (!slot) return 0;
+
+    if (op == JOURNAL_INSERT) {
+        if (slot->isQuestion) return 0;
+        return apply_insert_split(parent, wasYes, slot, q, a, newYes) != NULL;
+    }
+    if (op == JOURNAL_UNDO) {
+        if (!slot->isQuestion) return 0;
+        if (es_empty(&g_undo) || g_undo.edits[g_undo.size - 1].newQuestion != slot) {
+            // edit predates the snapshot: rebuild its record from the tree
+            Edit e;
+            e.type = EDIT_INSERT_SPLIT;
+            e.parent = parent;
+            e.wasYesChild = wasYes;
+            e.newQuestion = slot;
+            e.newLeaf = newYes ? slot->yes : slot->no;
+            e.oldLeaf = newYes ? slot->no : slot->yes;
+            es_push(&g_undo, e);
+        }
+        return undo_last_edit();
+    }
+    if (op == JOURNAL_REDO) {
+        if (!es_empty(&g_redo) && g_redo.edits[g_redo.size - 1].oldLeaf == slot) {
+            return redo_last_edit();
+        }
+        if (slot->isQuestion) return 0;
+        return apply_insert_split(parent, wasYes, slot, q, a, newYes) != NULL; //redo of an older undo
+    }
+    return 0;
+}
+
+/* Replays every complete record; *good gets the offset just past the last
+ * one that applied, which is where new records will be appended. Returns 1
+ * if it stopped at the end of the file, past at most a record cut short by a
+ * crash mid-write, and 0 if a whole record could not be read or applied
+ * (out of memory, or it does not fit the tree). */
+static int replay_journal(FILE *fp, long *good) {
+    Path p = { NULL, 0, 0 };
+    *good = ftell(fp);
+    for (;;) {
+        uint8_t op, newYes;
+        uint32_t depth;
+        char *q = NULL, *a = NULL;
+        if (fread(&op, 1, 1, fp) != 1 || fread(&newYes, 1, 1, fp) != 1 ||
+            fread(&depth, sizeof(uint32_t), 1, fp) != 1) {
+            break; //clean end (or torn record)
+        }
+        p.depth = 0;
+        uint32_t nbytes = (depth + 7) / 8;
+        int ok = 1;
+        for (uint32_t i = 0; ok && i < nbytes; i++) { //reads the path a byte at a time
+            int byte = fgetc(fp);
+            if (byte == EOF) { ok = 0; break; }
+            for (int b = 0; b < 8 && p.depth < depth; b++) {
+                if (!path_push(&p, (byte >> b) & 1)) ok = 0;
+            }
+        }
+        if (ok) ok = read_text(fp, &q) && read_text(fp, &a);
+        if (ok) ok = replay_record(op, newYes, &p, q, a);
+        free(q);
+        free(a);
+        if (!ok) break;
+        *good = ftell(fp);
+    }
+    free(p.bits);
+    return feof(fp) && !ferror(fp); //only running out of bytes makes a torn tail
+}
+
+int journal_open(const char *snapshot) {
+    journal_close();
+    size_t len = strlen(snapshot);
+    g_snapshotName = (char *)malloc(len + 1);
+    g_journalName = (char *)malloc(len + sizeof(".journal"));
+    if (!g_snapshotName || !g_journalName) { journal_close(); return 0; }
+    memcpy(g_snapshotName, snapshot, len + 1);
+    memcpy(g_journalName, snapshot, len);
+    memcpy(g_journalName + len, ".journal", sizeof(".journal"));
+
+    // edits refer to the tree about to be replaced
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+
+    struct stat st;
+    if (stat(g_snapshotName, &st) != 0) {
+        // first run: the current tree becomes the snapshot
+        if (!save_tree(g_snapshotName) || !journal_reset()) { journal_close(); return 0; }
+        return 1;
+    }
+    if (!load_tree(g_snapshotName)) { journal_close(); return 0; }
+
+    JournalHeader want, have;
+    memset(&want, 0, sizeof(want));
+    memset(&have, 0, sizeof(have));
+    FILE *fp = fopen(g_journalName, "rb");
+    if (fp && snapshot_header(&want) &&
+        fread(&have, sizeof(have), 1, fp) == 1 && memcmp(&want, &have, sizeof(want)) == 0) {
+        long good;
+        int replayed = replay_journal(fp, &good);
+        fclose(fp);
+        if (!replayed) { //kept whole: the record may apply once memory is back
+            journal_close();
+            return 0;
+        }
+        if (truncate(g_journalName, (off_t)good) == 0) { //drops a torn tail record
+            g_journal = fopen(g_journalName, "ab");
+        }
+        if (g_journal || journal_compact()) return 1; //else the snapshot takes the replayed edits
+        journal_close();
+        return 0;
+    } else if (fp) {
+        fclose(fp); //belongs to another snapshot
+    }
+    if (!journal_reset()) { journal_close(); return 0; }
+    return 1;
+}
+
+/* Folds the journal into a new snapshot. The snapshot is renamed into place
+ * before the journal is reset; if we stop in between, the old journal no
+ * longer matches the snapshot and is ignored on the next open. */
+int journal_compact(void) {
+    if (!g_snapshotName) return 0;
+    if (!save_tree(g_snapshotName)) return 0;
+    return journal_reset();
+}
+
+void journal_close(void) {
+    if (g_journal) fclose(g_journal);
+    g_journal = NULL;
+    free(g_snapshotName);
+    free(g_journalName);
+    g_snapshotName = NULL;
+    g_journalName = NULL;
+}
+
+void journal_log(JournalOp op, const Edit *e) {
+    if (!g_journal || !e || !e->newQuestion) return;
+    Path p = { NULL, 0, 0 };
+    if (!path_to(e, &p)) { //no record to write: the snapshot takes the edit instead
+        free(p.bits);
+        journal_compact();
+        return;
+    }
+
+    uint8_t opb = (uint8_t)op;
+    uint8_t newYes = (uint8_t)(e->newQuestion->yes == e->newLeaf ? 1 : 0);
+    int withText = op != JOURNAL_UNDO;
+    int32_t qLen = withText ? (int32_t)strlen(e->newQuestion->text) : 0;
+    int32_t aLen = withText ? (int32_t)strlen(e->newLeaf->text) : 0;
+    size_t nbytes = (p.depth + 7) / 8;
+
+    int ok = fwrite(&opb, 1, 1, g_journal) == 1 &&
+             fwrite(&newYes, 1, 1, g_journal) == 1 &&
+             fwrite(&p.depth, sizeof(uint32_t), 1, g_journal) == 1 &&
+             fwrite(p.bits, 1, nbytes, g_journal) == nbytes &&
+             fwrite(&qLen, sizeof(int32_t), 1, g_journal) == 1 &&
+             fwrite(e->newQuestion->text, 1, (size_t)qLen, g_journal) == (size_t)qLen &&
+             fwrite(&aLen, sizeof(int32_t), 1, g_journal) == 1 &&
+             fwrite(e->newLeaf->text, 1, (size_t)aLen, g_journal) == (size_t)aLen &&
+             fflush(g_journal) == 0;
+    free(p.bits);
+
+    if (!ok || ftell(g_journal) > JOURNAL_COMPACT_BYTES) journal_compact();
+}
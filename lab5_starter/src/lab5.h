@@ -1,21 +1,114 @@
 #ifndef LAB5_H
 #define LAB5_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 /* ========== Tree Node ========== */
 typedef struct Node {
     char *text;
     struct Node *yes;
     struct Node *no;
+    struct Node *parent;  /* NULL at the root */
     int isQuestion;
+    unsigned flags;   /* NODE_* ownership bits, 0 for plain heap nodes */
+    int nodes;        /* nodes in this subtree, itself included */
+    int leaves;       /* childless nodes in this subtree */
+    uint64_t hash;    /* over text, type and the children's hashes (Merkle) */
 } Node;
 
+/* Node (and its text) lives inside a TreeBlock and is released with it */
+#define NODE_IN_BLOCK 0x1u
+/* Node came from the node pool and its text from the text pool */
+#define NODE_POOLED 0x2u
+/* Text is a reference to the interned copy (see String Interning) */
+#define NODE_INTERNED 0x4u
+/* Only during tree_compact() and tree_share(): parent holds the node's new address */
+#define NODE_MOVED 0x8u
+/* Linked from more than one parent (see Subtree Sharing); parent is not kept */
+#define NODE_SHARED 0x10u
+/* Only during tree_share(): an Edit points at the node or below it */
+#define NODE_PINNED 0x20u
+
 /* Node constructors */
 Node *create_question_node(const char *question);
 Node *create_animal_node(const char *animal);
+void free_node(Node *node);
 void free_tree(Node *node);
-int count_nodes(Node *root);
+int count_nodes(Node *root);  /* -1 if out of memory */
+int node_set_text(Node *n, const char *text);  /* constructor-made nodes only */
+
+/* Cached subtree counts and hashes (Node.nodes/leaves/hash/parent). The
+ * constructors start them, loads and tree_recount() fill them for a whole
+ * tree, and edits keep them with tree_adjust() on the node above the change.
+ * count_nodes() walks instead, so it is right for trees linked up by hand
+ * too. Equal hashes mean equal subtrees (texts and shape), barring a 64-bit
+ * collision. */
+int subtree_nodes(const Node *n);   /* 0 for NULL */
+int subtree_leaves(const Node *n);
+uint64_t node_hash(const Node *n);  /* 0 for NULL */
+void node_rehash(Node *n);          /* from n's text, type and children's hashes */
+void tree_adjust(Node *n, int dNodes, int dLeaves);  /* n and all its ancestors, rehashed */
+int tree_recount(Node *root);  /* 0 if out of memory */
+
+/* Node pool: constructors take nodes from slabs and texts from size-classed
+ * slabs; free_node() puts them back for reuse. */
+typedef struct {
+    long mallocs;      /* malloc calls made for node structs and texts */
+    long nodesLive;
+    long textsLive;
+    size_t slabBytes;  /* held by the pools, in use or free */
+} PoolStats;
+
+void set_node_pool(int on);  /* 1 (default) = pooled, 0 = malloc + strdup per node */
+void pool_stats(PoolStats *out);
+
+/* Child links may point at nodes that are not filled in yet (a progressive
+ * load) or no longer are (a paged-out chunk). Tree walks go through
+ * node_child(), which makes the node and then the child complete before
+ * either is read; node_ready() does the same for a node kept from earlier,
+ * and must come before writing to a loaded node's links. */
+Node *node_ready(Node *n);
+Node *node_child(Node *n, int yes);
+void set_node_resolver(void (*resolve)(Node *n));  /* NULL = links are final */
+
+/* ========== Bulk Node Blocks ==========
+ * A loaded tree can keep all of its nodes in one array and all of its text
+ * in one region (a mapped file or an arena) instead of one malloc each.
+ * Nodes in a block carry NODE_IN_BLOCK; free_node() only counts them down
+ * and the whole block is released when its last node goes. Heap nodes made
+ * later by learning can point into (and be pointed to by) block nodes. */
+typedef struct TreeBlock {
+    Node *nodes;
+    int count;
+    int live;                 /* nodes not yet passed to free_node */
+    void *mem;                /* text storage backing the nodes */
+    size_t memLen;
+    void (*release_mem)(void *mem, size_t len);
+    size_t nodesMapped;       /* bytes of the node mapping (tb_reserve_pages), 0 if malloc'd */
+} TreeBlock;
+
+TreeBlock *tb_create(int count);
+TreeBlock *tb_reserve(int count);  /* nodes left zeroed: caller sets NODE_IN_BLOCK */
+TreeBlock *tb_reserve_pages(int count);  /* same, nodes in a mapping whose pages may be dropped */
+void tb_attach_memory(TreeBlock *b, void *mem, size_t len,
+                      void (*release_mem)(void *mem, size_t len));
+void tb_discard(TreeBlock *b);
+int tb_count_subtrees(TreeBlock *b, int rehash);  /* rehash 0 keeps loaded hashes; 0 if not a tree */
+int tb_intern_texts(TreeBlock *b);  /* 1 if texts moved to the intern table and b->mem went */
+
+/* ========== Relayout ==========
+ * tree_compact() rewrites the live tree (g_root) into one TreeBlock in a
+ * cache-friendly order and remaps the Edit pointers on g_undo and g_redo.
+ * Texts are shared interned copies, or one arena in node order with
+ * interning off. Returns 0, tree untouched, if memory runs out or the tree
+ * has shared subtrees. */
+#define LAYOUT_AUTO 0  /* BFS for shallow trees, van Emde Boas for deep ones */
+#define LAYOUT_BFS 1
+#define LAYOUT_VEB 2
+
+int tree_compact(int layout);
 
 /* ========== Stack for Gameplay ========== */
 typedef struct Frame {
@@ -30,11 +123,55 @@ typedef struct {
 } FrameStack;
 
 void fs_init(FrameStack *s);
-void fs_push(FrameStack *s, Node *node, int answeredYes);
+int fs_push(FrameStack *s, Node *node, int answeredYes);  /* 0 if out of memory */
 Frame fs_pop(FrameStack *s);
 int fs_empty(FrameStack *s);
 void fs_free(FrameStack *s);
 
+/* ========== Node Map ==========
+ * Open-addressing map from a node's address to an int, for walks that have
+ * to tell nodes apart by identity. A zeroed NodeMap is empty. */
+typedef struct {
+    Node *node;
+    int val;
+} NodeMapSlot;
+
+typedef struct {
+    NodeMapSlot *slots;
+    size_t cap;    /* power of two, at least twice count */
+    size_t count;
+} NodeMap;
+
+NodeMapSlot *nm_get(const NodeMap *m, const Node *n);  /* NULL if absent */
+NodeMapSlot *nm_put(NodeMap *m, Node *n);  /* new slots start at val 0; NULL if out of memory */
+int nm_reserve(NodeMap *m, size_t count);  /* nm_put cannot fail below count */
+void nm_remove(NodeMap *m, const Node *n);
+void nm_free(NodeMap *m);
+
+/* ========== Subtree Sharing ==========
+ * tree_share() hash-conses the live tree: subtrees with the same texts and
+ * shape become one copy linked from every place they appeared. A node with
+ * more than one parent carries NODE_SHARED and its link count; free_tree()
+ * drops a link and frees on the last one. Counts stay per logical subtree,
+ * so subtree_nodes(g_root) is unchanged. Editing below a shared node needs
+ * tree_unshare() on the path from the root first (copy-on-write), since
+ * the change must not show up in the other places. Nodes an Edit on g_undo
+ * or g_redo points at, and their ancestors, are never merged. v2 saves keep
+ * the sharing; v1, preorder and CompactTree copies expand it. */
+typedef struct {
+    long sharedNodes;   /* nodes linked from more than one parent */
+    long nodesSaved;    /* logical nodes minus stored ones */
+    size_t bytesSaved;  /* nodesSaved * sizeof(Node) */
+} ShareStats;
+
+int tree_share(void);                /* 0, tree untouched, if memory runs out */
+int tree_unshare(FrameStack *path);  /* frames from g_root down, as play_game pushes them */
+int tree_is_shared(void);
+int node_is_private(const Node *n);  /* n and every ancestor linked once */
+int share_check(Node *root);         /* link counts match the tree, no cycles */
+void share_stats(ShareStats *out);
+int tb_share_links(TreeBlock *b, int rehash);  /* a loaded block may link nodes more than once */
+
 /* ========== Edit/Undo/Redo ========== */
 typedef enum {
     EDIT_INSERT_SPLIT
@@ -70,6 +207,32 @@ extern Node *g_root;
 int undo_last_edit();
 int redo_last_edit();
 
+/* Replaces oldLeaf (reached from parent via wasYesChild, parent NULL at the
+ * root) with a new question whose newYes side is the new animal; records the
+ * Edit, clears redo, indexes the question and journals it. */
+Node *apply_insert_split(Node *parent, int wasYesChild, Node *oldLeaf,
+                         const char *question, const char *animal, int newYes);
+
+/* ========== Edit Journal ==========
+ * Learning, undo and redo are appended to "<snapshot>.journal" as they
+ * happen (O(1) I/O each). journal_open() loads the snapshot and replays the
+ * journal over it; once the journal passes JOURNAL_COMPACT_BYTES it is folded
+ * into a fresh snapshot. Only a record cut short at the end of the file is
+ * dropped: if a whole record does not replay, journal_open() returns 0 and
+ * leaves the file as it was. */
+#define JOURNAL_COMPACT_BYTES (1L << 20)
+
+typedef enum {
+    JOURNAL_INSERT = 1,
+    JOURNAL_UNDO = 2,
+    JOURNAL_REDO = 3
+} JournalOp;
+
+int journal_open(const char *snapshot);
+int journal_compact(void);
+void journal_close(void);
+void journal_log(JournalOp op, const Edit *e);
+
 /* ========== Queue for BFS ========== */
 typedef struct QueueNode {
     Node *treeNode;
@@ -96,38 +259,294 @@ typedef struct IdList {
     int capacity;
 } IdList;
 
+#define H_INLINE_IDS 2
+
 typedef struct Entry {
     char *key;
-    IdList vals;
+    unsigned hash;  /* h_hash(key), so resizing never rehashes a key */
+    IdList vals;    /* ids point at inlineIds until they outgrow it */
+    int inlineIds[H_INLINE_IDS];
     struct Entry *next;
 } Entry;
 
+/* Chained table that grows by doubling once size passes maxLoad entries
+ * per bucket. The move is incremental: the old buckets stay in old and
+ * every h_put/h_remove carries H_REHASH_STEP of them over, so no single
+ * insert pays for the whole table. Lookups check both while it lasts. */
+#define H_DEFAULT_LOAD 1.0
+#define H_REHASH_STEP 8
+
+/* HASH_OPEN backend (h_init_as): open addressing over groups of
+ * H_GROUP slots with one control byte each, a 7-bit tag of the hash or
+ * empty/deleted, so a probe compares a whole group's tags at once (SSE2
+ * where the compiler has it). Keys live back to back in one arena and up to
+ * H_INLINE_IDS ids sit in the slot itself. Grows in one pass, at most
+ * 7/8 full, so the insert that grows it pays for the whole move; tables
+ * that must answer every insert quickly stay chained. */
+#define H_GROUP 16
+
+typedef struct {
+    unsigned hash;
+    uint32_t keyOff;  /* into the arena */
+    int count;
+    int capacity;     /* 0: ids are inline */
+    union {
+        int inline_[H_INLINE_IDS];
+        int *heap;
+    } ids;
+} OpenSlot;
+
+typedef struct {
+    unsigned char *ctrl;  /* capacity control bytes */
+    OpenSlot *slots;
+    int capacity;         /* power of two, a multiple of H_GROUP */
+    int tombstones;
+    char *arena;
+    size_t arenaLen;
+    size_t arenaCap;
+    size_t arenaDead;     /* bytes of removed keys, dropped by the next rehash */
+} OpenTable;
+
+#define HASH_CHAINED 0
+#define HASH_OPEN 0x1
+#define HASH_WIDE 0x2  /* h_hash64 and power-of-two masking instead of h_hash % nbuckets */
+
 typedef struct {
     Entry **buckets;
     int nbuckets;
     int size;
+    Entry **old;     /* buckets still being moved into buckets, or NULL */
+    int oldBuckets;
+    int moved;       /* old[0..moved) are empty */
+    double maxLoad;  /* 0 = never grow */
+    int flags;       /* HASH_OPEN: the fields above but size and maxLoad are unused */
+    OpenTable open;
 } Hash;
 
-extern void h_init(Hash *h, int nbuckets);
+#define H_PROBE_HIST 8
+
+typedef struct {
+    int entries;
+    int buckets;         /* both tables while a resize is under way */
+    double loadFactor;   /* entries / buckets */
+    int maxChain;
+    int emptyBuckets;
+    long probes[H_PROBE_HIST];  /* keys found on the 1st, 2nd, ... compare (HASH_OPEN: group); the last bin is that many or more */
+    int resizing;
+} HashStats;
+
+extern void h_init(Hash *h, int nbuckets);                 /* HASH_CHAINED */
+extern void h_init_as(Hash *h, int nbuckets, int flags);
+extern void h_set_max_load(Hash *h, double maxLoad);
+extern void h_stats(const Hash *h, HashStats *out);
 extern unsigned h_hash(const char *s);
+extern uint64_t h_hash64(const char *s);  /* word at a time */
 extern int h_put(Hash *h, const char *key, int animalId);
 extern int h_contains(const Hash *h, const char *key, int animalId);
 extern int *h_get_ids(const Hash *h, const char *key, int *outCount);
+extern int h_remove(Hash *h, const char *key, int animalId);
 extern void h_free(Hash *h);
 extern char *canonicalize(const char *s);
+
+/* The calls above with canonicalize(text) as the key, canonicalized on the
+ * fly while hashing and comparing. Lookups and removals allocate nothing; a
+ * put that adds a key allocates only the stored copy (and, chained, its
+ * entry), as long as the canonical form is under 256 bytes. */
+extern int h_put_text(Hash *h, const char *text, int animalId);
+extern int h_contains_text(const Hash *h, const char *text, int animalId);
+extern int *h_get_ids_text(const Hash *h, const char *text, int *outCount);
+extern int h_remove_text(Hash *h, const char *text, int animalId);
+
+/* ========== Animal Index ==========
+ * Canonicalized animal name -> every leaf of g_root's tree with that name,
+ * so finding an animal is one hash lookup instead of a walk; the parent is
+ * the leaf's parent link. Learning, undo and redo keep it up to date
+ * through animal_index_update(). Loads, tree_compact, tree_share,
+ * tree_unshare, renames and trees linked up by hand (tree_recount) leave it
+ * to be rebuilt, in one walk, by the next lookup. A leaf of a shared
+ * subtree is listed once, with whichever parent linked it last. Tables
+ * built on top of the index compare animal_index_version(), which changes
+ * with every rebuild or drop but not with the updates. */
+typedef struct {
+    Node *leaf;
+    Node *parent;  /* NULL when the leaf is the root */
+} AnimalRef;
+
+int animal_find(const char *name, AnimalRef *out, int max);  /* leaves named name (fills up to max); -1 out of memory */
+Node *animal_lookup(const char *name);                       /* first one, or NULL */
+int animal_index_size(void);                                 /* leaves indexed */
+void animal_index_update(Node *before, Node *added, Node *removed, Node *moved);  /* before: g_root before the edit; moved: a leaf that went up or down */
+void animal_index_invalidate(void);
+unsigned animal_index_version(void);
+void animal_index_free(void);
+
+/* Answer-path signatures. Every indexed leaf carries the answers that lead
+ * to it: bit d is the answer (1 yes) to the question at depth d, for the
+ * first PATH_SIG_BITS of them. A leaf is still a candidate after some
+ * answers iff its path starts with them, so play_game can count what is
+ * left in one pass over the signatures. A shared leaf sits on more than
+ * one path, so a shared tree has no signatures: the calls below return 0
+ * (-1 for animal_candidates). at, the node the answers lead to, is only
+ * looked at past PATH_SIG_BITS answers and may be NULL before that. */
+#define PATH_SIG_BITS 64
+typedef struct {
+    uint64_t bits;
+    int depth;      /* answers, including any past PATH_SIG_BITS */
+} PathSig;
+
+void path_sig_push(PathSig *s, int yes);
+int animal_path(const Node *leaf, PathSig *out);  /* 0 if leaf is not indexed */
+int animal_consistent(const Node *leaf, const PathSig *answers, const Node *at);
+int animal_candidates(const PathSig *answers, const Node *at);  /* -1 out of memory or shared */
+
+/* ========== String Interning ==========
+ * One refcounted copy per distinct text, hashed with h_hash. Constructors,
+ * node_set_text, loads that copy their texts and the index keys all share
+ * it. str_release() drops one reference from str_intern(). */
+typedef struct {
+    long strings;       /* distinct texts held */
+    long refs;          /* references to them; refs / strings is the dedup ratio */
+    size_t bytes;       /* text bytes held, NULs included */
+    size_t savedBytes;  /* bytes the extra references would have cost as copies */
+} InternStats;
+
+const char *str_intern(const char *s);  /* NULL on allocation failure */
+void str_release(const char *s);
+void intern_stats(InternStats *out);
+void set_text_interning(int on);  /* 1 (default); 0 = node texts are private copies */
 extern int get_yes_no(int y, int x, const char *prompt);
 extern char *get_input(int y, int x, const char *prompt);
 
 extern Hash g_index;
 
 /* ========== Persistence ========== */
-int save_tree(const char *filename);
+/* On-disk layouts, selected by the header VERSION. load_tree reads both. */
+#define TREE_FORMAT_V1 1  /* BFS records: isQ, len, text, yesId, noId */
+#define TREE_FORMAT_V2 2  /* fixed-width node table + string pool, mmap'd */
+#define TREE_FORMAT_PREORDER 3  /* preorder shape bits + texts, no child ids */
+#define TREE_POOL_COMPRESSED 0x100  /* or'ed with TREE_FORMAT_V2: LZ block pool */
+#define TREE_HASHES 0x200  /* or'ed with TREE_FORMAT_V2: subtree hashes stored, not recomputed */
+
+int save_tree(const char *filename);                 /* TREE_FORMAT_V2 */
+int save_tree_as(const char *filename, int version);
 int load_tree(const char *filename);
+void set_load_threads(int threads);  /* 0 = one per CPU (default) */
+void set_save_threads(int threads);  /* 0 = one per CPU, 1 = streaming save */
+void set_load_progressive(int on);   /* v2 loads return once the top levels are built */
+int load_pending(void);              /* 1 while deeper levels are still being built */
+int load_wait(void);                 /* finishes a progressive load; 0 if a record was bad */
+void set_load_budget(size_t bytes);  /* page v2 chunks in and out to stay under it; 0 = off */
+
+/* While a load is pending, parent links of built nodes are kept, but the
+ * counts and hashes (nodes, leaves, hash) are only final after load_wait().
+ * Paging keeps residentBytes <= budgetBytes + PAGE_PINNED_CHUNKS *
+ * maxChunkBytes, plus any chunks whose links were edited (never dropped). */
+#define PAGE_PINNED_CHUNKS 4  /* the chunks touched last are never dropped */
+
+typedef struct {
+    size_t residentBytes;  /* nodes, records and texts of built chunks */
+    size_t budgetBytes;
+    size_t maxChunkBytes;  /* largest chunk built so far */
+    long faults;           /* chunks built because a walk reached them */
+    long evictions;        /* chunks dropped to stay under the budget */
+} PagingStats;
+
+void paging_stats(PagingStats *out);
+
+/* ========== Compact Tree (compact.c) ==========
+ * Structure-of-arrays alternative to Node trees: node i is yes[i], no[i]
+ * (32-bit indices, CT_NONE if absent), flags[i] and textOff[i], an offset
+ * into one shared NUL-terminated text pool. 13 bytes per node plus its text,
+ * against 32 bytes plus a separate allocation for a Node. Indices never
+ * move; nodes created by an edit that was undone and then cleared from the
+ * redo stack are reclaimed only if they are the newest ones. */
+#define CT_NONE 0xFFFFFFFFu
+#define CT_QUESTION 0x1u
+
+typedef struct {
+    uint32_t parent;      /* CT_NONE when the split replaced the root */
+    int wasYesChild;
+    uint32_t oldLeaf;
+    uint32_t newQuestion;
+    uint32_t newLeaf;
+} CtEdit;
+
+typedef struct {
+    uint32_t *yes;
+    uint32_t *no;
+    uint32_t *textOff;
+    uint8_t *flags;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t root;        /* CT_NONE for an empty tree */
+    char *pool;
+    size_t poolLen;
+    size_t poolCap;
+    CtEdit *undo;         /* edit stacks, newest last */
+    int undoCount, undoCap;
+    CtEdit *redo;
+    int redoCount, redoCap;
+} CompactTree;
+
+void ct_init(CompactTree *t);
+void ct_free(CompactTree *t);
+int ct_reserve(CompactTree *t, uint32_t need);   /* room for `need` nodes */
+uint32_t ct_add(CompactTree *t, const char *text, int isQuestion);  /* CT_NONE on failure */
+int ct_from_tree(CompactTree *t, Node *root);  /* replaces t's contents */
+uint32_t ct_child(const CompactTree *t, uint32_t i, int yes);
+const char *ct_text(const CompactTree *t, uint32_t i);
+int ct_is_question(const CompactTree *t, uint32_t i);
+uint32_t ct_count_reachable(const CompactTree *t);
+uint32_t ct_insert_split(CompactTree *t, uint32_t parent, int wasYesChild, uint32_t oldLeaf,
+                         const char *question, const char *animal, int newYes);
+int ct_undo(CompactTree *t);
+int ct_redo(CompactTree *t);
+int ct_check_integrity(const CompactTree *t);
+int ct_save(const CompactTree *t, const char *filename);  /* TREE_FORMAT_V2, persist.c */
+int ct_load(CompactTree *t, const char *filename);        /* TREE_FORMAT_V2 only */
+
+/* ========== Block Compression (lz.c) ========== */
+size_t lz_bound(size_t n);
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t rawLen);
 
 /* ========== Utilities ========== */
 int check_integrity();
 void find_shortest_path(const char *animal1, const char *animal2);
 
+/* Distinguishing questions. In in-order (yes side first) the leaves of a
+ * full tree alternate with the questions, and the question between leaf i
+ * and leaf i + 1 is their LCA; so LCA(leaf i, leaf j) is the shallowest of
+ * the questions between them, an O(1) sparse table lookup over their
+ * depths. The first query after the animal index is dropped builds the
+ * tables; learning, undo and redo update them in O(1) via lca_update():
+ * the nodes a learn adds are filed under the leaf they grew out of, and
+ * pairs under the same one are settled with parent links, as are nodes
+ * above the leaves. Once the learns filed outnumber half the leaves, the
+ * next query rebuilds the tables. A shared node keeps only one of its
+ * parents, so tree_lca (NULL), find_paths (-1) and find_shortest_path
+ * refuse shared trees. */
+typedef struct {
+    const char *animal1;
+    const char *animal2;
+    Node *split;  /* out: the question that tells them apart; NULL if one is unknown or both are one leaf */
+    int yes1;     /* out: 1 if animal1 is on split's yes side */
+} PathQuery;
+
+Node *tree_lca(Node *a, Node *b);
+int find_paths(PathQuery *queries, int count);  /* pairs with a split; -1 out of memory or shared */
+void lca_update(Node *before, const Edit *e, int applied);  /* after an edit (applied) or its undo */
+void lca_free(void);
+
+/* Tree diff: reports each place two trees differ, meaning a node whose text
+ * or type differs or that only one side has; nothing below it is reported.
+ * Subtrees with equal hashes are skipped whole, so the walk only follows
+ * the paths down to the differences. path holds the answers from the root
+ * ('y'/'n', "" at the root). */
+typedef void (*DiffReport)(const char *path, const Node *a, const Node *b, void *ctx);
+int tree_diff(Node *a, Node *b, DiffReport report, void *ctx);  /* places found; -1 out of memory */
+int diff_files(const char *fileA, const char *fileB, FILE *out);  /* prints them; -1 if a load fails */
+
 /* ========== Gameplay ========== */
 void play_game();
 
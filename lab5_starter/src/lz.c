@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lab5.h"
+
+/* Byte-oriented LZ77 block codec used for compressed string pools.
+ *
+ * A block is a run of sequences:
+ *   token       hi nibble = literal count, lo nibble = match length - 4
+ *               (15 in either means extra length bytes follow: each adds
+ *               its value, a byte < 255 ends the run)
+ *   literals    copied verbatim
+ *   offset      2 bytes little-endian, distance back into the output
+ *   [match ext] extra match length bytes
+ * The final sequence carries literals only (no offset). Offsets never reach
+ * outside the block, so blocks decode independently.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5   /* tail always stored as literals */
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    if (cap < lz_bound(n)) return 0;
+    uint32_t *table = (uint32_t *)calloc((size_t)1 << LZ_HASH_BITS, sizeof(uint32_t));
+    if (!table) return 0;
+
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *limit = n > LZ_LAST_LITERALS + LZ_MIN_MATCH ? src + n - LZ_LAST_LITERALS - LZ_MIN_MATCH : src;
+    uint8_t *op = dst;
+
+    while (ip < limit) {
+        uint32_t h = lz_hash4(read32(ip));
+        const uint8_t *ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        // extend the match, stopping short of the literal tail
+        const uint8_t *matchEnd = src + n - LZ_LAST_LITERALS;
+        size_t mlen = LZ_MIN_MATCH;
+        while (ip + mlen < matchEnd && ref[mlen] == ip[mlen]) mlen++;
+
+        size_t lit = (size_t)(ip - anchor);
+        uint8_t *token = op++;
+        *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+        if (lit >= 15) op = put_length(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+
+        uint16_t off = (uint16_t)(ip - ref);
+        *op++ = (uint8_t)(off & 0xFF);
+        *op++ = (uint8_t)(off >> 8);
+        size_t ml = mlen - LZ_MIN_MATCH;
+        *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+        if (ml >= 15) op = put_length(op, ml - 15);
+
+        ip += mlen;
+        anchor = ip;
+    }
+
+    // last literals
+    size_t lit = (size_t)(src + n - anchor);
+    *op++ = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = put_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    free(table);
+    return (size_t)(op - dst);
+}
+
+/* Decodes one block into dst, which must hold exactly rawLen bytes; any
+ * malformed input is rejected rather than read or written out of bounds.
+ * Returns 1 if the block decoded to exactly rawLen bytes. */
+int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t rawLen) {
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + rawLen;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return 0;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return 0;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break; //final literal-only sequence
+
+        if (iend - ip < 2) return 0;
+        size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - dst)) return 0;
+
+        size_t mlen = (token & 15u) + LZ_MIN_MATCH;
+        if ((token & 15u) == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return 0;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        if ((size_t)(oend - op) < mlen) return 0;
+
+        const uint8_t *ref = op - off;
+        if (off >= 8) { //non-overlapping 8-byte steps, then the remainder
+            while (mlen >= 8) {
+                memcpy(op, ref, 8);
+                op += 8;
+                ref += 8;
+                mlen -= 8;
+            }
+        }
+        while (mlen--) *op++ = *ref++; //overlapping copies repeat the pattern
+    }
+    return op == oend;
+}
@@ -30,7 +30,7 @@ EditStack g_undo = {NULL, 0, 0};
 EditStack g_redo = {NULL, 0, 0};
 
 /* Global attribute index */
-Hash g_index = {NULL, 0, 0};
+Hash g_index = { .maxLoad = H_DEFAULT_LOAD };
 
 /* GUI Colors */
 #define COLOR_HEADER 1
@@ -81,6 +81,7 @@ void display_menu() {
     int row = LINES - 3;
     attron(COLOR_PAIR(COLOR_HEADER));
     mvprintw(row, 2, "[P]lay | [V]iew Tree | [U]ndo | [R]edo | [S]ave | [L]oad | [I]ntegrity | [Q]uit");
+    mvprintw(row + 1, 2, "[C]ompact | S[h]are Subtrees");
     attroff(COLOR_PAIR(COLOR_HEADER));
 }
 
@@ -139,12 +140,21 @@ void initialize_tree() {
     g_root = water;
     
     h_free(&g_index);
-    h_init(&g_index, 31);
+    //chained, not HASH_OPEN: it grows a few buckets per insert, so no learn stalls on a rehash;
+    //questions share long prefixes: the word-at-a-time hash spreads them
+    h_init_as(&g_index, 32, HASH_WIDE);
     
     
 }
 
-int main() {
+int main(int argc, char **argv) {
+    /* guess_animal --diff A B: prints where two saved trees differ, no UI */
+    if (argc == 4 && strcmp(argv[1], "--diff") == 0) {
+        int found = diff_files(argv[2], argv[3], stdout);
+        if (found < 0) fprintf(stderr, "could not load %s or %s\n", argv[2], argv[3]);
+        return found < 0 ? 2 : found > 0;
+    }
+
     init_gui();
     
     /* Initialize undo/redo stacks FIRST */
@@ -159,6 +169,10 @@ int main() {
     es_init(&g_redo);
     
     initialize_tree();
+    set_load_progressive(1);      /* playable before a big tree is fully built */
+    if (!journal_open("animals.dat")) {  /* last snapshot + every edit since */
+        show_message("Saved tree not fully loaded; its files are kept for next time.", 1);
+    }
     
     int running = 1;
     while (running) {
@@ -167,8 +181,27 @@ int main() {
         draw_box(2, 1, LINES - 6, COLS - 2, "Game Status");
         display_menu();
         
-        mvprintw(4, 3, "Tree nodes: %d", g_root ? count_nodes(g_root) : 0);
+        if (load_pending()) {
+            mvprintw(4, 3, "Tree nodes: loading...");  /* counting would wait for the load */
+        } else {
+            load_wait(); //a background load that has finished: settles its counts once
+            ShareStats ss;
+            share_stats(&ss);
+            if (ss.nodesSaved > 0) { //shared subtrees count once per place they appear
+                mvprintw(4, 3, "Tree nodes: %d (%ld stored, %zu bytes saved) | Animals: %d",
+                         subtree_nodes(g_root), subtree_nodes(g_root) - ss.nodesSaved,
+                         ss.bytesSaved, subtree_leaves(g_root));
+            } else {
+                mvprintw(4, 3, "Tree nodes: %d | Animals: %d", subtree_nodes(g_root), subtree_leaves(g_root));
+            }
+        }
         mvprintw(5, 3, "Undo stack: %d | Redo stack: %d", g_undo.size, g_redo.size);
+        InternStats is;
+        intern_stats(&is);
+        if (is.strings > 0) {
+            mvprintw(6, 3, "Texts: %ld distinct, %.1f refs each, %zu bytes saved",
+                     is.strings, (double)is.refs / (double)is.strings, is.savedBytes);
+        }
         
         if (g_root == NULL) {
             attron(COLOR_PAIR(COLOR_ERROR));
@@ -208,14 +241,14 @@ int main() {
             case 's':
                 if (g_root == NULL) {
                     show_message("Error: No tree to save! Initialize tree first.", 1);
-                } else if (save_tree("animals.dat")) {
+                } else if (journal_compact()) {
                     show_message("Tree saved successfully!", 0);
                 } else {
                     show_message("Error saving tree!", 1);
                 }
                 break;
             case 'l':
-                if (load_tree("animals.dat")) {
+                if (journal_open("animals.dat")) {
                     show_message("Tree loaded successfully!", 0);
                 } else {
                     show_message("Error loading tree!", 1);
@@ -230,6 +263,30 @@ int main() {
                     show_message("Tree integrity check failed!", 1);
                 }
                 break;
+            case 'c':
+                if (g_root == NULL) {
+                    show_message("Error: No tree to compact! Initialize tree first.", 1);
+                } else if (tree_is_shared()) {
+                    show_message("Cannot compact: the tree has shared subtrees.", 1);
+                } else if (tree_compact(LAYOUT_AUTO)) {
+                    show_message("Tree compacted!", 0);
+                } else {
+                    show_message("Error compacting tree (out of memory)!", 1);
+                }
+                break;
+            case 'h':
+                if (g_root == NULL) {
+                    show_message("Error: No tree to share! Initialize tree first.", 1);
+                } else if (tree_share()) { //v2 saves keep it; the next load is shared too
+                    ShareStats ss;
+                    share_stats(&ss);
+                    char msg[96];
+                    snprintf(msg, sizeof(msg), "Subtrees shared: %ld nodes (%zu bytes) saved", ss.nodesSaved, ss.bytesSaved);
+                    show_message(msg, 0);
+                } else {
+                    show_message("Error sharing subtrees (out of memory)!", 1);
+                }
+                break;
             case 'q':
                 running = 0;
                 break;
@@ -237,10 +294,14 @@ int main() {
     }
     
     endwin();
+    journal_close();
+    load_wait();
     free_tree(g_root);
     free_edit_stack(&g_undo);
     free_edit_stack(&g_redo);
     h_free(&g_index);
+    animal_index_free();
+    lca_free();
     
     return 0;
 }
@@ -1,28 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE  /* madvise */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "lab5.h"
 
 extern Node *g_root;
 
 #define MAGIC 0x41544C35  /* "ATL5" */
-#define VERSION 1
+#define VERSION TREE_FORMAT_V1
+#define MAX_TEXT_LEN 10000
 
+/* Version 2 image: ImageHeader, `count` ImageNode records in BFS order, then
+ * the string pool. Every text is NUL-terminated inside the pool, so a mapped
+ * file can be traversed in place and nodes can point straight into it.
+ * Fields are native-endian, like version 1. */
+typedef struct {
+    int32_t magic;
+    int32_t version;
+    int32_t count;
+    uint32_t flags;       /* IMAGE_* bits */
+    uint64_t poolBytes;
+} ImageHeader;
+
+typedef struct {
+    uint32_t textOffset;  /* into the string pool */
+    uint32_t lenFlags;    /* bit 31: isQuestion, low bits: text length */
+    int32_t yesId;        /* -1 if none */
+    int32_t noId;
+} ImageNode;
+
+#define IMAGE_IS_QUESTION 0x80000000u
+
+/* Header flag: the string pool is stored as LZ blocks (see lz.c). Layout
+ * after the node table: uint32 blockCount, uint32 compLen[blockCount], then
+ * the blocks back to back. Every block but the last holds POOL_BLOCK raw
+ * bytes; a block whose compLen equals its raw length is stored verbatim.
+ * The node table stays uncompressed so it is still checked in place. */
+#define IMAGE_POOL_LZ 0x1u
+#define POOL_BLOCK (64 * 1024)
+
+/* Header flag: the tree had shared subtrees (see Subtree Sharing) and each
+ * was written once, so several records may name the same child id and a
+ * child's id may be lower than its parent's. Such images are never paged. */
+#define IMAGE_SHARED 0x2u
+
+/* Header flag: a uint64 hash[count] array (each node's subtree hash, see
+ * node_hash) sits between the node table and the pool, so a load keeps the
+ * hashes instead of recomputing them. The table is a multiple of 8 bytes
+ * past a 24-byte header, so the array is aligned in a mapped file. */
+#define IMAGE_HASHES 0x4u
+
+/* BFS order doubles as the id: map[id] describes node `id`, and its children's
+ * ids are recorded at the moment they are assigned, so no pointer lookup is
+ * ever needed while writing. */
 typedef struct {
     Node *node;
-    int id;
+    int32_t yesId;
+    int32_t noId;
 } NodeMapping;
 
+#define SAVE_IO_BUFFER (1 << 16)
 
-//helpers
-static int find_id(NodeMapping *map, int mcount, Node *n) {
-    for (int i = 0; i < mcount; i++) { //goes through and scans the mapping
-        if (map[i].node == n) return map[i].id; //returns id if matched
-    }
-    return -1; //means not found
-}
 
+//helpers
 static int ensure_map_capacity(NodeMapping **map, int *cap, int need) {
     if (need <= *cap) return 1; //checks if there is enough space
     int newcap = (*cap == 0) ? 64 : *cap; //both starts or grows the capacity
@@ -34,8 +80,140 @@ static int ensure_map_capacity(NodeMapping **map, int *cap, int need) {
     return 1;
 }
 
+/* ---------- Worker threads ----------
+ * Load: once record boundaries are known, nodes for disjoint id ranges can
+ * be built (and linked, since every node already has its slot in the block)
+ * by separate threads. Save: frontier subtrees are serialized as separate
+ * jobs. Small trees stay on the calling thread. */
+#define MIN_NODES_PER_THREAD (64 * 1024)
+/* A save thread pays for itself sooner (it serializes, not just links), but
+ * below this many nodes per thread starting it costs more than the write. */
+#define MIN_SAVE_NODES_PER_THREAD (16 * 1024)
+
+typedef int (*RangeFn)(void *ctx, int begin, int end);
+
+typedef struct {
+    RangeFn fn;
+    void *ctx;
+    int begin;
+    int end;
+    int ok;
+} RangeTask;
+
+static int g_load_threads = 0; //0 = one per online CPU
+static int g_save_threads = 0;
+
+void set_load_threads(int threads) {
+    g_load_threads = threads > 0 ? threads : 0;
+}
+
+void set_save_threads(int threads) {
+    g_save_threads = threads > 0 ? threads : 0;
+}
+
+static int resolve_threads(int configured) {
+    if (configured > 0) return configured;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+static void *run_range(void *arg) {
+    RangeTask *t = (RangeTask *)arg;
+    t->ok = t->fn(t->ctx, t->begin, t->end);
+    return NULL;
+}
+
+/* Runs fn over [0, count) split into contiguous ranges; 1 if all succeed. */
+static int parallel_ranges(int count, RangeFn fn, void *ctx) {
+    int threads = resolve_threads(g_load_threads);
+    int maxUseful = count / MIN_NODES_PER_THREAD;
+    if (threads > maxUseful) threads = maxUseful;
+    if (threads <= 1) return fn(ctx, 0, count);
+
+    RangeTask *tasks = (RangeTask *)calloc((size_t)threads, sizeof(RangeTask));
+    pthread_t *tids = (pthread_t *)calloc((size_t)threads, sizeof(pthread_t));
+    int *started = (int *)calloc((size_t)threads, sizeof(int));
+    if (!tasks || !tids || !started) {
+        free(tasks); free(tids); free(started);
+        return fn(ctx, 0, count);
+    }
+    for (int t = 0; t < threads; t++) {
+        tasks[t] = (RangeTask){ fn, ctx, (int)((long)count * t / threads),
+                                (int)((long)count * (t + 1) / threads), 0 };
+    }
+    for (int t = 1; t < threads; t++) { //range 0 runs on this thread
+        started[t] = pthread_create(&tids[t], NULL, run_range, &tasks[t]) == 0;
+        if (!started[t]) run_range(&tasks[t]);
+    }
+    run_range(&tasks[0]);
+
+    int ok = 1;
+    for (int t = 0; t < threads; t++) {
+        if (t > 0 && started[t]) pthread_join(tids[t], NULL);
+        if (!tasks[t].ok) ok = 0;
+    }
+    free(tasks);
+    free(tids);
+    free(started);
+    return ok;
+}
+
+typedef int (*JobFn)(void *ctx, int job);
+
+typedef struct {
+    JobFn fn;
+    void *ctx;
+    int njobs;
+    int next;             /* next job to hand out, under lock */
+    int ok;
+    pthread_mutex_t lock;
+} JobQueue;
+
+static void *run_jobs(void *arg) {
+    JobQueue *q = (JobQueue *)arg;
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        int job = q->next < q->njobs ? q->next++ : -1;
+        pthread_mutex_unlock(&q->lock);
+        if (job < 0) break;
+        if (!q->fn(q->ctx, job)) {
+            pthread_mutex_lock(&q->lock);
+            q->ok = 0;
+            pthread_mutex_unlock(&q->lock);
+        }
+    }
+    return NULL;
+}
+
+/* Runs fn for every job index on up to `threads` threads, handing jobs out
+ * one at a time so uneven subtrees still balance. 1 if all succeed. */
+static int parallel_jobs(int njobs, int threads, JobFn fn, void *ctx) {
+    JobQueue q;
+    q.fn = fn;
+    q.ctx = ctx;
+    q.njobs = njobs;
+    q.next = 0;
+    q.ok = 1;
+    pthread_mutex_init(&q.lock, NULL);
+    if (threads > njobs) threads = njobs;
+
+    pthread_t *tids = (pthread_t *)calloc((size_t)(threads > 1 ? threads : 1), sizeof(pthread_t));
+    int started = 0;
+    for (int t = 1; tids && t < threads; t++) { //this thread is worker 0
+        if (pthread_create(&tids[started], NULL, run_jobs, &q) != 0) break;
+        started++;
+    }
+    run_jobs(&q);
+    for (int t = 0; t < started; t++) pthread_join(tids[t], NULL);
+    free(tids);
+    pthread_mutex_destroy(&q.lock);
+    return q.ok;
+}
+
 /* TODO 27: Implement save_tree
  * Save the tree to a binary file using BFS traversal
+ * (save_tree now writes TREE_FORMAT_V2; save_tree_as(f, TREE_FORMAT_V1)
+ * still produces the layout below)
  * 
  * Binary format:
  * - Header: magic (4 bytes), version (4 bytes), nodeCount (4 bytes)
@@ -49,95 +227,1186 @@ static int ensure_map_capacity(NodeMapping **map, int *cap, int need) {
  * Steps:
  * 1. Return 0 if g_root is NULL
  * 2. Open file for writing binary ("wb")
- * 3. Initialize queue and NodeMapping array
+ * 3. Initialize the NodeMapping array (it doubles as the BFS queue)
  * 4. Use BFS to assign IDs to all nodes:
- *    - Enqueue root with id=0
- *    - Store mapping[0] = {g_root, 0}
- *    - While queue not empty:
- *      - Dequeue node and id
- *      - If node has yes child: add to mappings, enqueue with new id
- *      - If node has no child: add to mappings, enqueue with new id
+ *    - Store mapping[0] = {g_root}
+ *    - For head = 0 while head < mcount:
+ *      - If node has yes child: append to mappings, record its id as yesId
+ *      - If node has no child: append to mappings, record its id as noId
  * 5. Write header (magic, version, nodeCount)
  * 6. For each node in mapping order:
  *    - Write isQuestion, textLen, text bytes
- *    - Find yes child's id in mappings (or -1)
- *    - Find no child's id in mappings (or -1)
- *    - Write yesId, noId
+ *    - Write the yesId, noId recorded during the BFS (-1 if NULL)
  * 7. Clean up and return 1 on success
  */
-int save_tree(const char *filename) {
-    // TODO: Implement this function
-    // This is complex - break it into smaller steps
-    // You'll need to use the Queue functions you implemented
-    if (!g_root) return 0;
+static int write_v1(FILE *fp, const NodeMapping *map, int mcount);
+static int write_v2(FILE *fp, const NodeMapping *map, int mcount, int compressed, int shared,
+                    int hashes);
+static int write_parallel(FILE *fp, int version, int threads);
+static int write_preorder(FILE *fp);
 
-    FILE *fp = fopen(filename, "wb"); //open to write
-    if (!fp) return 0;
-
-    //  BFS to assign ids
-    Queue q; //queue for BFS
-    q_init(&q);
+/* Id for child, appending it to the map unless shared says a shared node
+ * keeps the id it got the first time; -1 if out of memory. */
+static int32_t map_child(NodeMapping **map, int *mcap, int *mcount, Node *child,
+                         NodeMap *shared) {
+    NodeMapSlot *s = NULL;
+    if (shared && (child->flags & NODE_SHARED)) {
+        s = nm_put(shared, child);
+        if (!s) return -1;
+        if (s->val) return s->val - 1; //written already
+    }
+    if (!ensure_map_capacity(map, mcap, *mcount + 1)) return -1;
+    if (s) s->val = *mcount + 1;
+    (*map)[*mcount] = (NodeMapping){ child, -1, -1 };
+    return (*mcount)++;
+}
 
+/* BFS over root; on success *out holds mcount entries indexed by id. With
+ * dedupe, a shared node is numbered once however many parents link it. */
+static int build_bfs_map(Node *root, int dedupe, NodeMapping **out, int *outCount) {
+    //  BFS to assign ids. The mapping array is the BFS queue itself: entries
+    //  are appended as children are discovered and consumed by `head`, so
+    //  every id is known the moment it is handed out (single linear pass).
     NodeMapping *map = NULL; //dynamically mapping array
     int mcap = 0, mcount = 0;
+    NodeMap shared = { NULL, 0, 0 };
 
-    if (!ensure_map_capacity(&map, &mcap, 1)) { fclose(fp); q_free(&q); return 0; } //ensures the slot
+    if (!ensure_map_capacity(&map, &mcap, 1)) return 0; //ensures the slot
+    map[mcount++] = (NodeMapping){ root, -1, -1 }; //sets map root -> 0
 
-    q_enqueue(&q, g_root, 0); //sets map root -> 0
-    map[mcount++] = (NodeMapping){ g_root, 0 };
-
-    Node *cur; //BFS node
-    int cid; //BFS id
-    while (q_dequeue(&q, &cur, &cid)) {
-        //visits yes child, ensures the slot is open, assigns id, enqueues the child, and adds to the count
+    for (int head = 0; head < mcount; head++) {
+        Node *cur = map[head].node; //BFS node, id == head
+        //visits yes child, ensures the slot is open, assigns id and records it on the parent
         if (cur->yes) {
-            if (!ensure_map_capacity(&map, &mcap, mcount + 1)) { fclose(fp); q_free(&q); free(map); return 0; }
-            map[mcount] = (NodeMapping){ cur->yes, mcount };
-            q_enqueue(&q, cur->yes, mcount);
-            mcount++;
+            int32_t id = map_child(&map, &mcap, &mcount, cur->yes, dedupe ? &shared : NULL);
+            if (id < 0) { free(map); nm_free(&shared); return 0; }
+            map[head].yesId = id;
         }
         if (cur->no) {
             //same thing but with no child
-            if (!ensure_map_capacity(&map, &mcap, mcount + 1)) { fclose(fp); q_free(&q); free(map); return 0; }
-            map[mcount] = (NodeMapping){ cur->no, mcount };
-            q_enqueue(&q, cur->no, mcount);
-            mcount++;
+            int32_t id = map_child(&map, &mcap, &mcount, cur->no, dedupe ? &shared : NULL);
+            if (id < 0) { free(map); nm_free(&shared); return 0; }
+            map[head].noId = id;
         }
     }
-    q_free(&q); //frees the queue when done
+    nm_free(&shared);
+    *out = map;
+    *outCount = mcount;
+    return 1;
+}
 
-    // header
-    int32_t magic = (int32_t)MAGIC;
-    int32_t version = (int32_t)VERSION;
-    int32_t count = (int32_t)mcount;
+int save_tree(const char *filename) {
+    // TODO: Implement this function
+    // This is complex - break it into smaller steps
+    // You'll need to use the Queue functions you implemented
+    return save_tree_as(filename, TREE_FORMAT_V2);
+}
 
-    //write magic, version, count, and bails if input or output error
-    if (fwrite(&magic, sizeof(int32_t), 1, fp) != 1 ||
-        fwrite(&version, sizeof(int32_t), 1, fp) != 1 ||
-        fwrite(&count, sizeof(int32_t), 1, fp) != 1) {
-        fclose(fp); free(map); return 0;
+/* Saves are written under "<filename>.tmp" and renamed into place, so a tree
+ * that is still mapped from `filename` (version 2) stays valid while it is
+ * being saved over. */
+static FILE *open_replacement(const char *filename, char **tmpName) {
+    size_t nameLen = strlen(filename);
+    *tmpName = (char *)malloc(nameLen + 5); //"<filename>.tmp"
+    if (!*tmpName) return NULL;
+    memcpy(*tmpName, filename, nameLen);
+    memcpy(*tmpName + nameLen, ".tmp", 5);
+
+    FILE *fp = fopen(*tmpName, "wb"); //open to write
+    if (!fp) { free(*tmpName); *tmpName = NULL; return NULL; }
+    setvbuf(fp, NULL, _IOFBF, SAVE_IO_BUFFER); //few large writes instead of many small ones
+    return fp;
+}
+
+static int commit_replacement(FILE *fp, char *tmpName, const char *filename, int ok) {
+    if (fclose(fp) != 0) ok = 0; //flushes the buffer, catches late write errors
+    if (ok && rename(tmpName, filename) != 0) ok = 0; //atomically replaces the old file
+    if (!ok) remove(tmpName);
+    free(tmpName);
+    return ok;
+}
+
+/* Writes g_root in the requested layout. */
+int save_tree_as(const char *filename, int version) {
+    if (!g_root) return 0;
+    load_wait(); //the writers follow links directly
+    int compressed = (version & TREE_POOL_COMPRESSED) != 0;
+    int hashes = (version & TREE_HASHES) != 0;
+    version &= ~(TREE_POOL_COMPRESSED | TREE_HASHES);
+    if (version != TREE_FORMAT_V1 && version != TREE_FORMAT_V2 &&
+        version != TREE_FORMAT_PREORDER) return 0;
+    if ((compressed || hashes) && version != TREE_FORMAT_V2) return 0;
+
+    char *tmpName = NULL;
+    FILE *fp = open_replacement(filename, &tmpName);
+    if (!fp) return 0;
+
+    int ok;
+    int threads = resolve_threads(g_save_threads);
+    int maxUseful = subtree_nodes(g_root) / MIN_SAVE_NODES_PER_THREAD; //counts are final after load_wait
+    if (threads > maxUseful) threads = maxUseful; //small trees take the streaming writer
+    int shared = version == TREE_FORMAT_V2 && tree_is_shared(); //other layouts write every copy
+    if (version == TREE_FORMAT_PREORDER) {
+        ok = write_preorder(fp); //no ids to number, one DFS
+    } else if (threads > 1 && !compressed && !shared && !hashes) {
+        ok = write_parallel(fp, version, threads); //frontier subtrees on worker threads
+    } else {
+        NodeMapping *map = NULL;
+        int mcount = 0;
+        ok = build_bfs_map(g_root, shared, &map, &mcount);
+        if (ok) {
+            ok = version == TREE_FORMAT_V1 ? write_v1(fp, map, mcount)
+                                           : write_v2(fp, map, mcount, compressed, shared, hashes);
+        }
+        free(map);
     }
+    return commit_replacement(fp, tmpName, filename, ok);
+}
 
+/* Writes v1 records for map[from, to); ids in the map are already global. */
+static int write_v1_records(FILE *fp, const NodeMapping *map, int from, int to) {
     // nodes in mapping order
-    for (int i = 0; i < mcount; i++) {
+    for (int i = from; i < to; i++) {
         Node *n = map[i].node; //cur node
 
         uint8_t isQ = (uint8_t)(n->isQuestion ? 1 : 0); //type checked
         int32_t textLen = (int32_t)strlen(n->text); //text length
-        int32_t yesId = n->yes ? (int32_t)find_id(map, mcount, n->yes) : -1; //yes link id
-        int32_t noId  = n->no  ? (int32_t)find_id(map, mcount, n->no)  : -1; //no link id
+        int32_t yesId = map[i].yesId; //yes link id (-1 if none)
+        int32_t noId  = map[i].noId; //no link id (-1 if none)
 
         if (fwrite(&isQ, sizeof(uint8_t), 1, fp) != 1 || //write type
             fwrite(&textLen, sizeof(int32_t), 1, fp) != 1 || //write length
             fwrite(n->text, 1, (size_t)textLen, fp) != (size_t)textLen || //write text
             fwrite(&yesId, sizeof(int32_t), 1, fp) != 1 || //write yes id
             fwrite(&noId, sizeof(int32_t), 1, fp) != 1) { //write no id
-            fclose(fp); free(map); return 0; //if input or output fails, bail
+            return 0; //if input or output fails, bail
         }
     }
+    return 1;
+}
+
+static int write_v1_header(FILE *fp, int mcount) {
+    // header
+    int32_t magic = (int32_t)MAGIC;
+    int32_t version = (int32_t)TREE_FORMAT_V1;
+    int32_t count = (int32_t)mcount;
+
+    //write magic, version, count, and bails if input or output error
+    return fwrite(&magic, sizeof(int32_t), 1, fp) == 1 &&
+           fwrite(&version, sizeof(int32_t), 1, fp) == 1 &&
+           fwrite(&count, sizeof(int32_t), 1, fp) == 1;
+}
+
+static int write_v1(FILE *fp, const NodeMapping *map, int mcount) {
+    return write_v1_header(fp, mcount) && write_v1_records(fp, map, 0, mcount);
+}
 
-    fclose(fp); //close file, free map
+/* Writes v2 node table entries for map[from, to), advancing *offset. */
+static int write_v2_records(FILE *fp, const NodeMapping *map, int from, int to, uint32_t *offset) {
+    for (int i = from; i < to; i++) {
+        Node *n = map[i].node;
+        uint32_t len = (uint32_t)strlen(n->text);
+        if (len > MAX_TEXT_LEN) return 0;
+        ImageNode rec;
+        rec.textOffset = *offset;
+        rec.lenFlags = len | (n->isQuestion ? IMAGE_IS_QUESTION : 0u);
+        rec.yesId = map[i].yesId;
+        rec.noId = map[i].noId;
+        if (fwrite(&rec, sizeof(rec), 1, fp) != 1) return 0;
+        *offset += len + 1;
+    }
+    return 1;
+}
+
+static int write_v2_texts(FILE *fp, const NodeMapping *map, int from, int to) {
+    for (int i = from; i < to; i++) {
+        const char *text = map[i].node->text;
+        size_t len = strlen(text) + 1;
+        if (fwrite(text, 1, len, fp) != len) return 0;
+    }
+    return 1;
+}
+
+/* Compresses the pool block by block and writes directory + blocks. */
+static int write_pool_lz(FILE *fp, const char *pool, size_t poolBytes) {
+    uint32_t blocks = (uint32_t)((poolBytes + POOL_BLOCK - 1) / POOL_BLOCK);
+    uint32_t *dir = (uint32_t *)malloc(sizeof(uint32_t) * (blocks ? blocks : 1));
+    uint8_t *out = (uint8_t *)malloc(lz_bound(poolBytes) + (size_t)blocks * 16);
+    if (!dir || !out) { free(dir); free(out); return 0; }
+
+    size_t outLen = 0;
+    for (uint32_t i = 0; i < blocks; i++) {
+        size_t start = (size_t)i * POOL_BLOCK;
+        size_t raw = poolBytes - start < POOL_BLOCK ? poolBytes - start : POOL_BLOCK;
+        size_t comp = lz_compress((const uint8_t *)pool + start, raw, out + outLen, lz_bound(raw));
+        if (comp == 0 || comp >= raw) { //incompressible: keep it verbatim
+            memcpy(out + outLen, pool + start, raw);
+            comp = raw;
+        }
+        dir[i] = (uint32_t)comp;
+        outLen += comp;
+    }
+
+    int ok = fwrite(&blocks, sizeof(uint32_t), 1, fp) == 1 &&
+             fwrite(dir, sizeof(uint32_t), blocks, fp) == blocks &&
+             fwrite(out, 1, outLen, fp) == outLen;
+    free(dir);
+    free(out);
+    return ok;
+}
+
+static int write_v2(FILE *fp, const NodeMapping *map, int mcount, int compressed, int shared,
+                    int hashes) {
+    ImageHeader hdr = { (int32_t)MAGIC, (int32_t)TREE_FORMAT_V2, (int32_t)mcount,
+                        (compressed ? IMAGE_POOL_LZ : 0u) | (shared ? IMAGE_SHARED : 0u) |
+                        (hashes ? IMAGE_HASHES : 0u), 0u };
+
+    //first pass: pool size, so offsets fit in 32 bits
+    for (int i = 0; i < mcount; i++) {
+        hdr.poolBytes += (uint64_t)strlen(map[i].node->text) + 1;
+    }
+    if (hdr.poolBytes > UINT32_MAX) return 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) return 0;
+
+    //node table
+    uint32_t offset = 0;
+    if (!write_v2_records(fp, map, 0, mcount, &offset)) return 0;
+    for (int i = 0; hashes && i < mcount; i++) {
+        uint64_t h = map[i].node->hash;
+        if (fwrite(&h, sizeof(h), 1, fp) != 1) return 0;
+    }
+
+    //string pool, terminators included
+    if (!compressed) return write_v2_texts(fp, map, 0, mcount);
+
+    char *pool = (char *)malloc((size_t)hdr.poolBytes); //gathered so blocks span node boundaries
+    if (!pool) return 0;
+    size_t pos = 0;
+    for (int i = 0; i < mcount; i++) {
+        const char *text = map[i].node->text;
+        size_t len = strlen(text) + 1;
+        memcpy(pool + pos, text, len);
+        pos += len;
+    }
+    int ok = write_pool_lz(fp, pool, pos);
+    free(pool);
+    return ok;
+}
+
+/* ---------- Parallel save ----------
+ * BFS ids interleave subtrees level by level, so the tree is cut at a
+ * frontier level: levels above it are numbered serially as usual, and each
+ * frontier subtree is numbered and serialized by its own job with local BFS
+ * ids. At frontier depth k the global BFS order is subtree 0's depth-k nodes,
+ * then subtree 1's, and so on, so once per-level counts are summed every
+ * local id maps to a global one and the stitched file is byte-identical to
+ * the streaming save. */
+
+typedef struct {
+    Node *root;
+    NodeMapping *map;       /* local BFS order, local child ids */
+    int count;
+    int levels;
+    int *levelStart;        /* levels + 1 entries into map */
+    uint64_t *levelText;    /* text bytes (with NUL) per level */
+    int32_t *globalBase;    /* per level: global id of its first node */
+    uint64_t *poolBase;     /* per level: pool offset of its first text (v2) */
+    char *out;              /* serialized records (v1) or ImageNodes (v2) */
+    size_t *outAt;          /* levels + 1 offsets into out */
+    char *pool;             /* v2 only: texts, level by level */
+    size_t *poolAt;
+} SubtreeJob;
+
+typedef struct {
+    SubtreeJob *jobs;
+    int version;
+} SaveJobs;
+
+/* Phase 1: local BFS ids and per-level sizes for one frontier subtree. */
+static int number_subtree(void *arg, int job) {
+    SubtreeJob *j = &((SaveJobs *)arg)->jobs[job];
+    if (!build_bfs_map(j->root, 0, &j->map, &j->count)) return 0;
+
+    int cap = 16;
+    j->levelStart = (int *)malloc(sizeof(int) * (size_t)(cap + 1));
+    j->levelText = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)cap);
+    if (!j->levelStart || !j->levelText) return 0;
+    // a level's children are exactly the ids it handed out, so the next
+    // level ends one past the last child id assigned from this one
+    int start = 0, end = 1;
+    while (start < end) {
+        if (j->levels == cap) {
+            cap *= 2;
+            int *ls = (int *)realloc(j->levelStart, sizeof(int) * (size_t)(cap + 1));
+            if (ls) j->levelStart = ls;
+            uint64_t *lt = (uint64_t *)realloc(j->levelText, sizeof(uint64_t) * (size_t)cap);
+            if (lt) j->levelText = lt;
+            if (!ls || !lt) return 0;
+        }
+        uint64_t text = 0;
+        int nextEnd = end;
+        for (int i = start; i < end; i++) {
+            text += strlen(j->map[i].node->text) + 1;
+            if (j->map[i].yesId >= 0) nextEnd = j->map[i].yesId + 1;
+            if (j->map[i].noId >= 0) nextEnd = j->map[i].noId + 1;
+        }
+        j->levelStart[j->levels] = start;
+        j->levelText[j->levels] = text;
+        j->levels++;
+        start = end;
+        end = nextEnd;
+    }
+    j->levelStart[j->levels] = j->count;
+    return 1;
+}
+
+static int32_t global_id(const SubtreeJob *j, int level, int32_t local) {
+    return local < 0 ? -1 : j->globalBase[level] + (local - j->levelStart[level]);
+}
+
+/* Phase 2: serialize one subtree into memory, level by level, with global
+ * child ids and (v2) global pool offsets. */
+static int serialize_subtree(void *arg, int job) {
+    SubtreeJob *j = &((SaveJobs *)arg)->jobs[job];
+    int v2 = ((SaveJobs *)arg)->version == TREE_FORMAT_V2;
+    j->outAt = (size_t *)malloc(sizeof(size_t) * (size_t)(j->levels + 1));
+    j->poolAt = (size_t *)malloc(sizeof(size_t) * (size_t)(j->levels + 1));
+    if (!j->outAt || !j->poolAt) return 0;
+
+    size_t outLen = 0, poolLen = 0;
+    for (int L = 0; L < j->levels; L++) {
+        int n = j->levelStart[L + 1] - j->levelStart[L];
+        j->outAt[L] = outLen;
+        j->poolAt[L] = poolLen;
+        if (v2) {
+            outLen += (size_t)n * sizeof(ImageNode);
+            poolLen += (size_t)j->levelText[L];
+        } else {
+            //isQ + textLen + yesId + noId per record, text without NUL
+            outLen += (size_t)n * (1 + 3 * sizeof(int32_t)) + (size_t)j->levelText[L] - (size_t)n;
+        }
+    }
+    j->outAt[j->levels] = outLen;
+    j->poolAt[j->levels] = poolLen;
+    j->out = (char *)malloc(outLen ? outLen : 1);
+    j->pool = v2 ? (char *)malloc(poolLen ? poolLen : 1) : NULL;
+    if (!j->out || (v2 && !j->pool)) return 0;
+
+    char *op = j->out, *pp = j->pool;
+    for (int L = 0; L < j->levels; L++) {
+        uint64_t textAt = j->poolBase ? j->poolBase[L] : 0;
+        for (int i = j->levelStart[L]; i < j->levelStart[L + 1]; i++) {
+            Node *node = j->map[i].node;
+            int32_t len = (int32_t)strlen(node->text);
+            int32_t yesId = global_id(j, L + 1, j->map[i].yesId);
+            int32_t noId = global_id(j, L + 1, j->map[i].noId);
+            if (len > MAX_TEXT_LEN) return 0;
+            if (v2) {
+                ImageNode rec;
+                rec.textOffset = (uint32_t)textAt;
+                rec.lenFlags = (uint32_t)len | (node->isQuestion ? IMAGE_IS_QUESTION : 0u);
+                rec.yesId = yesId;
+                rec.noId = noId;
+                memcpy(op, &rec, sizeof(rec));
+                op += sizeof(rec);
+                memcpy(pp, node->text, (size_t)len + 1);
+                pp += len + 1;
+                textAt += (uint64_t)len + 1;
+            } else {
+                *op++ = (char)(node->isQuestion ? 1 : 0);
+                memcpy(op, &len, sizeof(int32_t));
+                op += sizeof(int32_t);
+                memcpy(op, node->text, (size_t)len);
+                op += len;
+                memcpy(op, &yesId, sizeof(int32_t));
+                op += sizeof(int32_t);
+                memcpy(op, &noId, sizeof(int32_t));
+                op += sizeof(int32_t);
+            }
+        }
+    }
+    return 1;
+}
+
+static void free_subtree_jobs(SubtreeJob *jobs, int njobs) {
+    for (int s = 0; jobs && s < njobs; s++) {
+        free(jobs[s].map);
+        free(jobs[s].levelStart);
+        free(jobs[s].levelText);
+        free(jobs[s].globalBase);
+        free(jobs[s].poolBase);
+        free(jobs[s].out);
+        free(jobs[s].outAt);
+        free(jobs[s].pool);
+        free(jobs[s].poolAt);
+    }
+    free(jobs);
+}
+
+/* Same bytes as write_v1/write_v2 (uncompressed), built on `threads` threads. */
+static int write_parallel(FILE *fp, int version, int threads) {
+    // top levels, numbered serially until the frontier is wide enough
+    NodeMapping *map = NULL;
+    int mcap = 0, mcount = 0;
+    if (!ensure_map_capacity(&map, &mcap, 1)) return 0;
+    map[mcount++] = (NodeMapping){ g_root, -1, -1 };
+    int start = 0, end = 1;
+    while (end - start < 4 * threads) {
+        for (int head = start; head < end; head++) {
+            Node *cur = map[head].node;
+            if (!ensure_map_capacity(&map, &mcap, mcount + 2)) { free(map); return 0; }
+            if (cur->yes) { map[head].yesId = mcount; map[mcount++] = (NodeMapping){ cur->yes, -1, -1 }; }
+            if (cur->no)  { map[head].noId = mcount;  map[mcount++] = (NodeMapping){ cur->no, -1, -1 }; }
+        }
+        if (mcount == end) break; //nothing below this level
+        start = end;
+        end = mcount;
+    }
+    int topCount = start, njobs = end - start;
+
+    SaveJobs ctx;
+    ctx.version = version;
+    ctx.jobs = (SubtreeJob *)calloc((size_t)njobs, sizeof(SubtreeJob));
+    if (!ctx.jobs) { free(map); return 0; }
+    for (int s = 0; s < njobs; s++) ctx.jobs[s].root = map[topCount + s].node;
+
+    int ok = parallel_jobs(njobs, threads, number_subtree, &ctx);
+
+    // global bases: level by level, subtree by subtree
+    int maxLevels = 0;
+    for (int s = 0; ok && s < njobs; s++) {
+        SubtreeJob *j = &ctx.jobs[s];
+        if (j->levels > maxLevels) maxLevels = j->levels;
+        j->globalBase = (int32_t *)malloc(sizeof(int32_t) * (size_t)(j->levels + 1));
+        j->poolBase = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)(j->levels + 1));
+        if (!j->globalBase || !j->poolBase) ok = 0;
+    }
+    uint64_t topText = 0, poolBytes;
+    for (int i = 0; i < topCount; i++) topText += strlen(map[i].node->text) + 1;
+    int64_t nextId = topCount;
+    uint64_t nextText = topText;
+    for (int L = 0; ok && L <= maxLevels; L++) {
+        for (int s = 0; s < njobs; s++) {
+            SubtreeJob *j = &ctx.jobs[s];
+            if (L > j->levels) continue;
+            j->globalBase[L] = (int32_t)nextId; //level `levels` is empty; base unused
+            j->poolBase[L] = nextText;
+            if (L < j->levels) {
+                nextId += j->levelStart[L + 1] - j->levelStart[L];
+                nextText += j->levelText[L];
+            }
+        }
+    }
+    poolBytes = nextText;
+    if (nextId > INT32_MAX || poolBytes > UINT32_MAX) ok = 0;
+
+    if (ok) ok = parallel_jobs(njobs, threads, serialize_subtree, &ctx);
+
+    // stitch: header, top records, then each level across subtrees
+    if (ok && version == TREE_FORMAT_V1) {
+        ok = write_v1_header(fp, (int)nextId) && write_v1_records(fp, map, 0, topCount);
+    } else if (ok) {
+        ImageHeader hdr = { (int32_t)MAGIC, (int32_t)TREE_FORMAT_V2, (int32_t)nextId, 0u, poolBytes };
+        uint32_t offset = 0;
+        ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && write_v2_records(fp, map, 0, topCount, &offset);
+    }
+    for (int L = 0; ok && L < maxLevels; L++) {
+        for (int s = 0; ok && s < njobs; s++) {
+            SubtreeJob *j = &ctx.jobs[s];
+            if (L >= j->levels) continue;
+            size_t len = j->outAt[L + 1] - j->outAt[L];
+            ok = fwrite(j->out + j->outAt[L], 1, len, fp) == len;
+        }
+    }
+    if (ok && version == TREE_FORMAT_V2) {
+        ok = write_v2_texts(fp, map, 0, topCount);
+        for (int L = 0; ok && L < maxLevels; L++) {
+            for (int s = 0; ok && s < njobs; s++) {
+                SubtreeJob *j = &ctx.jobs[s];
+                if (L >= j->levels) continue;
+                size_t len = j->poolAt[L + 1] - j->poolAt[L];
+                ok = fwrite(j->pool + j->poolAt[L], 1, len, fp) == len;
+            }
+        }
+    }
+
+    free_subtree_jobs(ctx.jobs, njobs);
     free(map);
+    return ok;
+}
+
+/* Inflates a compressed pool into a fresh buffer of poolBytes. */
+static char *read_pool_lz(const uint8_t *src, size_t avail, size_t poolBytes) {
+    uint32_t blocks;
+    if (avail < sizeof(uint32_t)) return NULL;
+    memcpy(&blocks, src, sizeof(uint32_t));
+    if (blocks != (poolBytes + POOL_BLOCK - 1) / POOL_BLOCK ||
+        (avail - sizeof(uint32_t)) / sizeof(uint32_t) < blocks) {
+        return NULL;
+    }
+    const uint8_t *dir = src + sizeof(uint32_t);
+    const uint8_t *data = dir + (size_t)blocks * sizeof(uint32_t);
+    size_t dataAvail = avail - (size_t)(data - src);
+
+    char *pool = (char *)malloc(poolBytes ? poolBytes : 1);
+    if (!pool) return NULL;
+    size_t in = 0;
+    for (uint32_t i = 0; i < blocks; i++) {
+        uint32_t comp;
+        memcpy(&comp, dir + (size_t)i * sizeof(uint32_t), sizeof(uint32_t));
+        size_t start = (size_t)i * POOL_BLOCK;
+        size_t raw = poolBytes - start < POOL_BLOCK ? poolBytes - start : POOL_BLOCK;
+        if (comp > dataAvail - in) { free(pool); return NULL; }
+        if (comp == raw) {
+            memcpy(pool + start, data + in, raw); //stored verbatim
+        } else if (!lz_decompress(data + in, comp, (uint8_t *)pool + start, raw)) {
+            free(pool);
+            return NULL;
+        }
+        in += comp;
+    }
+    return pool;
+}
+
+static void release_arena(void *mem, size_t len) {
+    (void)len;
+    free(mem);
+}
+
+static void unmap_image(void *mem, size_t len) {
+    munmap(mem, len);
+}
+
+/* ---------- Preorder (succinct) layout ----------
+ * Header: magic, version 3, count. Then the shape as one bit per node in
+ * preorder (1 = question, 0 = animal; LSB first, padded to a byte), then
+ * every text NUL-terminated, also in preorder. In a full binary tree a
+ * question's yes subtree starts right after it and its no subtree right
+ * after that, so no child ids are stored. */
+
+/* Preorder node list; fails on a question without both children or a leaf
+ * with any, since the shape bits could not describe it. */
+static int collect_preorder(Node *root, Node ***out, int *outCount) {
+    int cap = 64, count = 0;
+    Node **order = (Node **)malloc(sizeof(Node *) * (size_t)cap);
+    FrameStack st;
+    fs_init(&st);
+    if (!order || !st.frames) { free(order); fs_free(&st); return 0; }
+    fs_push(&st, root, -1);
+    int ok = 1;
+    while (ok && !fs_empty(&st)) {
+        Node *n = fs_pop(&st).node;
+        if (n->isQuestion ? (!n->yes || !n->no) : (n->yes || n->no)) { ok = 0; break; }
+        if (count == cap) {
+            cap *= 2;
+            Node **tmp = (Node **)realloc(order, sizeof(Node *) * (size_t)cap);
+            if (!tmp) { ok = 0; break; }
+            order = tmp;
+        }
+        order[count++] = n;
+        if (n->isQuestion) { //no pushed first so yes comes out first
+            int before = st.size;
+            fs_push(&st, n->no, 0);
+            fs_push(&st, n->yes, 1);
+            if (st.size != before + 2) ok = 0;
+        }
+    }
+    fs_free(&st);
+    if (!ok || count > INT32_MAX) { free(order); return 0; }
+    *out = order;
+    *outCount = count;
+    return 1;
+}
+
+static int write_preorder(FILE *fp) {
+    Node **order = NULL;
+    int count = 0;
+    if (!collect_preorder(g_root, &order, &count)) return 0;
+
+    int32_t hdr[3] = { (int32_t)MAGIC, (int32_t)TREE_FORMAT_PREORDER, (int32_t)count };
+    int ok = fwrite(hdr, sizeof(int32_t), 3, fp) == 3;
+
+    //shape bits, a byte at a time
+    for (int i = 0; ok && i < count; i += 8) {
+        unsigned char byte = 0;
+        for (int b = 0; b < 8 && i + b < count; b++) {
+            if (order[i + b]->isQuestion) byte |= (unsigned char)(1u << b);
+        }
+        ok = fputc(byte, fp) != EOF;
+    }
+    //texts with terminators
+    for (int i = 0; ok && i < count; i++) {
+        size_t len = strlen(order[i]->text);
+        ok = len <= MAX_TEXT_LEN && fwrite(order[i]->text, 1, len + 1, fp) == len + 1;
+    }
+    free(order);
+    return ok;
+}
+
+/* Single streaming pass: the file body is the text arena, nodes fill one
+ * TreeBlock in preorder, and a stack of questions still waiting for a child
+ * links each node to its parent as it is read. Takes ownership of fp. */
+static int load_preorder(FILE *fp) {
+    int32_t count = 0;
+    struct stat st;
+    if (fread(&count, sizeof(int32_t), 1, fp) != 1 || count <= 0 ||
+        fstat(fileno(fp), &st) != 0 || st.st_size < (off_t)(3 * sizeof(int32_t))) {
+        fclose(fp);
+        return 0;
+    }
+    size_t bodyLen = (size_t)st.st_size - 3 * sizeof(int32_t);
+    size_t shapeLen = ((size_t)count + 7) / 8;
+    char *body = (char *)malloc(bodyLen ? bodyLen : 1); //bits + text arena
+    if (!body || bodyLen < shapeLen || fread(body, 1, bodyLen, fp) != bodyLen) {
+        free(body);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    TreeBlock *b = tb_create(count);
+    if (!b) { free(body); return 0; }
+    tb_attach_memory(b, body, bodyLen, release_arena);
+
+    FrameStack pending; //questions whose no child is still unset (answeredYes = yes filled)
+    fs_init(&pending);
+    const unsigned char *shape = (const unsigned char *)body;
+    char *text = body + shapeLen, *end = body + bodyLen;
+    int ok = pending.frames != NULL;
+    for (int32_t i = 0; ok && i < count; i++) {
+        char *nul = memchr(text, '\0', (size_t)(end - text));
+        if (!nul || nul - text > MAX_TEXT_LEN) { ok = 0; break; }
+        Node *n = &b->nodes[i];
+        n->text = text;
+        n->isQuestion = (shape[i / 8] >> (i % 8)) & 1;
+        text = nul + 1;
+
+        if (i > 0) { //attach to the innermost waiting question
+            if (fs_empty(&pending)) { ok = 0; break; } //more nodes than the shape allows
+            Frame *top = &pending.frames[pending.size - 1];
+            if (!top->answeredYes) {
+                top->node->yes = n;
+                top->answeredYes = 1;
+            } else {
+                top->node->no = n;
+                fs_pop(&pending);
+            }
+        }
+        if (n->isQuestion) {
+            int before = pending.size;
+            fs_push(&pending, n, 0);
+            if (pending.size != before + 1) ok = 0;
+        }
+    }
+    if (!fs_empty(&pending) || text != end) ok = 0; //a question left short, or trailing bytes
+    fs_free(&pending);
+    if (!ok) {
+        tb_discard(b);
+        return 0;
+    }
+    if (!tb_count_subtrees(b, 1)) { //preorder: children follow their parents
+        tb_discard(b);
+        return 0;
+    }
+    tb_intern_texts(b); //unless skipped, the arena goes
+
+    // Replace old root
+    if (g_root) free_tree(g_root);
+    g_root = &b->nodes[0];
+    return 1;
+}
+
+typedef struct {
+    const ImageNode *table;
+    const uint64_t *hashes; /* NULL unless IMAGE_HASHES */
+    const char *pool;
+    uint64_t poolBytes;
+    int32_t count;
+    Node *nodes;
+} ImageBuild;
+
+/* Validates and builds node i of a v2 image. */
+static int build_image_node(const ImageBuild *c, int i) {
+    const ImageNode *rec = &c->table[i];
+    uint64_t len = rec->lenFlags & ~IMAGE_IS_QUESTION;
+    //text must sit inside the pool and be terminated, ids in range
+    if ((uint64_t)rec->textOffset + len >= c->poolBytes || c->pool[rec->textOffset + len] != '\0' ||
+        rec->yesId < -1 || rec->yesId >= c->count || rec->noId < -1 || rec->noId >= c->count) {
+        return 0;
+    }
+    Node *n = &c->nodes[i];
+    n->text = (char *)(c->pool + rec->textOffset); //points into the pool, never freed per node
+    n->isQuestion = (rec->lenFlags & IMAGE_IS_QUESTION) ? 1 : 0;
+    n->yes = rec->yesId >= 0 ? &c->nodes[rec->yesId] : NULL;
+    n->no  = rec->noId  >= 0 ? &c->nodes[rec->noId]  : NULL;
+    n->flags = NODE_IN_BLOCK;
+    if (c->hashes) n->hash = c->hashes[i];
+    return 1;
+}
+
+/* Validates and builds nodes [begin, end) of a v2 image. */
+static int build_image_range(void *arg, int begin, int end) {
+    const ImageBuild *c = (const ImageBuild *)arg;
+    for (int i = begin; i < end; i++) {
+        if (!build_image_node(c, i)) return 0;
+    }
+    return 1;
+}
+
+/* ---------- Progressive load and paging ----------
+ * The node table is in BFS order, so the top levels are its first records.
+ * A progressive load builds the first chunk, hands the tree over, and lets
+ * one background thread build the remaining chunks in order. With a memory
+ * budget there is no background thread: a chunk is built only when a walk
+ * reaches it, and cold chunks are dropped in clock order to stay under the
+ * budget. The nodes of a paged load are an anonymous mapping of their own
+ * (tb_reserve_pages) and their addresses never change, so dropping is just
+ * releasing the pages; node_ready() rebuilds a dropped chunk from the image the next time
+ * it is reached. Chunks whose links were edited no longer match the image
+ * and are never dropped. Parent links come from the image records too, so
+ * a rebuilt chunk gets them back without its parents being built. */
+#define PAGE_CHUNK 256    /* one page of records */
+
+enum { CHUNK_EMPTY, CHUNK_BUILDING, CHUNK_DONE };
+
+typedef struct Pager {
+    ImageBuild build;
+    void *map;              /* the image mapping, to find the pager on release */
+    unsigned char *state;   /* CHUNK_* per chunk */
+    unsigned char *ref;     /* clock bit per chunk */
+    size_t *bytes;          /* resident bytes of each built chunk */
+    int32_t *parentFrom;    /* first record known to link into each chunk, -1 if none */
+    size_t maxChunk;        /* largest chunk built */
+    int chunks;
+    int done;               /* chunks in CHUNK_DONE */
+    int bad;                /* records that failed validation */
+    size_t budget;          /* 0 = keep everything */
+    size_t resident;
+    int hand;
+    int recent[PAGE_PINNED_CHUNKS];
+    int recentAt;
+    int threaded;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+    struct Pager *next;
+} Pager;
+
+static int g_load_progressive = 0;
+static size_t g_load_budget = 0;
+static Pager *g_pagers = NULL;       //loads whose links are not all final
+static long g_page_faults = 0;
+static long g_page_evictions = 0;
+static char g_bad_text[1] = "";      //text of records that failed validation
+
+void set_load_progressive(int on) {
+    g_load_progressive = on ? 1 : 0;
+}
+
+void set_load_budget(size_t bytes) {
+    g_load_budget = bytes;
+}
+
+/* Releases whole pages inside [begin, end); partial edge pages stay. */
+static void drop_pages(const void *begin, const void *end) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)begin + page - 1) & ~(page - 1);
+    uintptr_t hi = (uintptr_t)end & ~(page - 1);
+    if (lo < hi) madvise((void *)lo, hi - lo, MADV_DONTNEED);
+}
+
+static int chunk_end(const Pager *p, int chunk) {
+    int end = (chunk + 1) * PAGE_CHUNK;
+    return end < p->build.count ? end : p->build.count;
+}
+
+/* Sets the parent links of a chunk that was just built (lock held). Its
+ * questions first note where their children's parents start, or link
+ * children whose chunk is built already. Then the records from
+ * parentFrom[chunk] on are read for this chunk's parents; in BFS order
+ * they stop once a question's children are past the chunk. Only records
+ * are read, so parents in dropped chunks stay dropped. */
+static void pager_link_parents(Pager *p, int chunk) {
+    const ImageBuild *c = &p->build;
+    int begin = chunk * PAGE_CHUNK, end = chunk_end(p, chunk);
+    for (int i = begin; i < end; i++) {
+        Node *n = &c->nodes[i];
+        Node *kids[2] = { n->yes, n->no };
+        for (int k = 0; k < 2; k++) {
+            if (!kids[k]) continue;
+            int kc = (int)(kids[k] - c->nodes) / PAGE_CHUNK;
+            if (p->parentFrom[kc] < 0 || i < p->parentFrom[kc]) p->parentFrom[kc] = i;
+            if (kc != chunk && p->state[kc] == CHUNK_DONE && !kids[k]->parent) kids[k]->parent = n;
+        }
+    }
+    for (int j = p->parentFrom[chunk]; j >= 0 && j < end; j++) {
+        const ImageNode *rec = &c->table[j];
+        if (!(rec->lenFlags & IMAGE_IS_QUESTION)) continue;
+        int32_t kids[2] = { rec->yesId, rec->noId };
+        for (int k = 0; k < 2; k++) {
+            if (kids[k] >= begin && kids[k] < end) c->nodes[kids[k]].parent = &c->nodes[j];
+        }
+        if (kids[0] >= end && kids[1] >= end) break; //later records link later chunks
+    }
+}
+
+/* Builds one chunk outside the lock. A bad record becomes an empty animal
+ * so the tree stays walkable; load_wait() reports it. */
+static void pager_build_chunk(Pager *p, int chunk) {
+    int begin = chunk * PAGE_CHUNK, end = chunk_end(p, chunk);
+    int bad = 0;
+    uint64_t textLo = UINT64_MAX, textHi = 0;
+    for (int i = begin; i < end; i++) {
+        if (build_image_node(&p->build, i)) {
+            const ImageNode *rec = &p->build.table[i];
+            uint64_t stop = (uint64_t)rec->textOffset + (rec->lenFlags & ~IMAGE_IS_QUESTION) + 1;
+            if (rec->textOffset < textLo) textLo = rec->textOffset;
+            if (stop > textHi) textHi = stop;
+            continue;
+        }
+        Node *n = &p->build.nodes[i];
+        n->text = g_bad_text;
+        n->isQuestion = 0;
+        n->yes = n->no = NULL;
+        n->flags = NODE_IN_BLOCK;
+        bad++;
+    }
+    size_t bytes = (size_t)(end - begin) * (sizeof(Node) + sizeof(ImageNode)) +
+                   (size_t)(textHi > textLo ? textHi - textLo : 0);
+    pthread_mutex_lock(&p->lock);
+    pager_link_parents(p, chunk);
+    p->state[chunk] = CHUNK_DONE;
+    p->bytes[chunk] = bytes;
+    if (bytes > p->maxChunk) p->maxChunk = bytes;
+    p->resident += bytes;
+    p->ref[chunk] = 1;
+    p->done++;
+    p->bad += bad;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Claims chunk if nobody has, else waits for whoever is building it.
+ * Called with the lock held; returns with it held. */
+static void pager_ensure(Pager *p, int chunk) {
+    while (p->state[chunk] == CHUNK_BUILDING) pthread_cond_wait(&p->changed, &p->lock);
+    if (p->state[chunk] == CHUNK_DONE) return;
+    p->state[chunk] = CHUNK_BUILDING;
+    pthread_mutex_unlock(&p->lock);
+    pager_build_chunk(p, chunk);
+    pthread_mutex_lock(&p->lock);
+}
+
+/* 1 if every link in the chunk, parents included, is still the one the
+ * image records. */
+static int chunk_is_clean(const Pager *p, int chunk) {
+    const ImageBuild *c = &p->build;
+    for (int i = chunk * PAGE_CHUNK, end = chunk_end(p, chunk); i < end; i++) {
+        const ImageNode *rec = &c->table[i];
+        const Node *n = &c->nodes[i];
+        if (n->text == g_bad_text) continue; //never built from the image
+        if (n->parent && (n->parent < c->nodes || n->parent >= c->nodes + c->count)) {
+            return 0; //under a learned question; a rebuild would lose that
+        }
+        if (n->yes != (rec->yesId >= 0 ? &c->nodes[rec->yesId] : NULL) ||
+            n->no  != (rec->noId  >= 0 ? &c->nodes[rec->noId]  : NULL)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Drops the chunk's nodes and its part of the image. Lock held. */
+static void pager_evict(Pager *p, int chunk) {
+    const ImageBuild *c = &p->build;
+    int begin = chunk * PAGE_CHUNK, end = chunk_end(p, chunk);
+    uint64_t textLo = UINT64_MAX, textHi = 0;
+    for (int i = begin; i < end; i++) { //texts of a chunk sit together in the pool
+        const ImageNode *rec = &c->table[i];
+        uint64_t stop = (uint64_t)rec->textOffset + (rec->lenFlags & ~IMAGE_IS_QUESTION) + 1;
+        if (stop > c->poolBytes) continue;
+        if (rec->textOffset < textLo) textLo = rec->textOffset;
+        if (stop > textHi) textHi = stop;
+    }
+    drop_pages(&c->nodes[begin], &c->nodes[end]);
+    drop_pages(&c->table[begin], &c->table[end]);
+    if (textHi > textLo) drop_pages(c->pool + textLo, c->pool + textHi);
+    p->state[chunk] = CHUNK_EMPTY;
+    p->resident -= p->bytes[chunk];
+    p->done--;
+    g_page_evictions++;
+}
+
+static int is_recent(const Pager *p, int chunk) {
+    for (int r = 0; r < PAGE_PINNED_CHUNKS; r++) {
+        if (p->recent[r] == chunk) return 1;
+    }
+    return 0;
+}
+
+/* Clock sweep until the pager fits its budget (or nothing can go). */
+static void pager_trim(Pager *p) {
+    for (int steps = 0; p->resident > p->budget && steps < 2 * p->chunks; steps++) {
+        int c = p->hand;
+        p->hand = (p->hand + 1) % p->chunks;
+        if (p->state[c] != CHUNK_DONE || is_recent(p, c)) continue;
+        if (p->ref[c]) { p->ref[c] = 0; continue; } //second chance
+        if (chunk_is_clean(p, c)) pager_evict(p, c);
+    }
+}
+
+static void *pager_thread(void *arg) {
+    Pager *p = (Pager *)arg;
+    pthread_mutex_lock(&p->lock);
+    for (int c = 0; c < p->chunks && !p->stop; c++) {
+        if (p->state[c] == CHUNK_EMPTY) pager_ensure(p, c);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static void pager_resolve(Node *n) {
+    Pager *p = g_pagers;
+    while (p && (n < p->build.nodes || n >= p->build.nodes + p->build.count)) p = p->next;
+    if (!p) return; //heap node, or a block whose links are final
+    int chunk = (int)(n - p->build.nodes) / PAGE_CHUNK;
+    pthread_mutex_lock(&p->lock);
+    p->recent[p->recentAt] = chunk;
+    p->recentAt = (p->recentAt + 1) % PAGE_PINNED_CHUNKS;
+    if (p->state[chunk] != CHUNK_DONE) {
+        g_page_faults++;
+        pager_ensure(p, chunk);
+        if (p->budget) pager_trim(p); //only a fault adds resident bytes
+    }
+    p->ref[chunk] = 1;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Stops the loader thread and frees the pager; the nodes stay as they are. */
+static void pager_destroy(Pager *p) {
+    if (p->threaded) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->thread, NULL);
+    }
+    for (Pager **pp = &g_pagers; *pp; pp = &(*pp)->next) {
+        if (*pp == p) {
+            *pp = p->next;
+            break;
+        }
+    }
+    if (!g_pagers) set_node_resolver(NULL); //every link is final now
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->changed);
+    free(p->state);
+    free(p->ref);
+    free(p->bytes);
+    free(p->parentFrom);
+    free(p);
+}
+
+static Pager *find_pager(const void *map) {
+    Pager *p = g_pagers;
+    while (p && p->map != map) p = p->next;
+    return p;
+}
+
+/* Release hook of a paged image: its block is going away, so its pager
+ * must stop first. */
+static void release_paged_image(void *mem, size_t len) {
+    Pager *p = find_pager(mem);
+    if (p) pager_destroy(p);
+    munmap(mem, len);
+}
+
+int load_pending(void) {
+    int pending = 0;
+    for (Pager *p = g_pagers; p; p = p->next) {
+        pthread_mutex_lock(&p->lock);
+        if (p->done < p->chunks) pending = 1;
+        pthread_mutex_unlock(&p->lock);
+    }
+    return pending;
+}
+
+/* Builds whatever is missing (past any budget) and makes every link final;
+ * the subtree counts a paged load skipped are filled in then. */
+int load_wait(void) {
+    int ok = 1, paged = g_pagers != NULL;
+    while (g_pagers) {
+        Pager *p = g_pagers;
+        if (p->threaded) { //let the loader finish what it started
+            pthread_join(p->thread, NULL);
+            p->threaded = 0;
+        }
+        for (int c = 0; c < p->chunks; c++) {
+            if (p->state[c] == CHUNK_EMPTY) pager_build_chunk(p, c);
+        }
+        if (p->bad) ok = 0;
+        pager_destroy(p);
+    }
+    if (paged) tree_recount(g_root); //nothing can be dropped any more
+    return ok;
+}
+
+void paging_stats(PagingStats *out) {
+    memset(out, 0, sizeof(*out));
+    for (Pager *p = g_pagers; p; p = p->next) {
+        pthread_mutex_lock(&p->lock);
+        out->residentBytes += p->resident;
+        if (p->maxChunk > out->maxChunkBytes) out->maxChunkBytes = p->maxChunk;
+        pthread_mutex_unlock(&p->lock);
+    }
+    out->budgetBytes = g_load_budget;
+    out->faults = g_page_faults;
+    out->evictions = g_page_evictions;
+}
+
+/* Builds the first chunk of an uncompressed image whose block and mapping
+ * are set up, then leaves the rest to a loader thread (progressive) or to
+ * node_ready() (budget). Returns 0 if the first chunk is bad. */
+static int start_pager(const ImageBuild *build, void *map) {
+    Pager *p = (Pager *)calloc(1, sizeof(Pager));
+    if (!p) return 0;
+    p->build = *build;
+    p->map = map;
+    p->chunks = (build->count + PAGE_CHUNK - 1) / PAGE_CHUNK;
+    p->state = (unsigned char *)calloc((size_t)p->chunks, 1);
+    p->ref = (unsigned char *)calloc((size_t)p->chunks, 1);
+    p->bytes = (size_t *)calloc((size_t)p->chunks, sizeof(size_t));
+    p->parentFrom = (int32_t *)malloc((size_t)p->chunks * sizeof(int32_t));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    p->next = g_pagers;
+    g_pagers = p;
+    set_node_resolver(pager_resolve);
+    if (!p->state || !p->ref || !p->bytes || !p->parentFrom) { pager_destroy(p); return 0; }
+    for (int c = 0; c < p->chunks; c++) p->parentFrom[c] = -1;
+    for (int r = 0; r < PAGE_PINNED_CHUNKS; r++) p->recent[r] = -1;
+
+    pager_build_chunk(p, 0); //the root and the first levels, before returning
+    if (p->bad) { pager_destroy(p); return 0; }
+    p->budget = g_load_budget;
+    if (!p->budget && p->chunks > 1) {
+        p->threaded = pthread_create(&p->thread, NULL, pager_thread, p) == 0;
+        if (!p->threaded) { //no thread: finish here
+            for (int c = 1; c < p->chunks; c++) pager_build_chunk(p, c);
+        }
+    }
+    if (!p->threaded && p->done == p->chunks) {
+        int ok = p->bad == 0;
+        pager_destroy(p);
+        return ok;
+    }
+    return 1;
+}
+
+/* Loads a TREE_FORMAT_V2 file: the file is mapped read-only, the node table
+ * is validated in place, and the live tree is one node array whose texts
+ * point into the mapped string pool. A compressed pool is inflated into one
+ * arena instead and the mapping is dropped once the nodes are built (then
+ * the texts are interned like a v1 load's; mapped texts are shared file
+ * pages already and stay where they are). With
+ * set_load_progressive(1) or a load budget an uncompressed image returns
+ * after its first chunk (see Progressive load and paging); a shared image
+ * is built whole so its link counts are known. Stored hashes (IMAGE_HASHES)
+ * are taken as they are. Takes ownership of fp. */
+static int load_image(FILE *fp) {
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        fclose(fp);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    fclose(fp); //the mapping outlives the descriptor
+    if (base == MAP_FAILED) return 0;
+
+    const ImageHeader *hdr = (const ImageHeader *)base;
+    int32_t count = hdr->count;
+    int compressed = (hdr->flags & IMAGE_POOL_LZ) != 0;
+    int shared = (hdr->flags & IMAGE_SHARED) != 0;
+    int hashed = (hdr->flags & IMAGE_HASHES) != 0;
+    size_t tableBytes = (size_t)(count > 0 ? count : 0) * sizeof(ImageNode);
+    size_t hashBytes = hashed ? (size_t)(count > 0 ? count : 0) * sizeof(uint64_t) : 0;
+    size_t poolAt = sizeof(ImageHeader) + tableBytes + hashBytes;
+    if (count <= 0 || (hdr->flags & ~(IMAGE_POOL_LZ | IMAGE_SHARED | IMAGE_HASHES)) != 0 ||
+        hdr->poolBytes > UINT32_MAX || tableBytes / sizeof(ImageNode) != (size_t)count || poolAt > size ||
+        (!compressed && hdr->poolBytes > size - poolAt)) {
+        munmap(base, size);
+        return 0;
+    }
+    const ImageNode *table = (const ImageNode *)((const char *)base + sizeof(ImageHeader));
+    uint64_t poolBytes = hdr->poolBytes;
+
+    int paged = (g_load_progressive || g_load_budget) && !compressed && !shared;
+    //the only allocation besides the mapping; a paged load maps it untouched
+    TreeBlock *b = paged ? tb_reserve_pages(count) : tb_create(count);
+    if (!b) { munmap(base, size); return 0; }
+    const char *pool;
+    if (compressed) {
+        char *raw = read_pool_lz((const uint8_t *)base + poolAt, size - poolAt, (size_t)poolBytes);
+        if (!raw) { tb_discard(b); munmap(base, size); return 0; }
+        tb_attach_memory(b, raw, (size_t)poolBytes, release_arena);
+        pool = raw;
+    } else {
+        tb_attach_memory(b, base, size, paged ? release_paged_image : unmap_image);
+        pool = (const char *)base + poolAt;
+    }
+
+    const uint64_t *hashes = hashed ? (const uint64_t *)(table + count) : NULL;
+    ImageBuild ctx = { table, hashes, pool, poolBytes, count, b->nodes };
+    int built = paged ? start_pager(&ctx, base)
+                      : parallel_ranges(count, build_image_range, &ctx) &&
+                        (!shared || tb_share_links(b, !hashed));
+    if (built && !shared && !find_pager(base)) built = tb_count_subtrees(b, !hashed); //a paged load counts in load_wait()
+    if (!built) {
+        tb_discard(b);
+        if (compressed) munmap(base, size);
+        return 0;
+    }
+    if (compressed) {
+        munmap(base, size); //node table no longer needed
+        tb_intern_texts(b); //the inflated pool is a private copy too
+    }
+
+    // Replace old root
+    if (g_root) free_tree(g_root);
+    g_root = &b->nodes[0];
+    return 1;
+}
+
+typedef struct {
+    char *body;
+    const size_t *offsets;
+    int32_t count;
+    Node *nodes;
+} RecordBuild;
+
+/* Parses v1 records [begin, end), whose offsets the boundary scan found. */
+static int build_record_range(void *arg, int begin, int end) {
+    const RecordBuild *c = (const RecordBuild *)arg;
+    for (int i = begin; i < end; i++) {
+        char *rec = c->body + c->offsets[i];
+        int32_t textLen, yid, nid;
+        memcpy(&textLen, rec + 1, sizeof(int32_t));
+        char *text = rec + 1 + sizeof(int32_t); //text stays where it was read
+        memcpy(&yid, text + textLen, sizeof(int32_t));
+        memcpy(&nid, text + textLen + sizeof(int32_t), sizeof(int32_t));
+        text[textLen] = '\0'; //terminator overwrites the already-read yesId
+        if (yid < -1 || yid >= c->count || nid < -1 || nid >= c->count) {
+            return 0; //id is out of range
+        }
+
+        Node *n = &c->nodes[i]; //slot in the block
+        n->isQuestion = rec[0] ? 1 : 0; //sets the type
+        n->text = text;
+        // every node already has its slot, so links resolve immediately
+        n->yes = yid >= 0 ? &c->nodes[yid] : NULL;
+        n->no  = nid >= 0 ? &c->nodes[nid] : NULL;
+    }
     return 1;
 }
 
@@ -147,29 +1416,21 @@ int save_tree(const char *filename) {
  * Steps:
  * 1. Open file for reading binary ("rb")
  * 2. Read and validate header (magic, version, count)
- * 3. Allocate arrays for nodes and child IDs:
- *    - Node **nodes = calloc(count, sizeof(Node*))
- *    - int32_t *yesIds = calloc(count, sizeof(int32_t))
- *    - int32_t *noIds = calloc(count, sizeof(int32_t))
- * 4. Read each node:
+ * 3. Read the rest of the file into one buffer (the text arena) and
+ *    allocate one TreeBlock holding all `count` nodes
+ * 4. Scan record boundaries (validate each textLen, e.g. < 10000)
+ * 5. Parse records in parallel id ranges:
  *    - Read isQuestion, textLen
- *    - Validate textLen (e.g., < 10000)
- *    - Allocate and read text string (add null terminator!)
- *    - Read yesId, noId
+ *    - Read yesId, noId, then NUL-terminate the text in place
  *    - Validate IDs are in range [-1, count)
- *    - Create Node and store in nodes[i]
- * 5. Link nodes using stored IDs:
- *    - For each node i:
- *      - If yesIds[i] >= 0: nodes[i]->yes = nodes[yesIds[i]]
- *      - If noIds[i] >= 0: nodes[i]->no = nodes[noIds[i]]
+ *    - Fill nodes[i] and link its children to their block slots
  * 6. Free old g_root if not NULL
  * 7. Set g_root = nodes[0]
- * 8. Clean up temporary arrays
- * 9. Return 1 on success
+ * 8. Return 1 on success
  * 
  * Error handling:
  * - If any read fails or validation fails, goto load_error
- * - In load_error: free all allocated memory and return 0
+ * - In load_error: discard the block (and arena) and return 0
  */
 int load_tree(const char *filename) {
     // TODO: Implement this function
@@ -179,95 +1440,198 @@ int load_tree(const char *filename) {
     if (!fp) return 0;
 
     int32_t magic = 0, version = 0, count = 0; //header fields
-    //read magic, version, count
+    //read magic, version
     if (fread(&magic, sizeof(int32_t), 1, fp) != 1 ||
         fread(&version, sizeof(int32_t), 1, fp) != 1 ||
-        fread(&count, sizeof(int32_t), 1, fp) != 1) {
+        magic != (int32_t)MAGIC) {
         fclose(fp);
         return 0;
     }
-    //if invalid header bail
-    if (magic != (int32_t)MAGIC || version != (int32_t)VERSION || count <= 0) {
+    if (version == TREE_FORMAT_V2) return load_image(fp); //mapped, no per-node parsing
+    if (version == TREE_FORMAT_PREORDER) return load_preorder(fp); //shape bits, no ids
+
+    //read count; if invalid header bail
+    if (version != (int32_t)VERSION ||
+        fread(&count, sizeof(int32_t), 1, fp) != 1 || count <= 0) {
         fclose(fp);
         return 0;
     }
 
-    Node **nodes = (Node **)calloc((size_t)count, sizeof(Node *)); //node array linked
-    int32_t *yesIds = (int32_t *)calloc((size_t)count, sizeof(int32_t)); //yes links
-    int32_t *noIds  = (int32_t *)calloc((size_t)count, sizeof(int32_t)); //no links
-    if (!nodes || !yesIds || !noIds) { //if the above fails it bails
+    // Arena load: the rest of the file is read in one go and becomes the text
+    // arena (each text is terminated in place once the ids after it have been
+    // read), and every node lives in one TreeBlock array. Three allocations in
+    // total, however many nodes, and freeing returns them as a unit. Once
+    // built, the texts are interned and the arena is freed early.
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size < (off_t)(3 * sizeof(int32_t))) {
         fclose(fp);
-        free(nodes); free(yesIds); free(noIds);
         return 0;
     }
+    size_t bodyLen = (size_t)st.st_size - 3 * sizeof(int32_t);
+    char *body = (char *)malloc(bodyLen ? bodyLen : 1); //text arena == file body
+    if (!body || fread(body, 1, bodyLen, fp) != bodyLen) {
+        free(body);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
 
+    TreeBlock *b = tb_create(count); //one array for every node
+    if (!b) { free(body); return 0; }
+    tb_attach_memory(b, body, bodyLen, release_arena);
+
+    // Boundary scan: a length-prefix walk that only finds where each record
+    // starts (and that it fits); the records themselves are parsed below.
+    size_t *offsets = (size_t *)malloc(sizeof(size_t) * (size_t)count);
+    if (!offsets) goto load_error;
+    size_t pos = 0;
     for (int i = 0; i < count; i++) { //goes through each node record
-        uint8_t isQ; //type byte
         int32_t textLen; //text length
-        if (fread(&isQ, sizeof(uint8_t), 1, fp) != 1 ||
-            fread(&textLen, sizeof(int32_t), 1, fp) != 1) {
-            goto load_error; //if header read fails
-        }
-        if (textLen < 0 || textLen > 10000) goto load_error;
+        if (bodyLen - pos < sizeof(uint8_t) + sizeof(int32_t)) goto scan_error; //truncated record
+        memcpy(&textLen, body + pos + 1, sizeof(int32_t));
+        if (textLen < 0 || textLen > MAX_TEXT_LEN) goto scan_error;
+        if (bodyLen - pos - 1 - sizeof(int32_t) < (size_t)textLen + 2 * sizeof(int32_t)) goto scan_error;
+        offsets[i] = pos;
+        pos += 1 + sizeof(int32_t) + (size_t)textLen + 2 * sizeof(int32_t);
+    }
 
-        char *text = (char *)malloc((size_t)textLen + 1); //allocates the text
-        if (!text) goto load_error;
-        if (fread(text, 1, (size_t)textLen, fp) != (size_t)textLen) {
-            free(text);
-            goto load_error; //if the body read fails
-        }
-        text[textLen] = '\0'; //add null terminator
+    RecordBuild ctx = { body, offsets, count, b->nodes };
+    int built = parallel_ranges(count, build_record_range, &ctx);
+    free(offsets);
+    if (!built) goto load_error;
+    if (!tb_count_subtrees(b, 1)) goto load_error; //BFS ids put children after parents; others are recounted
+    tb_intern_texts(b); //repeated texts share one copy and the arena goes
 
-        int32_t yid, nid; //child ids
-        if (fread(&yid, sizeof(int32_t), 1, fp) != 1 ||
-            fread(&nid, sizeof(int32_t), 1, fp) != 1) {
-            free(text);
-            goto load_error; //if the link read fails
-        }
-        if (yid < -1 || yid >= count || nid < -1 || nid >= count) {
-            free(text);
-            goto load_error; //id is out of range
-        }
+    // Replace old root
+    if (g_root) free_tree(g_root); //frees previous trees
+    g_root = &b->nodes[0]; //puts new root
+    return 1;
 
-        Node *n = (Node *)malloc(sizeof(Node)); //allocate the node
-        if (!n) { free(text); goto load_error; }
-        n->isQuestion = isQ ? 1 : 0; //sets the type
-        n->text = text;         /* text already heap-allocated */
-        n->yes = NULL; //initializes children
-        n->no  = NULL;
+scan_error:
+    free(offsets);
+load_error:
+    tb_discard(b); //releases the node array and the arena together
+    return 0;
+}
 
-        nodes[i] = n; //stores node in array and records child ids
-        yesIds[i] = yid;
-        noIds[i]  = nid;
-    }
+/* ---------- Compact tree images ----------
+ * A CompactTree is saved as an ordinary TREE_FORMAT_V2 image (BFS ids, so
+ * the bytes match save_tree for the same tree) and loaded back by copying
+ * the node table into its arrays; neither side builds Node structs. */
 
-    // Link phase
-    for (int i = 0; i < count; i++) { //resolves the child links
-        if (yesIds[i] >= 0) nodes[i]->yes = nodes[yesIds[i]];
-        if (noIds[i]  >= 0) nodes[i]->no  = nodes[noIds[i]];
+int ct_save(const CompactTree *t, const char *filename) {
+    if (t->root == CT_NONE) return 0;
+    uint32_t *order = (uint32_t *)malloc(sizeof(uint32_t) * t->count);
+    uint32_t *newId = (uint32_t *)malloc(sizeof(uint32_t) * t->count);
+    if (!order || !newId) { free(order); free(newId); return 0; }
+
+    //BFS numbering; order doubles as the queue
+    uint32_t n = 0;
+    uint64_t poolBytes = 0;
+    order[n++] = t->root;
+    newId[t->root] = 0;
+    for (uint32_t head = 0; head < n; head++) {
+        uint32_t i = order[head];
+        poolBytes += strlen(ct_text(t, i)) + 1;
+        uint32_t kids[2] = { t->yes[i], t->no[i] };
+        for (int k = 0; k < 2; k++) {
+            if (kids[k] == CT_NONE) continue;
+            newId[kids[k]] = n;
+            order[n++] = kids[k];
+        }
     }
 
-    // Replace old root
-    if (g_root) free_tree(g_root); //frees previous trees
-    g_root = nodes[0]; //puts new root
+    char *tmpName = NULL;
+    FILE *fp = poolBytes <= UINT32_MAX ? open_replacement(filename, &tmpName) : NULL;
+    if (!fp) { free(order); free(newId); return 0; }
+    ImageHeader hdr = { (int32_t)MAGIC, (int32_t)TREE_FORMAT_V2, (int32_t)n, 0u, poolBytes };
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    uint32_t offset = 0;
+    for (uint32_t k = 0; ok && k < n; k++) {
+        uint32_t i = order[k];
+        uint32_t len = (uint32_t)strlen(ct_text(t, i));
+        ImageNode rec;
+        rec.textOffset = offset;
+        rec.lenFlags = len | (ct_is_question(t, i) ? IMAGE_IS_QUESTION : 0u);
+        rec.yesId = t->yes[i] == CT_NONE ? -1 : (int32_t)newId[t->yes[i]];
+        rec.noId = t->no[i] == CT_NONE ? -1 : (int32_t)newId[t->no[i]];
+        ok = len <= MAX_TEXT_LEN && fwrite(&rec, sizeof(rec), 1, fp) == 1;
+        offset += len + 1;
+    }
+    for (uint32_t k = 0; ok && k < n; k++) {
+        const char *text = ct_text(t, order[k]);
+        size_t len = strlen(text) + 1;
+        ok = fwrite(text, 1, len, fp) == len;
+    }
+    free(order);
+    free(newId);
+    return commit_replacement(fp, tmpName, filename, ok);
+}
 
-    free(yesIds); //frees the link arrays, node ptr array, closes the file
-    free(noIds);
-    free(nodes);   /* not freeing the nodes themselves—they're the live tree */
+/* Replaces t with the tree in a v2 file (plain or compressed pool); edit
+ * history starts empty. t is untouched on failure. */
+int ct_load(CompactTree *t, const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    struct stat st;
+    ImageHeader hdr;
+    if (fstat(fileno(fp), &st) != 0 || (size_t)st.st_size < sizeof(hdr) ||
+        fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != (int32_t)MAGIC ||
+        hdr.version != TREE_FORMAT_V2 || hdr.count <= 0 ||
+        (hdr.flags & ~(IMAGE_POOL_LZ | IMAGE_HASHES)) != 0 || hdr.poolBytes == 0 ||
+        hdr.poolBytes > UINT32_MAX) {
+        fclose(fp);
+        return 0;
+    }
+    size_t rest = (size_t)st.st_size - sizeof(hdr);
+    size_t tableBytes = (size_t)hdr.count * sizeof(ImageNode);
+    size_t poolAt = tableBytes; //stored hashes are skipped, a CompactTree has none
+    if (hdr.flags & IMAGE_HASHES) poolAt += (size_t)hdr.count * sizeof(uint64_t);
+    char *body = (char *)malloc(rest ? rest : 1);
+    int ok = body && poolAt <= rest && fread(body, 1, rest, fp) == rest;
     fclose(fp);
-    return 1;
 
-load_error:
-    /* free any nodes/text successfully allocated so far */
-    for (int i = 0; i < count; i++) { //free text and nodes
-        if (nodes && nodes[i]) {
-            free(nodes[i]->text);
-            free(nodes[i]);
+    CompactTree nt;
+    ct_init(&nt);
+    char *pool = NULL;
+    if (ok) { //the pool becomes the tree's pool as is
+        if (hdr.flags & IMAGE_POOL_LZ) {
+            pool = read_pool_lz((const uint8_t *)body + poolAt, rest - poolAt, (size_t)hdr.poolBytes);
+        } else if (hdr.poolBytes <= rest - poolAt) {
+            pool = (char *)malloc((size_t)hdr.poolBytes);
+            if (pool) memcpy(pool, body + poolAt, (size_t)hdr.poolBytes);
         }
+        ok = pool && ct_reserve(&nt, (uint32_t)hdr.count);
     }
-    free(yesIds); //free arrays and close file
-    free(noIds);
-    free(nodes);
-    fclose(fp);
-    return 0;
+    const ImageNode *table = (const ImageNode *)body;
+    for (int32_t i = 0; ok && i < hdr.count; i++) {
+        const ImageNode *rec = &table[i];
+        uint64_t len = rec->lenFlags & ~IMAGE_IS_QUESTION;
+        if ((uint64_t)rec->textOffset + len >= hdr.poolBytes || pool[rec->textOffset + len] != '\0' ||
+            rec->yesId < -1 || rec->yesId >= hdr.count || rec->noId < -1 || rec->noId >= hdr.count) {
+            ok = 0;
+            break;
+        }
+        nt.textOff[i] = rec->textOffset;
+        nt.flags[i] = (rec->lenFlags & IMAGE_IS_QUESTION) ? CT_QUESTION : 0;
+        nt.yes[i] = rec->yesId < 0 ? CT_NONE : (uint32_t)rec->yesId;
+        nt.no[i] = rec->noId < 0 ? CT_NONE : (uint32_t)rec->noId;
+    }
+    free(body);
+    if (ok) {
+        nt.count = (uint32_t)hdr.count;
+        nt.root = 0;
+        nt.pool = pool;
+        nt.poolLen = nt.poolCap = (size_t)hdr.poolBytes;
+        pool = NULL;
+        ok = ct_check_integrity(&nt); //ids could still form cycles or shared subtrees
+    }
+    free(pool);
+    if (!ok) {
+        ct_free(&nt);
+        return 0;
+    }
+    ct_free(t);
+    *t = nt;
+    return 1;
 }
@@ -20,4 +20,4 @@ EditStack g_undo = {NULL, 0, 0};
 EditStack g_redo = {NULL, 0, 0};
 
 /* Global attribute index */
-Hash g_index = {NULL, 0, 0};
+Hash g_index = { .maxLoad = H_DEFAULT_LOAD };
@@ -1,7 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "lab5.h"
 
 /* Test Frame Stack */
@@ -119,6 +123,256 @@ void test_hash() {
     printf("  ✓ Hash table tests passed\n");
 }
 
+/* Test growth: lookups and removals across an incremental resize, the
+ * load factor, and stats */
+void test_hash_resize() {
+    printf("Testing Hash Resize...\n");
+    
+    Hash h;
+    h_init(&h, 7);
+    char key[32];
+    int sawResize = 0;
+    for (int i = 0; i < 5000; i++) {
+        sprintf(key, "key%d", i);
+        assert(h_put(&h, key, i));
+        if (h.old) { //every key so far, from whichever table holds it
+            sawResize = 1;
+            for (int j = 0; j <= i; j += 97) {
+                sprintf(key, "key%d", j);
+                assert(h_contains(&h, key, j));
+            }
+        }
+    }
+    assert(sawResize && h.size == 5000 && h.nbuckets >= 5000);
+    
+    HashStats st;
+    h_stats(&h, &st);
+    assert(st.entries == 5000 && st.loadFactor <= H_DEFAULT_LOAD);
+    long probes = 0;
+    for (int i = 0; i < H_PROBE_HIST; i++) probes += st.probes[i];
+    assert(probes == 5000 && st.maxChain < 12);
+    assert(st.probes[0] == st.buckets - st.emptyBuckets); //one key per non-empty chain is found first
+    
+    /* Removals mid-resize, second ids, and nothing lost */
+    for (int i = 0; i < 5000; i += 2) {
+        sprintf(key, "key%d", i);
+        assert(h_remove(&h, key, i));
+        assert(!h_remove(&h, key, i));
+    }
+    for (int i = 1; i < 5000; i += 2) {
+        sprintf(key, "key%d", i);
+        assert(h_put(&h, key, -i) && !h_contains(&h, "key0", 0));
+    }
+    for (int i = 0; i < 5000; i++) {
+        sprintf(key, "key%d", i);
+        int count;
+        int *ids = h_get_ids(&h, key, &count);
+        assert(i % 2 ? count == 2 && (ids[0] == i || ids[1] == i) : ids == NULL);
+    }
+    assert(h.size == 2500);
+    h_free(&h);
+    
+    /* maxLoad 0 keeps the buckets it was given */
+    h_init(&h, 7);
+    h_set_max_load(&h, 0);
+    for (int i = 0; i < 100; i++) {
+        sprintf(key, "key%d", i);
+        h_put(&h, key, i);
+    }
+    h_stats(&h, &st);
+    assert(h.nbuckets == 7 && !h.old && st.maxChain >= 15 && st.loadFactor > 14);
+    h_free(&h);
+    printf("  ✓ Hash resize tests passed\n");
+}
+
+/* 1 if both tables hold key with the same ids, in any order */
+static int same_ids(const Hash *a, const Hash *b, const char *key) {
+    int ca, cb;
+    int *ia = h_get_ids(a, key, &ca), *ib = h_get_ids(b, key, &cb);
+    if (ca != cb || (ia == NULL) != (ib == NULL)) return 0;
+    for (int i = 0; i < ca; i++) {
+        if (!h_contains(b, key, ia[i])) return 0;
+    }
+    return 1;
+}
+
+/* Test the open-addressing backend against the chained one: random puts
+ * and removals, ids past the inline ones, tombstones and growth */
+void test_hash_open() {
+    printf("Testing Open Hash...\n");
+    
+    Hash open, chained;
+    h_init_as(&open, 7, HASH_OPEN);
+    h_init(&chained, 7);
+    assert(open.open.capacity == H_GROUP && !open.buckets);
+    char key[32];
+    unsigned r = 12345;
+    for (int op = 0; op < 60000; op++) {
+        r = r * 1103515245u + 12345u;
+        int k = (int)((r >> 8) % 3000), id = (int)((r >> 20) % 6);
+        sprintf(key, "key%d", k);
+        if ((r >> 4) % 3 == 0) assert(h_remove(&open, key, id) == h_remove(&chained, key, id));
+        else assert(h_put(&open, key, id) == h_put(&chained, key, id));
+        assert(open.size == chained.size);
+        if (op % 50 == 0) assert(same_ids(&open, &chained, key));
+    }
+    for (int k = 0; k < 3000; k++) {
+        sprintf(key, "key%d", k);
+        assert(same_ids(&open, &chained, key));
+    }
+    
+    HashStats st;
+    h_stats(&open, &st);
+    long probes = 0;
+    for (int i = 0; i < H_PROBE_HIST; i++) probes += st.probes[i];
+    assert(st.entries == open.size && probes == open.size);
+    assert(st.loadFactor <= 7.0 / 8 && st.maxChain >= 1);
+    
+    /* Empty it, then reuse: tombstones and dead keys are dropped by rehashes */
+    for (int k = 0; k < 3000; k++) {
+        sprintf(key, "key%d", k);
+        for (int id = 0; id < 6; id++) h_remove(&open, key, id);
+    }
+    assert(open.size == 0 && !h_get_ids(&open, "key1", NULL));
+    int capacity = open.open.capacity;
+    for (int round = 0; round < 20; round++) {
+        for (int k = 0; k < 1000; k++) {
+            sprintf(key, "round%d_%d", round, k);
+            assert(h_put(&open, key, k));
+        }
+        for (int k = 0; k < 1000; k++) {
+            sprintf(key, "round%d_%d", round, k);
+            assert(h_remove(&open, key, k));
+        }
+    }
+    assert(open.size == 0 && open.open.capacity == capacity);
+    assert(open.open.arenaLen < 64 * 1024);
+    
+    h_free(&open);
+    h_free(&chained);
+    printf("  ✓ Open hash tests passed\n");
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Test h_hash64 over synthetic keys sharing long prefixes: no collisions,
+ * balanced bits, masked buckets as even as chance, and HASH_WIDE tables */
+void test_hash64() {
+    printf("Testing Hash64...\n");
+    
+    enum { KEYS = 200000, BUCKETS = 1 << 16 };
+    uint64_t *all = malloc(sizeof(uint64_t) * KEYS);
+    int *load = calloc(BUCKETS, sizeof(int));
+    long bits[64] = { 0 };
+    char key[64];
+    for (int i = 0; i < KEYS; i++) { //short, mid-length and past 16 bytes
+        if (i % 4 == 0) sprintf(key, "k%d", i);
+        else if (i % 4 == 1) sprintf(key, "does_it_%d", i);
+        else if (i % 4 == 2) sprintf(key, "does_it_have_trait_%d", i);
+        else sprintf(key, "does_it_live_in_water_and_have_%d_legs", i);
+        uint64_t x = h_hash64(key);
+        all[i] = x;
+        load[(unsigned)(x ^ (x >> 32)) & (BUCKETS - 1)]++;
+        for (int b = 0; b < 64; b++) bits[b] += (x >> b) & 1;
+    }
+    qsort(all, KEYS, sizeof(uint64_t), cmp_u64);
+    for (int i = 1; i < KEYS; i++) assert(all[i] != all[i - 1]);
+    for (int b = 0; b < 64; b++) assert(bits[b] > KEYS * 49L / 100 && bits[b] < KEYS * 51L / 100);
+    
+    /* Chi-square over the buckets: BUCKETS give or take six standard deviations */
+    double expect = (double)KEYS / BUCKETS, chi2 = 0;
+    for (int i = 0; i < BUCKETS; i++) chi2 += (load[i] - expect) * (load[i] - expect) / expect;
+    assert((chi2 - BUCKETS) * (chi2 - BUCKETS) < 36.0 * 2 * BUCKETS);
+    
+    /* One flipped bit at the end of a long key changes about half the hash */
+    long flipped = 0;
+    for (int i = 0; i < 1000; i++) {
+        sprintf(key, "does_it_have_trait_number_%06d", i);
+        uint64_t a = h_hash64(key);
+        key[strlen(key) - 1] ^= 1;
+        for (uint64_t d = a ^ h_hash64(key); d; d &= d - 1) flipped++;
+    }
+    assert(flipped > 30 * 1000 && flipped < 34 * 1000);
+    assert(h_hash64("") != h_hash64("a") && h_hash64("ab") != h_hash64("ba"));
+    free(all);
+    free(load);
+    
+    /* Both backends with HASH_WIDE: powers of two, growth, lookups */
+    for (int open = 0; open <= 1; open++) {
+        Hash h;
+        h_init_as(&h, 20, HASH_WIDE | (open ? HASH_OPEN : 0));
+        assert(open || h.nbuckets == 32);
+        for (int i = 0; i < 5000; i++) {
+            sprintf(key, "does_it_have_trait_%d", i);
+            assert(h_put(&h, key, i));
+        }
+        for (int i = 0; i < 5000; i += 7) {
+            sprintf(key, "does_it_have_trait_%d", i);
+            assert(h_contains(&h, key, i) && !h_contains(&h, key, i + 1));
+        }
+        HashStats st;
+        h_stats(&h, &st);
+        assert(st.entries == 5000 && st.maxChain < 12);
+        assert(open || (h.nbuckets & (h.nbuckets - 1)) == 0);
+        h_free(&h);
+    }
+    printf("  ✓ Hash64 tests passed\n");
+}
+
+/* Test the h_*_text calls: the same keys as canonicalize() would give, in
+ * both directions, for every backend and every length the hashes split on */
+void test_hash_text() {
+    printf("Testing Hash Text Keys...\n");
+    
+    char texts[14][400];
+    strcpy(texts[0], "Does it meow?");
+    strcpy(texts[1], "  Is It BIG??  ");
+    strcpy(texts[2], "?!");                                 /* canonical form is empty */
+    strcpy(texts[3], "A, B;C.");                            /* canonical: 4 bytes */
+    strcpy(texts[4], "Does it have 16x?");                  /* 16 */
+    strcpy(texts[5], "Does it have, 17xy?");                /* 17 */
+    strcpy(texts[6], "Does it live in water at nightly?");  /* 32 */
+    strcpy(texts[7], "Does it live in water, at nightlyx"); /* 33 */
+    strcpy(texts[8], "Does it live in the water at night?");
+    strcpy(texts[9], "x");
+    memset(texts[10], 'Q', 300);                            /* past the stack buffer */
+    texts[10][300] = '\0';
+    strcpy(texts[11], "Does\tit\nbark?");
+    strcpy(texts[12], "\xC3\x89l\xC3\xA9phant d'Afrique?");
+    for (int i = 0; i < 150; i++) memcpy(texts[13] + 2 * i, "\xD0\x96", 2); /* Ж: 300 canonical bytes */
+    texts[13][300] = '\0';
+    
+    const int kinds[] = { HASH_CHAINED, HASH_WIDE, HASH_OPEN, HASH_OPEN | HASH_WIDE };
+    for (int k = 0; k < 4; k++) {
+        Hash h;
+        h_init_as(&h, 8, kinds[k]);
+        for (int i = 0; i < 14; i++) {
+            char *canon = canonicalize(texts[i]);
+            int count;
+            assert(h_put_text(&h, texts[i], i));
+            assert(h_contains(&h, canon, i) && h_contains_text(&h, texts[i], i));
+            assert(h_put(&h, canon, 100 + i) && !h_put_text(&h, texts[i], 100 + i));
+            int *ids = h_get_ids_text(&h, texts[i], &count);
+            assert(ids && count == 2);
+            free(canon);
+        }
+        /* "Does it have 16x?" and "does_it_have_16x" name the same key */
+        assert(h_contains_text(&h, "DOES IT HAVE 16X", 4) && !h_contains_text(&h, "Does it have 16", 4));
+        assert(h_contains_text(&h, "DOES IT MEOW!!", 0) && !h_contains_text(&h, "Does it meow too", 0));
+        assert(h.size == 14);
+        for (int i = 0; i < 14; i++) {
+            assert(h_remove_text(&h, texts[i], i) && !h_remove_text(&h, texts[i], i));
+            assert(h_remove_text(&h, texts[i], 100 + i));
+        }
+        assert(h.size == 0 && !h_get_ids_text(&h, texts[0], NULL));
+        h_free(&h);
+    }
+    printf("  ✓ Hash text key tests passed\n");
+}
+
 /* Test Persistence */
 void test_persistence() {
     printf("Testing Persistence...\n");
@@ -173,6 +427,594 @@ void test_persistence() {
     printf("  ✓ Persistence tests passed\n");
 }
 
+/* Writes a v1 file by hand: texts[i] with child ids yes[i]/no[i] (-1 none) */
+static void write_v1_file(const char *name, int count, const char **texts, const int32_t *yes, const int32_t *no) {
+    FILE *fp = fopen(name, "wb");
+    int32_t header[3] = { 0x41544C35, TREE_FORMAT_V1, count };   /* "ATL5" */
+    fwrite(header, sizeof(int32_t), 3, fp);
+    for (int i = 0; i < count; i++) {
+        uint8_t isQ = yes[i] >= 0;
+        int32_t len = (int32_t)strlen(texts[i]);
+        fwrite(&isQ, 1, 1, fp);
+        fwrite(&len, sizeof(len), 1, fp);
+        fwrite(texts[i], 1, (size_t)len, fp);
+        fwrite(&yes[i], sizeof(int32_t), 1, fp);
+        fwrite(&no[i], sizeof(int32_t), 1, fp);
+    }
+    fclose(fp);
+}
+
+/* Test both on-disk layouts and mixing heap nodes into a loaded tree */
+void test_persistence_formats() {
+    printf("Testing Persistence Formats...\n");
+    
+    Node *saved_root = g_root;
+    g_root = create_question_node("Does it fly?");
+    g_root->yes = create_animal_node("Bird");
+    g_root->no = create_animal_node("Cow");
+    
+    /* Legacy layout still round-trips */
+    assert(save_tree_as("test.dat", TREE_FORMAT_V1));
+    assert(save_tree_as("test2.dat", TREE_FORMAT_V2));
+    free_tree(g_root);
+    g_root = NULL;
+    
+    assert(load_tree("test.dat"));
+    assert(strcmp(g_root->no->text, "Cow") == 0);
+    assert(g_root->flags & NODE_IN_BLOCK);   /* arena-loaded */
+    assert(g_root->yes->flags & NODE_IN_BLOCK);
+    
+    /* Mapped layout: nodes live in one block */
+    assert(load_tree("test2.dat"));
+    assert(g_root->flags & NODE_IN_BLOCK);
+    assert(strcmp(g_root->text, "Does it fly?") == 0);
+    assert(strcmp(g_root->yes->text, "Bird") == 0);
+    assert(!g_root->yes->isQuestion);
+    
+    /* Learning grafts heap nodes under block nodes */
+    Node *cow = g_root->no;
+    Node *q = create_question_node("Does it bark?");
+    q->yes = create_animal_node("Dog");
+    q->no = cow;
+    g_root->no = q;
+    assert(check_integrity());
+    
+    /* Saving over the file that is currently mapped */
+    assert(save_tree("test2.dat"));
+    assert(load_tree("test2.dat"));
+    assert(count_nodes(g_root) == 5);
+    assert(strcmp(g_root->no->yes->text, "Dog") == 0);
+    
+    /* A v1 file need not number children after their parents */
+    const char *texts[5] = { "Does it fly?", "Cow", "Dog", "Does it bark?", "Bird" };
+    int32_t yes[5] = { 3, -1, -1, 2, -1 }, no[5] = { 4, -1, -1, 1, -1 };
+    write_v1_file("test.dat", 5, texts, yes, no);
+    assert(load_tree("test.dat"));
+    assert(subtree_nodes(g_root) == 5 && subtree_leaves(g_root) == 3 && count_nodes(g_root) == 5);
+    assert(g_root->yes->yes->parent == g_root->yes && g_root->yes->parent == g_root);
+    assert(strcmp(g_root->yes->no->text, "Cow") == 0 && check_integrity());
+    
+    /* Links that are not a tree are refused: a node linked twice, the root linked */
+    Node *kept = g_root;
+    no[3] = 2;
+    write_v1_file("test.dat", 5, texts, yes, no);
+    assert(!load_tree("test.dat") && g_root == kept);
+    no[3] = 0;
+    write_v1_file("test.dat", 5, texts, yes, no);
+    assert(!load_tree("test.dat") && g_root == kept);
+    
+    free_tree(g_root);
+    g_root = saved_root;
+    remove("test.dat");
+    remove("test2.dat");
+    
+    printf("  ✓ Persistence format tests passed\n");
+}
+
+/* Builds a complete question tree with 2^levels - 1 nodes (no recursion) */
+static Node *build_complete_tree(int levels) {
+    int total = (1 << levels) - 1;
+    Node **all = malloc(sizeof(Node *) * (size_t)total);
+    char text[64];
+    for (int i = total - 1; i >= 0; i--) {   /* children before parents */
+        int isLeaf = 2 * i + 1 >= total;
+        snprintf(text, sizeof(text), isLeaf ? "Animal %d" : "Question %d?", i);
+        all[i] = isLeaf ? create_animal_node(text) : create_question_node(text);
+        if (!isLeaf) {
+            all[i]->yes = all[2 * i + 1];
+            all[i]->no = all[2 * i + 2];
+        }
+    }
+    Node *root = all[0];
+    free(all);
+    return root;
+}
+
+/* 1 if both trees have the same shape and texts (iterative) */
+static int same_tree(Node *a, Node *b) {
+    FrameStack s;
+    fs_init(&s);
+    fs_push(&s, a, -1);
+    fs_push(&s, b, -1);
+    int same = 1;
+    while (same && !fs_empty(&s)) {
+        Node *y = fs_pop(&s).node;
+        Node *x = fs_pop(&s).node;
+        if (!x || !y) { same = (x == y); continue; }
+        if (x->isQuestion != y->isQuestion || strcmp(x->text, y->text) != 0) { same = 0; break; }
+        fs_push(&s, x->yes, -1); fs_push(&s, y->yes, -1);
+        fs_push(&s, x->no, -1);  fs_push(&s, y->no, -1);
+    }
+    fs_free(&s);
+    return same;
+}
+
+/* Test loading big trees with several worker threads */
+void test_parallel_load() {
+    printf("Testing Parallel Load...\n");
+    
+    Node *saved = g_root;
+    Node *orig = build_complete_tree(18);   /* 262143 nodes */
+    g_root = orig;
+    assert(save_tree_as("test.dat", TREE_FORMAT_V1));
+    assert(save_tree_as("test2.dat", TREE_FORMAT_V2));
+    g_root = NULL;
+    
+    set_load_threads(4);
+    assert(load_tree("test.dat"));
+    assert(same_tree(g_root, orig));
+    assert(load_tree("test2.dat"));
+    assert(same_tree(g_root, orig));
+    set_load_threads(0);
+    
+    free_tree(g_root);
+    free_tree(orig);
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    
+    printf("  ✓ Parallel load tests passed\n");
+}
+
+/* Test progressive load: the top is usable at once, the rest fills in */
+void test_progressive_load() {
+    printf("Testing Progressive Load...\n");
+    
+    Node *saved = g_root;
+    Node *orig = build_complete_tree(16);   /* 65535 nodes, many chunks */
+    g_root = orig;
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2));
+    g_root = NULL;
+    set_load_progressive(1);
+    
+    /* Walking straight to the deepest leaf only needs the chunks on the path */
+    assert(load_tree("test.dat"));
+    assert(strcmp(g_root->text, orig->text) == 0);
+    Node *cur = g_root, *want = orig;
+    while (cur->isQuestion) {
+        cur = node_child(cur, 0);
+        want = want->no;
+        assert(strcmp(cur->text, want->text) == 0);
+    }
+    assert(count_nodes(g_root) == 65535);
+    assert(check_integrity());
+    assert(load_wait());
+    assert(!load_pending());
+    assert(same_tree(g_root, orig));
+    
+    /* Freeing or replacing a tree mid-load is safe */
+    assert(load_tree("test.dat"));
+    free_tree(g_root);
+    g_root = NULL;
+    assert(load_wait());
+    assert(load_tree("test.dat"));
+    assert(load_tree("test.dat"));
+    
+    /* A bad record deep in the file only shows up when the load finishes */
+    FILE *fp = fopen("test.dat", "r+b");
+    int32_t badId = 1 << 20;
+    fseek(fp, 24 + 16L * 65534 + 8, SEEK_SET);   /* last record's yesId */
+    fwrite(&badId, sizeof(badId), 1, fp);
+    fclose(fp);
+    assert(load_tree("test.dat"));
+    assert(!load_wait());
+    
+    set_load_progressive(0);
+    free_tree(g_root);
+    free_tree(orig);
+    g_root = saved;
+    remove("test.dat");
+    
+    printf("  ✓ Progressive load tests passed\n");
+}
+
+/* Test paging under a memory budget: cold chunks go, edits stay */
+void test_paging() {
+    printf("Testing Paging...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    Node *orig = build_complete_tree(16);   /* about 4.5 MB once loaded */
+    g_root = orig;
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2));
+    g_root = NULL;
+    set_load_budget(1 << 20);
+    
+    assert(load_tree("test.dat"));
+    assert(count_nodes(g_root) == 65535);
+    assert(check_integrity());
+    PagingStats st;
+    paging_stats(&st);
+    assert(st.faults > 0 && st.evictions > 0);
+    assert(st.maxChunkBytes > 0 && st.maxChunkBytes < 64u << 10);
+    assert(st.residentBytes <= st.budgetBytes + PAGE_PINNED_CHUNKS * st.maxChunkBytes);
+    
+    /* Parent links come back when a dropped chunk is rebuilt */
+    Node *path[17];
+    int depth = 0;
+    path[0] = g_root;
+    while (node_ready(path[depth])->isQuestion) {   /* even the root's page may have gone */
+        path[depth + 1] = node_child(path[depth], 0);
+        depth++;
+    }
+    long evicted = st.evictions;
+    assert(count_nodes(g_root) == 65535);   /* walks everything, drops the deep chunks */
+    paging_stats(&st);
+    assert(st.evictions > evicted);
+    for (int d = depth; d > 0; d--) {
+        assert(node_ready(path[d])->parent == path[d - 1]);
+    }
+    
+    /* An edit under a deep leaf survives its chunk being paged back and forth */
+    Node *parent = path[depth - 1], *leaf = path[depth];
+    assert(apply_insert_split(parent, 0, leaf, "Does it purr?", "Cat", 1));
+    assert(count_nodes(g_root) == 65537);
+    Node *cur = g_root;
+    while (node_ready(cur)->isQuestion && strcmp(cur->text, "Does it purr?") != 0) cur = node_child(cur, 0);
+    assert(strcmp(node_child(cur, 1)->text, "Cat") == 0);
+    assert(count_nodes(g_root) == 65537);
+    assert(leaf->parent == cur);   /* its chunk was kept, not rebuilt from the image */
+    
+    assert(undo_last_edit());
+    assert(count_nodes(g_root) == 65535);
+    assert(node_ready(leaf)->parent == parent);
+    assert(load_wait());   /* everything resident again, links final */
+    assert(same_tree(g_root, orig));
+    
+    set_load_budget(0);
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(g_root);
+    free_tree(orig);
+    g_root = saved;
+    remove("test.dat");
+    
+    printf("  ✓ Paging tests passed\n");
+}
+
+/* 1 if the two files hold the same bytes */
+static int same_file(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int same = fa && fb;
+    while (same) {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        if (ca != cb) same = 0;
+        if (ca == EOF || cb == EOF) break;
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return same;
+}
+
+/* Test that the threaded save writes exactly what the streaming save does */
+void test_parallel_save() {
+    printf("Testing Parallel Save...\n");
+    
+    Node *saved = g_root;
+    g_root = build_complete_tree(16);   /* big enough for 4 save threads */
+    /* lopsided: grow one long chain so subtrees differ in depth */
+    Node *parent = g_root;
+    while (parent->no->isQuestion) parent = parent->no;
+    for (int i = 0; i < 40; i++) {
+        Node *q = create_question_node("Chain?");
+        q->yes = create_animal_node("Chain animal");
+        q->no = parent->no;
+        parent->no = q;
+        parent = q;
+    }
+    tree_recount(g_root);   /* the thread count follows the cached size */
+    
+    for (int v = TREE_FORMAT_V1; v <= TREE_FORMAT_V2; v++) {
+        set_save_threads(1);
+        assert(save_tree_as("test.dat", v));
+        set_save_threads(4);
+        assert(save_tree_as("test2.dat", v));
+        assert(same_file("test.dat", "test2.dat"));
+    }
+    
+    /* A small tree is written by the streaming writer whatever the setting */
+    free_tree(g_root);
+    g_root = build_complete_tree(8);
+    tree_recount(g_root);
+    set_save_threads(1);
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2));
+    set_save_threads(8);
+    assert(save_tree_as("test2.dat", TREE_FORMAT_V2));
+    assert(same_file("test.dat", "test2.dat"));
+    set_save_threads(0);
+    
+    free_tree(g_root);
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    
+    printf("  ✓ Parallel save tests passed\n");
+}
+
+/* Test the LZ block codec and compressed string pools */
+void test_compression() {
+    printf("Testing Compression...\n");
+    
+    /* Repetitive text compresses and round-trips */
+    char src[4096];
+    size_t n = 0;
+    while (n + 32 < sizeof(src)) {
+        n += (size_t)sprintf(src + n, "Does it have trait %zu?", n % 97) + 1;
+    }
+    uint8_t *comp = malloc(lz_bound(n));
+    char out[4096];
+    size_t clen = lz_compress((const uint8_t *)src, n, comp, lz_bound(n));
+    assert(clen > 0 && clen < n / 2);
+    assert(lz_decompress(comp, clen, (uint8_t *)out, n));
+    assert(memcmp(src, out, n) == 0);
+    
+    /* Truncated input and wrong sizes are rejected, not overrun */
+    assert(!lz_decompress(comp, clen - 1, (uint8_t *)out, n));
+    assert(!lz_decompress(comp, clen, (uint8_t *)out, n - 1));
+    free(comp);
+    
+    /* Compressed pool round-trips through save/load */
+    Node *saved = g_root;
+    g_root = create_question_node("Does it have stripes?");
+    g_root->yes = create_animal_node("Zebra");
+    g_root->no = create_animal_node("Horse");
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2 | TREE_POOL_COMPRESSED));
+    assert(!save_tree_as("test2.dat", TREE_FORMAT_V1 | TREE_POOL_COMPRESSED));
+    free_tree(g_root);
+    g_root = NULL;
+    assert(load_tree("test.dat"));
+    assert(strcmp(g_root->text, "Does it have stripes?") == 0);
+    assert(strcmp(g_root->no->text, "Horse") == 0);
+    assert(check_integrity());
+    
+    free_tree(g_root);
+    g_root = saved;
+    remove("test.dat");
+    
+    printf("  ✓ Compression tests passed\n");
+}
+
+/* Test the preorder format: same tree back, no child ids on disk */
+void test_preorder_format() {
+    printf("Testing Preorder Format...\n");
+    
+    Node *saved = g_root;
+    g_root = build_complete_tree(10);
+    Node *q = create_question_node("Does it bark?");   /* lopsided branch */
+    q->yes = create_animal_node("Dog");
+    q->no = g_root->no->no;
+    g_root->no->no = q;
+    int count = count_nodes(g_root);
+    
+    assert(save_tree_as("test.dat", TREE_FORMAT_PREORDER));
+    assert(save_tree_as("test2.dat", TREE_FORMAT_V1));
+    struct stat a, b;
+    assert(stat("test.dat", &a) == 0 && stat("test2.dat", &b) == 0);
+    assert(b.st_size - a.st_size >= 8L * count);   /* ids were most of the overhead */
+    
+    Node *orig = g_root;
+    g_root = NULL;
+    assert(load_tree("test.dat"));
+    assert(g_root->flags & NODE_IN_BLOCK);
+    assert(same_tree(orig, g_root));
+    assert(check_integrity());
+    free_tree(g_root);
+    
+    /* Truncated files are rejected and leave the tree alone */
+    g_root = orig;
+    assert(truncate("test.dat", a.st_size - 1) == 0);
+    assert(!load_tree("test.dat"));
+    assert(g_root == orig);
+    
+    /* A question missing a child has no preorder encoding */
+    Node *dog = q->yes;
+    q->yes = NULL;
+    assert(!save_tree_as("test.dat", TREE_FORMAT_PREORDER));
+    q->yes = dog;
+    
+    free_tree(g_root);
+    g_root = saved;
+    remove("test.dat");
+    remove("test2.dat");
+    
+    printf("  ✓ Preorder format tests passed\n");
+}
+
+/* Test the compact (index) tree: learning, undo/redo, integrity, save/load */
+void test_compact_tree() {
+    printf("Testing Compact Tree...\n");
+    
+    CompactTree t;
+    ct_init(&t);
+    uint32_t root = ct_add(&t, "Does it live in water?", 1);
+    uint32_t fish = ct_add(&t, "Fish", 0);
+    uint32_t dog = ct_add(&t, "Dog", 0);
+    t.yes[root] = fish;
+    t.no[root] = dog;
+    assert(ct_check_integrity(&t) && ct_count_reachable(&t) == 3);
+    
+    /* Learning splits a leaf; undo/redo only relink */
+    uint32_t q = ct_insert_split(&t, root, 0, dog, "Does it meow?", "Cat", 1);
+    assert(q != CT_NONE && ct_child(&t, root, 0) == q);
+    assert(strcmp(ct_text(&t, ct_child(&t, q, 1)), "Cat") == 0);
+    assert(ct_child(&t, q, 0) == dog);
+    assert(ct_count_reachable(&t) == 5 && ct_check_integrity(&t));
+    assert(ct_undo(&t) && ct_child(&t, root, 0) == dog && ct_count_reachable(&t) == 3);
+    assert(ct_redo(&t) && ct_child(&t, root, 0) == q);
+    assert(!ct_redo(&t));
+    
+    /* Learning after an undo reuses the undone nodes' ids */
+    assert(ct_undo(&t));
+    uint32_t q2 = ct_insert_split(&t, root, 1, fish, "Does it have scales?", "Whale", 0);
+    assert(q2 == q && t.count == 5 && ct_child(&t, root, 1) == q2);
+    assert(strcmp(ct_text(&t, ct_child(&t, q2, 0)), "Whale") == 0);
+    assert(ct_check_integrity(&t));
+    
+    /* Bad splits change nothing: empty texts, a question, a leaf not in that slot */
+    size_t poolLen = t.poolLen;
+    assert(ct_insert_split(&t, root, 0, dog, NULL, "Cat", 1) == CT_NONE);
+    assert(ct_insert_split(&t, root, 0, dog, "Does it meow?", "", 1) == CT_NONE);
+    assert(ct_insert_split(&t, CT_NONE, -1, root, "Is it alive?", "Rock", 0) == CT_NONE);
+    assert(ct_insert_split(&t, root, 1, dog, "Does it meow?", "Cat", 1) == CT_NONE);
+    assert(t.count == 5 && t.poolLen == poolLen && t.undoCount == 1);
+    assert(ct_check_integrity(&t) && ct_count_reachable(&t) == 5);
+    
+    /* Saves the same bytes as save_tree, and loads back */
+    Node *saved = g_root;
+    g_root = create_question_node("Does it live in water?");
+    g_root->yes = create_question_node("Does it have scales?");
+    g_root->yes->yes = create_animal_node("Fish");
+    g_root->yes->no = create_animal_node("Whale");
+    g_root->no = create_animal_node("Dog");
+    assert(save_tree("test.dat"));
+    assert(ct_save(&t, "test2.dat"));
+    assert(same_file("test.dat", "test2.dat"));
+    
+    CompactTree u;
+    ct_init(&u);
+    assert(ct_load(&u, "test2.dat"));
+    assert(u.count == 5 && ct_check_integrity(&u));
+    assert(strcmp(ct_text(&u, ct_child(&u, ct_child(&u, u.root, 1), 0)), "Whale") == 0);
+    
+    /* Node trees convert in the order save_tree numbers them */
+    Node *big = build_complete_tree(12);
+    assert(ct_from_tree(&u, big));
+    assert(u.count == 4095 && ct_check_integrity(&u));
+    assert(strcmp(ct_text(&u, 4094), "Animal 4094") == 0);
+    
+    /* A shared subtree is not a tree */
+    u.no[u.root] = u.yes[u.root];
+    assert(!ct_check_integrity(&u));
+    
+    free_tree(big);
+    free_tree(g_root);
+    g_root = saved;
+    ct_free(&t);
+    ct_free(&u);
+    remove("test.dat");
+    remove("test2.dat");
+    
+    printf("  ✓ Compact tree tests passed\n");
+}
+
+/* Test the edit journal: edits survive a reopen without a full save */
+void test_journal() {
+    printf("Testing Edit Journal...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    remove("test.dat");
+    remove("test.dat.journal");
+    
+    g_root = create_question_node("Does it live in water?");
+    g_root->yes = create_animal_node("Fish");
+    g_root->no = create_animal_node("Dog");
+    assert(journal_open("test.dat"));   /* first run writes the snapshot */
+    
+    assert(apply_insert_split(g_root, 0, g_root->no, "Does it meow?", "Cat", 1));
+    assert(apply_insert_split(g_root, 1, g_root->yes, "Is it a mammal?", "Whale", 1));
+    assert(undo_last_edit());
+    assert(redo_last_edit());
+    assert(undo_last_edit());
+    assert(count_nodes(g_root) == 5);
+    
+    /* Reopen: snapshot + replayed journal, with the same undo/redo state */
+    assert(journal_open("test.dat"));
+    assert(count_nodes(g_root) == 5);
+    assert(strcmp(g_root->no->text, "Does it meow?") == 0);
+    assert(strcmp(g_root->no->yes->text, "Cat") == 0);
+    assert(g_undo.size == 1 && g_redo.size == 1);
+    assert(subtree_nodes(g_root) == 5 && subtree_leaves(g_root) == 3);
+    assert(redo_last_edit());
+    assert(subtree_nodes(g_root) == 7);
+    assert(strcmp(g_root->yes->yes->text, "Whale") == 0);
+    
+    /* Compaction folds the journal into the snapshot; undoing an edit that
+     * is now part of the snapshot still replays */
+    assert(journal_compact());
+    assert(undo_last_edit());
+    assert(journal_open("test.dat"));
+    assert(count_nodes(g_root) == 5);
+    assert(!g_root->yes->isQuestion);
+    assert(check_integrity());
+    
+    /* A deep slot's path comes from the parent links; when they do not
+     * reach the root the edit goes into a fresh snapshot instead */
+    Node *meow = g_root->no;
+    assert(apply_insert_split(meow, 1, meow->yes, "Is it big?", "Lion", 1));
+    Node *up = meow->parent;
+    meow->parent = NULL;                  /* as if the link were stale */
+    assert(apply_insert_split(meow->yes, 0, meow->yes->no, "Does it purr?", "Tiger", 0));
+    meow->parent = up;
+    struct stat js;
+    assert(stat("test.dat.journal", &js) == 0 && js.st_size < 64); /* just the header */
+    assert(journal_open("test.dat"));
+    assert(count_nodes(g_root) == 9);
+    assert(strcmp(g_root->no->yes->no->text, "Does it purr?") == 0);
+    assert(strcmp(g_root->no->yes->no->no->text, "Tiger") == 0);
+    assert(check_integrity());
+    
+    /* A whole record that does not replay keeps the file; only a record
+     * cut short at the end is dropped */
+    struct stat before, after;
+    assert(stat("test.dat.journal", &before) == 0);
+    assert(apply_insert_split(g_root, 1, g_root->yes, "Does it have fins?", "Shark", 1));
+    assert(stat("test.dat.journal", &after) == 0);
+    long recLen = (long)(after.st_size - before.st_size);
+    char rec[256];
+    assert(recLen > 0 && recLen <= (long)sizeof(rec));
+    FILE *jf = fopen("test.dat.journal", "rb");
+    assert(jf && fseek(jf, (long)before.st_size, SEEK_SET) == 0);
+    assert(fread(rec, 1, (size_t)recLen, jf) == (size_t)recLen);
+    fclose(jf);
+    jf = fopen("test.dat.journal", "ab");
+    assert(jf && fwrite(rec, 1, (size_t)recLen, jf) == (size_t)recLen); /* its slot is a question by then */
+    fclose(jf);
+    assert(!journal_open("test.dat"));
+    assert(stat("test.dat.journal", &js) == 0 && js.st_size == after.st_size + recLen);
+    assert(truncate("test.dat.journal", after.st_size + 3) == 0);         /* torn mid-write */
+    assert(journal_open("test.dat"));
+    assert(stat("test.dat.journal", &js) == 0 && js.st_size == after.st_size);
+    assert(count_nodes(g_root) == 11 && strcmp(g_root->yes->text, "Does it have fins?") == 0);
+    assert(check_integrity());
+    
+    journal_close();
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(g_root);
+    g_root = saved;
+    remove("test.dat");
+    remove("test.dat.journal");
+    
+    printf("  ✓ Journal tests passed\n");
+}
+
 /* Test Integrity Checker */
 void test_integrity() {
     printf("Testing Integrity Checker...\n");
@@ -217,6 +1059,69 @@ void test_canonicalize() {
     assert(strcmp(c3, "abc123") == 0);
     free(c3);
     
+    /* ASCII: the same bytes as the ctype rules, every byte at every offset
+     * of a 16-byte block and in random strings of mixed length */
+    char text[160], want[160];
+    for (int c = 1; c < 128; c++) {
+        for (int at = 0; at < 40; at += 13) {
+            memset(text, 'Q', 40);
+            text[at] = (char)c;
+            text[40] = '\0';
+            int j = 0;
+            for (int i = 0; i < 40; i++) {
+                unsigned char b = (unsigned char)text[i];
+                if (isalnum(b)) want[j++] = (char)tolower(b);
+                else if (isspace(b)) want[j++] = '_';
+            }
+            want[j] = '\0';
+            char *got = canonicalize(text);
+            assert(strcmp(got, want) == 0);
+            free(got);
+        }
+    }
+    unsigned seed = 12345;
+    for (int round = 0; round < 2000; round++) {
+        int len = round % 150, j = 0;
+        for (int i = 0; i < len; i++) {
+            seed = seed * 1103515245u + 12345u;
+            unsigned char b = (unsigned char)(1 + (seed >> 16) % 127);
+            if (seed & 0x10000000u) b = (unsigned char)("Abz Z9"[(seed >> 8) % 6]); /* long kept runs */
+            text[i] = (char)b;
+            if (isalnum(b)) want[j++] = (char)tolower(b);
+            else if (isspace(b)) want[j++] = '_';
+        }
+        text[len] = want[j] = '\0';
+        char *got = canonicalize(text);
+        assert(strcmp(got, want) == 0);
+        free(got);
+    }
+    
+    /* UTF-8: letters kept and lowercased, punctuation and spaces as in
+     * ASCII, malformed bytes dropped */
+    const char *cases[][2] = {
+        { "\xC3\x89l\xC3\xA9phant", "\xC3\xA9l\xC3\xA9phant" },                 /* Éléphant */
+        { "\xD0\x81\xD0\x96", "\xD1\x91\xD0\xB6" },                               /* Ёж */
+        { "Stra\xC3\x9F" "e!", "stra\xC3\x9F" "e" },                              /* ß has no capital here */
+        { "\xC3\x84pfel \xC3\x9C" "ber", "\xC3\xA4pfel_\xC3\xBC" "ber" },
+        { "\xC5\x81\xC3\xB3" "d\xC5\xBA", "\xC5\x82\xC3\xB3" "d\xC5\xBA" },       /* Łódź */
+        { "\xC4\xB0stanbul", "istanbul" },
+        { "\xCE\xA3\xCE\x9F\xCE\xA6\xCE\x91;", "\xCF\x83\xCE\xBF\xCF\x86\xCE\xB1" }, /* ΣΟΦΑ */
+        { "\xEF\xBC\xA1\xEF\xBD\x82\xEF\xBC\x81", "\xEF\xBD\x81\xEF\xBD\x82" },     /* fullwidth Ab! */
+        { "\xE7\x8C\xAB\xE3\x80\x82", "\xE7\x8C\xAB" },                           /* 猫。 */
+        { "1 \xC3\x97 2", "1__2" },
+        { "cat\xE2\x80\x94" "dog", "catdog" },
+        { "a\xC2\xA0" "b", "a_b" },
+        { "ab\xC3(c", "abc" },                                                 /* truncated */
+        { "a\xFF" "b\xC0\xAF" "c\xED\xA0\x80" "d", "abcd" },                     /* invalid, overlong, surrogate */
+        { "Does the \xD0\x81\xD0\xB6 of M\xC3\xBC" "nchen, or not? Yes!",
+          "does_the_\xD1\x91\xD0\xB6_of_m\xC3\xBC" "nchen_or_not_yes" },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char *got = canonicalize(cases[i][0]);
+        assert(strcmp(got, cases[i][1]) == 0);
+        free(got);
+    }
+    
     printf("  ✓ Canonicalization tests passed\n");
 }
 
@@ -252,6 +1157,866 @@ void test_nodes() {
     printf("  ✓ Node tests passed\n");
 }
 
+/* Learns `splits` times at pseudo-random leaves of g_root (seeded by from) */
+static void learn_random(int from, int splits) {
+    char q[32], a[32];
+    for (int i = from; i < from + splits; i++) {
+        Node *parent = NULL, *cur = g_root;
+        int viaYes = 0;
+        for (unsigned step = (unsigned)i; cur->isQuestion; step = step * 7 + 3) {
+            parent = cur;
+            viaYes = step & 1;
+            cur = viaYes ? cur->yes : cur->no;
+        }
+        snprintf(q, sizeof(q), "Question %d?", i);
+        snprintf(a, sizeof(a), "Animal %d", i);
+        assert(apply_insert_split(parent, viaYes, cur, q, a, i & 1));
+    }
+}
+
+/* Test cached subtree counts through learning, undo/redo and loads, and
+ * walks over a chain too deep for recursion */
+void test_subtree_counts() {
+    printf("Testing Subtree Counts...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    
+    g_root = create_animal_node("Cat");
+    assert(subtree_nodes(g_root) == 1 && subtree_leaves(g_root) == 1);
+    for (int i = 0; i < 200; i++) {   /* split pseudo-random leaves */
+        learn_random(i, 1);
+        assert(subtree_nodes(g_root) == count_nodes(g_root));
+        assert(subtree_leaves(g_root) == i + 2);
+    }
+    Node *mid = g_root->yes;
+    int midNodes = subtree_nodes(mid);
+    assert(midNodes == count_nodes(mid));
+    for (int i = 0; i < 50; i++) assert(undo_last_edit());
+    assert(subtree_nodes(g_root) == count_nodes(g_root) && subtree_leaves(g_root) == 151);
+    for (int i = 0; i < 50; i++) assert(redo_last_edit());
+    assert(subtree_nodes(g_root) == 401 && subtree_nodes(mid) == midNodes);
+    
+    es_free(&g_undo);   /* the edits point into the tree the load replaces */
+    es_free(&g_redo);
+    h_free(&g_index);
+    
+    /* Loads fill the counts in */
+    assert(save_tree_as("test.dat", TREE_FORMAT_V1));
+    assert(load_tree("test.dat"));
+    assert(subtree_nodes(g_root) == 401 && subtree_leaves(g_root) == 201);
+    assert(subtree_nodes(g_root->no) == count_nodes(g_root->no));
+    assert(g_root->yes->parent == g_root);
+    free_tree(g_root);
+    remove("test.dat");
+    
+    /* A one-sided chain far deeper than the C stack would allow */
+    int depth = 1000000;
+    Node *root = create_animal_node("Bottom");
+    for (int i = 0; i < depth; i++) {
+        Node *up = create_question_node("Deeper?");
+        up->yes = root;
+        up->no = create_animal_node("Here");
+        root = up;
+    }
+    assert(count_nodes(root) == 2 * depth + 1);
+    tree_recount(root);
+    assert(subtree_nodes(root) == 2 * depth + 1 && subtree_leaves(root) == depth + 1);
+    free_tree(root);
+    
+    g_root = saved;
+    printf("  ✓ Subtree count tests passed\n");
+}
+
+/* 1 if every node of the tree sits in [base, base + count) after its parent */
+static int laid_out_in(Node *root, Node *base, int count) {
+    FrameStack s;
+    fs_init(&s);
+    fs_push(&s, root, -1);
+    int ok = 1;
+    while (ok && !fs_empty(&s)) {
+        Node *n = fs_pop(&s).node;
+        ok = n >= base && n < base + count;
+        if (n->yes) { ok = ok && n->yes > n; fs_push(&s, n->yes, -1); }
+        if (n->no) { ok = ok && n->no > n; fs_push(&s, n->no, -1); }
+    }
+    fs_free(&s);
+    return ok;
+}
+
+/* Test relayout: every order keeps the tree, its counts and the edits */
+void test_tree_compact() {
+    printf("Testing Tree Compaction...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    g_root = create_animal_node("Cat");
+    learn_random(0, 300);
+    for (int i = 0; i < 40; i++) assert(undo_last_edit());
+    
+    /* A reference copy of the tree as it is now */
+    Node *live = g_root;
+    assert(save_tree_as("test.dat", TREE_FORMAT_V1));
+    g_root = NULL;
+    assert(load_tree("test.dat"));
+    Node *ref = g_root;
+    g_root = live;
+    
+    int layouts[] = { LAYOUT_BFS, LAYOUT_VEB, LAYOUT_AUTO, LAYOUT_VEB };
+    for (int k = 0; k < 4; k++) {
+        if (k == 3) set_text_interning(0);   /* texts go to one arena */
+        assert(tree_compact(layouts[k]));
+        set_text_interning(1);
+        int count = count_nodes(g_root);
+        assert(g_root->flags & NODE_IN_BLOCK);
+        assert(laid_out_in(g_root, g_root, count));
+        assert(same_tree(g_root, ref));
+        assert(subtree_nodes(g_root) == count && check_integrity());
+    }
+    
+    /* Edits were remapped: redo and undo still work on the moved nodes */
+    for (int i = 0; i < 40; i++) assert(redo_last_edit());
+    assert(subtree_nodes(g_root) == 601 && count_nodes(g_root) == 601);
+    for (int i = 0; i < 300; i++) assert(undo_last_edit());
+    assert(count_nodes(g_root) == 1 && strcmp(g_root->text, "Cat") == 0);
+    for (int i = 0; i < 300; i++) assert(redo_last_edit());
+    assert(check_integrity() && subtree_leaves(g_root) == 301);
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(g_root);
+    free_tree(ref);
+    remove("test.dat");
+    
+    /* van Emde Boas over a chain far deeper than recursion allows */
+    int depth = 100000;
+    g_root = create_animal_node("Bottom");
+    for (int i = 0; i < depth; i++) {
+        Node *up = create_question_node("Deeper?");
+        up->yes = g_root;
+        up->no = create_animal_node("Here");
+        g_root = up;
+    }
+    assert(tree_compact(LAYOUT_AUTO));
+    assert(laid_out_in(g_root, g_root, 2 * depth + 1));
+    assert(subtree_nodes(g_root) == 2 * depth + 1 && check_integrity());
+    free_tree(g_root);
+    
+    g_root = saved;
+    printf("  ✓ Tree compaction tests passed\n");
+}
+
+/* "Does it bark?" over Dog and Cat: the subtree both branches end in */
+static Node *bark_subtree(void) {
+    Node *q = create_question_node("Does it bark?");
+    q->yes = create_animal_node("Dog");
+    q->no = create_animal_node("Cat");
+    return q;
+}
+
+static long file_bytes(const char *name) {
+    FILE *fp = fopen(name, "rb");
+    if (!fp) return -1;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fclose(fp);
+    return len;
+}
+
+/* Complete tree with one question text per level over Dog/Cat leaves, so
+ * all subtrees on a level are alike */
+static Node *build_uniform_tree(int levels) {
+    int total = (1 << levels) - 1;
+    Node **all = malloc(sizeof(Node *) * (size_t)total);
+    char text[32];
+    for (int i = total - 1; i >= 0; i--) {   /* children before parents */
+        int level = 0;
+        while ((2 << level) <= i + 1) level++;
+        if (2 * i + 1 >= total) {
+            all[i] = create_animal_node(i % 2 ? "Dog" : "Cat");
+            continue;
+        }
+        snprintf(text, sizeof(text), "Question %d?", level);
+        all[i] = create_question_node(text);
+        all[i]->yes = all[2 * i + 1];
+        all[i]->no = all[2 * i + 2];
+    }
+    Node *root = all[0];
+    free(all);
+    return root;
+}
+
+/* Test hash-consing: identical subtrees stored once, copy-on-write when
+ * learning below one, saves and loads that keep it, and free_tree */
+void test_subtree_sharing() {
+    printf("Testing Subtree Sharing...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    PoolStats before, after;
+    pool_stats(&before);
+    ShareStats ss;
+    
+    /* Both "Does it bark?" subtrees become one */
+    g_root = create_question_node("Is it a pet?");
+    Node *wild = create_question_node("Is it wild?");
+    g_root->yes = bark_subtree();
+    g_root->no = wild;
+    wild->yes = bark_subtree();
+    wild->no = create_animal_node("Fish");
+    tree_recount(g_root);
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2));
+    long fullBytes = file_bytes("test.dat");
+    assert(tree_share() && tree_is_shared());
+    assert(g_root->yes == wild->yes);
+    share_stats(&ss);
+    assert(ss.sharedNodes == 1 && ss.nodesSaved == 3 && ss.bytesSaved == 3 * sizeof(Node));
+    assert(count_nodes(g_root) == 9 && subtree_nodes(g_root) == 9 && subtree_leaves(g_root) == 5);
+    assert(check_integrity());
+    
+    /* Parent links no longer give one path: LCAs and signatures refuse */
+    PathQuery pq = { "Dog", "Fish", NULL, 0 };
+    PathSig none = { 0, 0 }, sig;
+    assert(!tree_lca(wild->yes->yes, wild->no) && find_paths(&pq, 1) == -1);
+    assert(animal_candidates(&none, NULL) == -1 && !animal_path(wild->no, &sig));
+    assert(!animal_consistent(wild->no, &none, NULL));
+    
+    /* v2 writes the shared subtree once and loads it back shared */
+    Node *live = g_root;
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2));
+    assert(file_bytes("test.dat") < fullBytes);
+    g_root = NULL;
+    assert(load_tree("test.dat"));
+    assert(g_root->yes == g_root->no->yes && check_integrity());
+    assert(subtree_nodes(g_root) == 9 && count_nodes(g_root) == 9);
+    share_stats(&ss);
+    assert(ss.nodesSaved == 6);   /* both trees */
+    free_tree(g_root);
+    share_stats(&ss);
+    assert(ss.nodesSaved == 3);
+    
+    /* v1 writes every copy: loads back unshared */
+    g_root = live;
+    assert(save_tree_as("test.dat", TREE_FORMAT_V1));
+    g_root = NULL;
+    assert(load_tree("test.dat"));
+    assert(g_root->yes != g_root->no->yes && same_tree(g_root, live));
+    free_tree(g_root);
+    g_root = live;
+    share_stats(&ss);
+    assert(ss.nodesSaved == 3);
+    
+    /* Learning at the wild Dog copies its path first; the pet Dog stays */
+    Node *dog = wild->yes->yes;
+    assert(!apply_insert_split(wild->yes, 1, dog, "Is it big?", "Wolf", 1));
+    FrameStack path;
+    fs_init(&path);
+    fs_push(&path, g_root, -1);
+    fs_push(&path, wild, 0);
+    fs_push(&path, wild->yes, 1);
+    fs_push(&path, dog, 1);
+    assert(tree_unshare(&path));
+    Node *bark = path.frames[2].node;
+    assert(wild->yes == bark && g_root->yes != bark && path.frames[3].node != dog);
+    assert(apply_insert_split(bark, 1, path.frames[3].node, "Is it big?", "Wolf", 1));
+    fs_free(&path);
+    assert(g_root->yes->yes == dog && !dog->isQuestion);
+    assert(strcmp(wild->yes->yes->text, "Is it big?") == 0);
+    assert(subtree_nodes(g_root) == 11 && count_nodes(g_root) == 11 && check_integrity());
+    share_stats(&ss);
+    assert(ss.sharedNodes == 1 && ss.nodesSaved == 1);   /* Cat, under both copies */
+    
+    /* Undo and redo only touch the copy; sharing again leaves edited nodes alone */
+    assert(undo_last_edit());
+    assert(subtree_nodes(g_root) == 9 && strcmp(wild->yes->yes->text, "Dog") == 0);
+    assert(check_integrity());
+    assert(redo_last_edit() && subtree_nodes(g_root) == 11);
+    assert(tree_share() && wild->yes == bark);
+    assert(undo_last_edit() && check_integrity());
+    es_clear(&g_redo);
+    assert(tree_share() && wild->yes == g_root->yes);
+    share_stats(&ss);
+    assert(ss.nodesSaved == 3 && count_nodes(g_root) == 9 && check_integrity());
+    assert(!tree_compact(LAYOUT_AUTO));   /* would copy the shared subtree twice */
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(g_root);
+    assert(!tree_is_shared());
+    pool_stats(&after);
+    assert(after.nodesLive == before.nodesLive && after.textsLive == before.textsLive);
+    
+    /* A complete tree with the same text on every level: one node per level */
+    int levels = 16, logical = (1 << levels) - 1;
+    g_root = build_uniform_tree(levels);
+    tree_recount(g_root);
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2));
+    fullBytes = file_bytes("test.dat");
+    assert(tree_share());
+    share_stats(&ss);
+    assert(ss.nodesSaved == logical - (levels + 1) && subtree_nodes(g_root) == logical);
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2) && file_bytes("test.dat") * 100 < fullBytes);
+    live = g_root;
+    g_root = NULL;
+    assert(load_tree("test.dat"));
+    assert(count_nodes(g_root) == logical && same_tree(g_root, live) && check_integrity());
+    free_tree(g_root);
+    g_root = live;
+    assert(check_integrity());
+    free_tree(g_root);
+    assert(!tree_is_shared());
+    
+    /* A chain too deep for recursion: its "Here" leaves all become one */
+    int depth = 100000;
+    g_root = create_animal_node("Bottom");
+    for (int i = 0; i < depth; i++) {
+        Node *up = create_question_node("Deeper?");
+        up->yes = g_root;
+        up->no = create_animal_node("Here");
+        g_root = up;
+    }
+    tree_recount(g_root);
+    assert(tree_share());
+    share_stats(&ss);
+    assert(ss.sharedNodes == 1 && ss.nodesSaved == depth - 1 && check_integrity());
+    free_tree(g_root);
+    assert(!tree_is_shared());
+    pool_stats(&after);
+    assert(after.nodesLive == before.nodesLive);
+    
+    remove("test.dat");
+    g_root = saved;
+    printf("  ✓ Subtree sharing tests passed\n");
+}
+
+/* 1 if every node's hash matches its text, type and children's hashes */
+static int hashes_fresh(Node *root) {
+    FrameStack s;
+    fs_init(&s);
+    fs_push(&s, root, -1);
+    int ok = 1;
+    while (ok && !fs_empty(&s)) {
+        Node *n = fs_pop(&s).node;
+        uint64_t h = n->hash;
+        node_rehash(n);
+        ok = n->hash == h;
+        if (n->yes) fs_push(&s, n->yes, -1);
+        if (n->no) fs_push(&s, n->no, -1);
+    }
+    fs_free(&s);
+    return ok;
+}
+
+typedef struct {
+    int calls;
+    char path[64];
+    const Node *a, *b;
+} DiffLog;
+
+static void log_difference(const char *path, const Node *a, const Node *b, void *ctx) {
+    DiffLog *log = (DiffLog *)ctx;
+    log->calls++;
+    snprintf(log->path, sizeof(log->path), "%s", path);
+    log->a = a;
+    log->b = b;
+}
+
+/* Test subtree hashes through edits and saves, and diffs of trees and files */
+void test_tree_diff() {
+    printf("Testing Tree Diff...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    
+    g_root = create_animal_node("Cat");
+    learn_random(0, 100);
+    assert(hashes_fresh(g_root));
+    assert(save_tree_as("diffA.dat", TREE_FORMAT_V2));
+    Node *live = g_root;
+    g_root = NULL;
+    assert(load_tree("diffA.dat"));
+    Node *copy = g_root;
+    g_root = live;
+    assert(node_hash(copy) == node_hash(live) && tree_diff(copy, live, NULL, NULL) == 0);
+    
+    /* One learn is one difference, at the path down to the new question */
+    learn_random(100, 1);
+    assert(hashes_fresh(g_root) && node_hash(copy) != node_hash(live));
+    Node *q = g_undo.edits[g_undo.size - 1].newQuestion;
+    char expect[64];
+    int len = 0;
+    for (Node *n = q; n->parent; n = n->parent) len++;
+    expect[len] = '\0';
+    for (Node *n = q; n->parent; n = n->parent) expect[--len] = n->parent->yes == n ? 'y' : 'n';
+    DiffLog log = { 0, "", NULL, NULL };
+    assert(tree_diff(copy, live, log_difference, &log) == 1 && log.calls == 1);
+    assert(strcmp(log.path, expect) == 0 && log.b == q && !log.a->isQuestion);
+    
+    /* Undo and redo keep the hashes right */
+    assert(undo_last_edit() && hashes_fresh(g_root) && tree_diff(copy, live, NULL, NULL) == 0);
+    assert(redo_last_edit() && hashes_fresh(g_root) && tree_diff(copy, live, NULL, NULL) == 1);
+    
+    /* Stored hashes: 8 more bytes a node, loaded as they were saved */
+    assert(save_tree_as("diffB.dat", TREE_FORMAT_V2));
+    long plain = file_bytes("diffB.dat");
+    assert(save_tree_as("diffB.dat", TREE_FORMAT_V2 | TREE_HASHES));
+    assert(file_bytes("diffB.dat") == plain + 8 * (long)subtree_nodes(live));
+    assert(!save_tree_as("diffC.dat", TREE_FORMAT_V1 | TREE_HASHES));
+    g_root = NULL;
+    assert(load_tree("diffB.dat"));
+    assert(node_hash(g_root) == node_hash(live) && hashes_fresh(g_root) && same_tree(g_root, live));
+    free_tree(g_root);
+    g_root = live;
+    assert(save_tree_as("diffC.dat", TREE_FORMAT_V2 | TREE_HASHES | TREE_POOL_COMPRESSED));
+    g_root = NULL;
+    assert(load_tree("diffC.dat") && node_hash(g_root) == node_hash(live));
+    free_tree(g_root);
+    g_root = live;
+    CompactTree ct;
+    ct_init(&ct);
+    assert(ct_load(&ct, "diffB.dat") && ct_count_reachable(&ct) == (uint32_t)subtree_nodes(live));
+    ct_free(&ct);
+    
+    /* Files: the live tree is left where it was */
+    FILE *out = tmpfile();
+    assert(diff_files("diffA.dat", "diffB.dat", out) == 1 && g_root == live);
+    char line[256] = "";
+    rewind(out);
+    assert(fgets(line, sizeof(line), out));
+    fclose(out);
+    assert(strncmp(line, expect, strlen(expect)) == 0 && strstr(line, q->text) && strstr(line, "(1 -> 3 nodes)"));
+    assert(diff_files("diffB.dat", "diffC.dat", NULL) == 0);
+    assert(diff_files("diffA.dat", "missing.dat", NULL) == -1 && g_root == live);
+    
+    /* Diffs of unrelated roots and of a missing side */
+    Node *cat = create_animal_node("Cat");
+    assert(tree_diff(cat, live, log_difference, &log) == 1 && strcmp(log.path, "") == 0);
+    assert(tree_diff(cat, NULL, NULL, NULL) == 1 && tree_diff(NULL, NULL, NULL, NULL) == 0);
+    free_node(cat);
+    
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(copy);
+    free_tree(live);
+    remove("diffA.dat");
+    remove("diffB.dat");
+    remove("diffC.dat");
+    g_root = saved;
+    printf("  ✓ Tree diff tests passed\n");
+}
+
+/* What find_shortest_path prints, read back from a temporary file */
+static void path_output(const char *a, const char *b, char *out, size_t cap) {
+    fflush(stdout);
+    FILE *tmp = tmpfile();
+    int saved = dup(1);
+    dup2(fileno(tmp), 1);
+    find_shortest_path(a, b);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    rewind(tmp);
+    size_t len = fread(out, 1, cap - 1, tmp);
+    out[len] = '\0';
+    fclose(tmp);
+}
+
+/* Test the animal index through learning, undo/redo, loads and path queries */
+void test_animal_index() {
+    printf("Testing Animal Index...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    
+    g_root = create_question_node("Does it bark?");
+    g_root->yes = create_animal_node("Dog");
+    g_root->no = create_animal_node("Cat");
+    tree_recount(g_root);
+    assert(animal_index_size() == 2);
+    AnimalRef ref;
+    assert(animal_find("dog", &ref, 1) == 1 && ref.leaf == g_root->yes && ref.parent == g_root);
+    assert(animal_lookup("CAT!") == g_root->no && animal_lookup("Cow") == NULL);
+    
+    /* Learning adds the new leaf; the old one keeps its entry, under its new parent */
+    Node *cat = g_root->no;
+    Node *q = apply_insert_split(g_root, 0, cat, "Does it moo?", "Cow", 1);
+    assert(q && animal_lookup("cow") == q->yes && animal_find("Cat", &ref, 1) == 1 && ref.parent == q);
+    learn_random(0, 300);
+    assert(animal_index_size() == subtree_leaves(g_root));
+    Node *a7 = animal_lookup("Animal 7");
+    assert(a7 && strcmp(a7->text, "Animal 7") == 0 && !a7->isQuestion);
+    
+    /* Undo takes the leaf out, redo puts it back */
+    Node *last = g_undo.edits[g_undo.size - 1].newLeaf;
+    assert(animal_lookup("Animal 299") == last);
+    assert(undo_last_edit() && animal_lookup("Animal 299") == NULL);
+    assert(animal_index_size() == subtree_leaves(g_root));
+    assert(redo_last_edit() && animal_lookup("Animal 299") == last);
+    
+    /* A split of the root leaf moves the root; both Dogs are listed */
+    es_clear(&g_undo);   /* the edits point into the tree freed next */
+    free_tree(g_root);
+    g_root = create_animal_node("Dog");
+    assert(animal_lookup("dog") == g_root);
+    Node *dog = g_root;
+    assert(apply_insert_split(NULL, 0, dog, "Is it big?", "Dog", 1));
+    AnimalRef two[4];
+    assert(animal_find("dog", two, 4) == 2 && two[0].leaf != two[1].leaf);
+    assert(two[0].parent == g_root && two[1].parent == g_root);
+    assert(undo_last_edit() && g_root == dog && animal_find("dog", two, 4) == 1 && two[0].parent == NULL);
+    es_clear(&g_redo);   /* frees the undone split */
+    
+    /* Loads leave the index to the next lookup, which sees the new tree */
+    learn_random(0, 50);
+    es_clear(&g_undo);   /* the edits point into the tree the load replaces */
+    assert(save_tree_as("test.dat", TREE_FORMAT_V2));
+    assert(load_tree("test.dat"));
+    Node *loaded = animal_lookup("Animal 42");
+    assert(loaded && loaded >= g_root && loaded < g_root + subtree_nodes(g_root));
+    assert(animal_index_size() == 51);
+    
+    /* A freed tree's index is never used for a tree at the same address */
+    free_tree(g_root);
+    g_root = create_question_node("Does it fly?");
+    g_root->yes = create_animal_node("Bird");
+    g_root->no = create_animal_node("Animal 42");
+    tree_recount(g_root);
+    assert(animal_lookup("Animal 42") == g_root->no && animal_lookup("Animal 7") == NULL);
+    
+    /* Path queries: the question where the two paths part, then each side's answers */
+    Node *fish = apply_insert_split(g_root, 0, g_root->no, "Does it swim?", "Fish", 1);
+    assert(fish);
+    char out[512];
+    path_output("fish", "bird", out, sizeof(out));
+    assert(strstr(out, "Fish vs Bird: \"Does it fly?\"") && strstr(out, "Fish: Does it fly? no, Does it swim? yes"));
+    path_output("Fish", "Animal 42", out, sizeof(out));
+    assert(strstr(out, "\"Does it swim?\"") && strstr(out, "Animal 42: Does it swim? no"));
+    path_output("Fish", "Unicorn", out, sizeof(out));
+    assert(strstr(out, "Unicorn"));
+    
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(g_root);
+    animal_index_free();
+    remove("test.dat");
+    g_root = saved;
+    printf("  ✓ Animal index tests passed\n");
+}
+
+/* 1 if anc is n or above it */
+static int is_above(const Node *anc, const Node *n) {
+    for (; n; n = n->parent) if (n == anc) return 1;
+    return 0;
+}
+
+/* Every pair of leaves: tree_lca is the deepest common ancestor, and
+ * find_paths puts animal1 on the right side of it */
+static int lca_all_pairs(void) {
+    int k = subtree_leaves(g_root), n = 0;
+    Node **leaves = malloc(sizeof(Node *) * (size_t)k);
+    FrameStack s;
+    fs_init(&s);
+    fs_push(&s, g_root, -1);
+    while (!fs_empty(&s)) {
+        Node *x = fs_pop(&s).node;
+        if (!x->isQuestion) { leaves[n++] = x; continue; }
+        fs_push(&s, x->no, -1);
+        fs_push(&s, x->yes, -1);
+    }
+    fs_free(&s);
+    int ok = n == k;
+    for (int i = 0; ok && i < n; i++) {
+        for (int j = 0; ok && j < n; j++) {
+            if (i == j) continue;
+            Node *lca = tree_lca(leaves[i], leaves[j]);
+            ok = lca && lca->isQuestion && is_above(lca, leaves[i]) && is_above(lca, leaves[j]) &&
+                 is_above(lca->yes, leaves[i]) != is_above(lca->yes, leaves[j]);
+        }
+    }
+    for (int i = 0; ok && i + 1 < n; i++) {
+        PathQuery q = { leaves[i + 1]->text, leaves[i]->text, NULL, 0 };
+        ok = find_paths(&q, 1) == 1 && q.split == tree_lca(leaves[i], leaves[i + 1]) &&
+             q.yes1 == is_above(q.split->yes, leaves[i + 1]);
+    }
+    free(leaves);
+    return ok;
+}
+
+/* Test LCA tables: every pair against parent links, kept through learning, undo and redo */
+void test_find_paths() {
+    printf("Testing Find Paths...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    
+    /* A root leaf grows into a tree; before any table is built, then after */
+    g_root = create_animal_node("Cat");
+    learn_random(0, 20);
+    assert(lca_all_pairs());
+    learn_random(20, 100);   /* filed under the leaves they grew from */
+    assert(lca_all_pairs());
+    
+    /* Undo of a filed learn, and of one the tables were built with */
+    for (int i = 0; i < 60; i++) assert(undo_last_edit());
+    assert(lca_all_pairs());
+    for (int i = 0; i < 30; i++) assert(redo_last_edit());
+    assert(lca_all_pairs());
+    learn_random(200, 40);
+    assert(lca_all_pairs());
+    
+    /* A chain learned under one leaf outgrows the tables: they are rebuilt */
+    Node *leaf = animal_lookup("Animal 3");
+    char q[32], a[32];
+    for (int i = 0; i < 300; i++) { //always split the animal just learned
+        snprintf(q, sizeof(q), "Chain %d?", i);
+        snprintf(a, sizeof(a), "Chain animal %d", i);
+        Node *nq = apply_insert_split(leaf->parent, leaf->parent && leaf->parent->yes == leaf, leaf, q, a, 1);
+        assert(nq);
+        leaf = nq->yes;
+    }
+    assert(lca_all_pairs());
+    
+    /* Batches: unknown animals and the same leaf twice give no split */
+    PathQuery qs[3] = {
+        { "Animal 3", "Animal 7", NULL, 0 },
+        { "Animal 3", "Unicorn", NULL, 0 },
+        { "animal 3", "ANIMAL 3", NULL, 0 },
+    };
+    assert(find_paths(qs, 3) == 1 && qs[0].split && !qs[1].split && !qs[2].split);
+    assert(qs[0].split == tree_lca(animal_lookup("Animal 3"), animal_lookup("Animal 7")));
+    
+    /* Learning at the root leaf of a one-leaf tree */
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    free_tree(g_root);
+    g_root = create_animal_node("Dog");
+    assert(tree_lca(g_root, g_root) == g_root);
+    learn_random(0, 10);
+    assert(lca_all_pairs());
+    
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(g_root);
+    animal_index_free();
+    lca_free();
+    g_root = saved;
+    printf("  ✓ Find paths tests passed\n");
+}
+
+/* Walks answer sequences down from the root: at every node the signatures
+ * count exactly the leaves below it, and a leaf fits iff it is below */
+static int signatures_match(int walks) {
+    int ok = 1;
+    for (int w = 0; ok && w < walks; w++) {
+        PathSig answers = { 0, 0 };
+        Node *cur = g_root;
+        unsigned step = (unsigned)w * 2654435761u;
+        for (;;) {
+            ok = animal_candidates(&answers, cur) == subtree_leaves(cur);
+            if (!ok || !cur->isQuestion) break;
+            int yes = (step >> 7) & 1;
+            step = step * 1103515245u + 12345u;
+            Node *other = yes ? cur->no : cur->yes;
+            while (other->isQuestion) other = other->yes; //a leaf the next answer rules out
+            path_sig_push(&answers, yes);
+            cur = yes ? cur->yes : cur->no;
+            PathSig sig;
+            ok = !animal_consistent(other, &answers, cur) && animal_path(other, &sig) && sig.depth >= answers.depth;
+            if (!ok) break;
+        }
+        PathSig sig;
+        ok = ok && animal_consistent(cur, &answers, cur) && animal_path(cur, &sig) &&
+             sig.depth == answers.depth && sig.bits == answers.bits;
+    }
+    return ok;
+}
+
+/* Test answer-path signatures through learning, undo, redo and paths
+ * longer than the signatures */
+void test_path_signatures() {
+    printf("Testing Path Signatures...\n");
+    
+    Node *saved = g_root;
+    es_init(&g_undo);
+    es_init(&g_redo);
+    h_init(&g_index, 31);
+    
+    g_root = create_animal_node("Cat");
+    PathSig none = { 0, 0 };
+    assert(animal_candidates(&none, g_root) == 1);
+    learn_random(0, 200);
+    assert(animal_candidates(&none, NULL) == 201);
+    assert(signatures_match(100));
+    
+    /* Undo moves the old leaves back up, redo down again */
+    for (int i = 0; i < 80; i++) assert(undo_last_edit());
+    assert(animal_candidates(&none, NULL) == 121);
+    assert(signatures_match(100));
+    for (int i = 0; i < 40; i++) assert(redo_last_edit());
+    assert(signatures_match(100));
+    learn_random(300, 20);
+    assert(signatures_match(100));
+    
+    /* A chain 100 answers deep: past the signatures at checks the rest */
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    free_tree(g_root);
+    g_root = create_animal_node("Fish");
+    char q[32], a[32];
+    Node *leaf = g_root;
+    for (int i = 0; i < 100; i++) { //always split the animal just learned
+        snprintf(q, sizeof(q), "Deep %d?", i);
+        snprintf(a, sizeof(a), "Deep animal %d", i);
+        Node *nq = apply_insert_split(leaf->parent, leaf->parent && leaf->parent->yes == leaf, leaf, q, a, i & 1);
+        assert(nq);
+        leaf = (i & 1) ? nq->yes : nq->no;
+    }
+    PathSig deep;
+    assert(animal_path(leaf, &deep) && deep.depth == 100);
+    assert(animal_consistent(leaf, &deep, leaf));
+    assert(animal_candidates(&deep, leaf) == 1);
+    assert(signatures_match(50));
+    
+    es_free(&g_undo);
+    es_free(&g_redo);
+    h_free(&g_index);
+    free_tree(g_root);
+    animal_index_free();
+    lca_free();
+    g_root = saved;
+    printf("  ✓ Path signature tests passed\n");
+}
+
+/* Test the node pool: cells are reused, pooled and heap nodes mix */
+void test_node_pool() {
+    printf("Testing Node Pool...\n");
+    
+    PoolStats before, after;
+    Node *nodes[1000];
+    char text[300];
+    
+    /* Warm the pool once, then a second round needs no malloc at all */
+    for (int round = 0; round < 2; round++) {
+        pool_stats(&before);
+        for (int i = 0; i < 1000; i++) {
+            snprintf(text, sizeof(text), "Animal %d", i);
+            nodes[i] = create_animal_node(text);
+        }
+        pool_stats(&after);
+        assert(after.nodesLive - before.nodesLive == 1000);
+        assert(after.mallocs - before.mallocs < (round ? 1 : 10));
+        for (int i = 0; i < 1000; i++) free_node(nodes[i]);
+    }
+    pool_stats(&after);
+    assert(after.nodesLive == before.nodesLive && after.textsLive == before.textsLive);
+    
+    /* Texts past the biggest class, and nodes made with the pool off */
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    Node *q = create_question_node(text);
+    set_node_pool(0);
+    q->yes = create_animal_node("Heap cat");
+    set_node_pool(1);
+    q->no = create_animal_node("Pool dog");
+    assert(!(q->yes->flags & NODE_POOLED) && (q->no->flags & NODE_POOLED));
+    assert(node_set_text(q->no, "Pool wolf") && strcmp(q->no->text, "Pool wolf") == 0);
+    assert(node_set_text(q, "Short now?") && strcmp(q->text, "Short now?") == 0);
+    free_tree(q);
+    pool_stats(&after);
+    assert(after.nodesLive == before.nodesLive && after.textsLive == before.textsLive);
+    
+    /* Block nodes find their own block among many, freed in any order */
+    TreeBlock *blocks[64];
+    for (int i = 0; i < 64; i++) {
+        blocks[i] = tb_create(3);
+        assert(blocks[i] != NULL);
+        for (int k = 0; k < 3; k++) blocks[i]->nodes[k].text = "Block animal";
+    }
+    for (int i = 63; i >= 0; i--) {
+        free_node(&blocks[i]->nodes[2]);
+        free_node(&blocks[(i * 37) % 64]->nodes[0]);
+    }
+    for (int i = 0; i < 64; i++) assert(blocks[i]->live == 1);
+    for (int i = 0; i < 64; i++) free_node(&blocks[(i * 29) % 64]->nodes[1]); /* the last one discards */
+    
+    printf("  ✓ Node pool tests passed\n");
+}
+
+/* Test the intern table: shared copies, refcounts, index keys and loads */
+void test_string_interning() {
+    printf("Testing String Interning...\n");
+    
+    InternStats base, st;
+    intern_stats(&base);
+    Node *q = create_question_node("Does it bark?");
+    q->yes = create_animal_node("Dog");
+    q->no = create_animal_node("Dog");
+    assert(q->yes->text == q->no->text);   /* one copy */
+    assert(q->yes->flags & NODE_INTERNED);
+    intern_stats(&st);
+    assert(st.strings - base.strings == 2 && st.refs - base.refs == 3);
+    assert(st.savedBytes - base.savedBytes == 4);
+    
+    /* Retexting moves the reference; the shared copy stays for the other node */
+    assert(node_set_text(q->no, "Cat") && strcmp(q->yes->text, "Dog") == 0);
+    
+    /* Index keys share the table with node texts */
+    Hash h;
+    h_init(&h, 16);
+    assert(h_put(&h, "Dog", 1));
+    assert(h.buckets[h_hash("Dog") % 16]->key == q->yes->text);
+    h_free(&h);
+    
+    /* Private copies with interning off, and both kinds free correctly */
+    set_text_interning(0);
+    Node *own = create_animal_node("Dog");
+    set_text_interning(1);
+    assert(own->text != q->yes->text && !(own->flags & NODE_INTERNED));
+    assert(node_set_text(own, "Dog") && own->text == q->yes->text);
+    free_node(own);
+    free_tree(q);
+    intern_stats(&st);
+    assert(st.strings == base.strings && st.refs == base.refs);
+    assert(st.bytes == base.bytes && st.savedBytes == base.savedBytes);
+    
+    /* Arena loads intern their texts and drop the arena */
+    Node *saved = g_root;
+    g_root = create_question_node("Does it swim?");
+    g_root->yes = create_animal_node("Fish");
+    g_root->no = create_question_node("Does it bark?");
+    g_root->no->yes = create_animal_node("Fish");
+    g_root->no->no = create_animal_node("Cat");
+    assert(save_tree_as("test.dat", TREE_FORMAT_V1));
+    free_tree(g_root);
+    g_root = NULL;
+    assert(load_tree("test.dat"));
+    assert((g_root->flags & NODE_IN_BLOCK) && (g_root->flags & NODE_INTERNED));
+    assert(g_root->yes->text == g_root->no->yes->text);
+    assert(check_integrity());
+    free_tree(g_root);
+    g_root = saved;
+    intern_stats(&st);
+    assert(st.strings == base.strings && st.refs == base.refs);
+    remove("test.dat");
+    
+    printf("  ✓ String interning tests passed\n");
+}
+
 /* Test Edit Stack */
 void test_edit_stack() {
     printf("Testing Edit Stack...\n");
@@ -261,7 +2026,7 @@ void test_edit_stack() {
     
     assert(es_empty(&s));
     
-    Edit e1, e2;
+    Edit e1 = { 0 }, e2 = { 0 };  /* no nodes: es_clear frees detached ones */
     e1.type = EDIT_INSERT_SPLIT;
     e1.parent = NULL;
     
@@ -299,12 +2064,34 @@ int main() {
     printf("\n=== Running Unit Tests ===\n\n");
     
     test_nodes();
+    test_subtree_counts();
+    test_tree_compact();
+    test_subtree_sharing();
+    test_tree_diff();
+    test_animal_index();
+    test_find_paths();
+    test_path_signatures();
+    test_node_pool();
+    test_string_interning();
     test_stack();
     test_edit_stack();
     test_queue();
     test_canonicalize();
     test_hash();
+    test_hash_resize();
+    test_hash_open();
+    test_hash64();
+    test_hash_text();
     test_persistence();
+    test_persistence_formats();
+    test_parallel_load();
+    test_progressive_load();
+    test_paging();
+    test_parallel_save();
+    test_compression();
+    test_preorder_format();
+    test_compact_tree();
+    test_journal();
     test_integrity();
     
     printf("\n=== All Tests Passed! ===\n\n");
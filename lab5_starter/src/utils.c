@@ -26,11 +26,14 @@ extern Node *g_root;
  *      - Check if yes != NULL or no != NULL
  *      - If so, set valid = 0 and break
  * 5. Free queue and return valid
+ * A tree with shared subtrees (tree_share) is also checked for link counts
+ * that match the tree and for cycles, which the BFS alone would not end on.
  */
 int check_integrity() {
     // TODO: Implement this function
     // Use the Queue functions you implemented
     if (g_root == NULL) return 1; //empty is valid
+    if (tree_is_shared() && !share_check(g_root)) return 0; //first: a cycle would keep the BFS going
 
     Queue q; //BFS queue
     q_init(&q); //initializes
@@ -44,14 +47,16 @@ int check_integrity() {
         if (!q_dequeue(&q, &n, &dummy)) break;  // defensive
 
         if (n == NULL) { valid = 0; break; } //null node so invalid
+        node_ready(n); //may have been paged out while queued
 
         if (n->isQuestion) { //question not must have both or invalid
-            if (n->yes == NULL || n->no == NULL) {
+            Node *yes = node_child(n, 1), *no = node_child(n, 0);
+            if (yes == NULL || no == NULL) {
                 valid = 0;
                 break;
             }
-            q_enqueue(&q, n->yes, 0); //goes to yes and no
-            q_enqueue(&q, n->no, 0);
+            q_enqueue(&q, yes, 0); //goes to yes and no
+            q_enqueue(&q, no, 0);
         } else {
             if (n->yes != NULL || n->no != NULL) { //leaves have no kids so invalid and stop early
                 valid = 0;
@@ -64,36 +69,350 @@ int check_integrity() {
     return valid;
 }
 
-typedef struct PathNode {
-    Node *treeNode;
-    struct PathNode *parent;
-    int viaYes;  /* 1 if reached via yes, 0 if via no, -1 for root */
-} PathNode;
+/* ========== Distinguishing Questions ========== */
+
+/* Tables for g_root as of animal_index_version() == version (root NULL:
+ * rebuilt by the next query; leaves 0: the tree has none). Level j >= 1 of the sparse table starts at
+ * sparse[(j - 1) * (leaves - 1)] and holds, for each m, the index of the
+ * shallowest of between[m, m + 2^j). */
+static struct {
+    Node *root;
+    unsigned version;
+    int leaves;
+    Node **between;          /* between[m]: the question between leaf m and leaf m + 1 */
+    int *depth;              /* depth of between[m] */
+    int *sparse;
+    unsigned char *log2of;   /* floor(log2(len)) for len < leaves */
+    NodeMap pos;             /* leaf -> in-order index; a node learned since -> -(its leaf's index) - 1 */
+    int filed;               /* learns filed under a leaf since the build */
+} g_lca;
+
+void lca_free(void) {
+    free(g_lca.between);
+    free(g_lca.depth);
+    free(g_lca.sparse);
+    free(g_lca.log2of);
+    nm_free(&g_lca.pos);
+    memset(&g_lca, 0, sizeof(g_lca));
+}
+
+typedef struct {
+    Node *node;
+    int depth;
+} Pending;
+
+/* In-order over g_root with a stack of the questions still to be passed. */
+static int lca_build(void) {
+    lca_free();
+    if (!g_root || tree_is_shared() || animal_index_size() < 0) return 0; //same tree as the index
+    int k = subtree_leaves(g_root), between = k > 1 ? k - 1 : 1, levels = 1;
+    while ((2 << (levels - 1)) <= k - 1) levels++;
+    g_lca.between = (Node **)malloc(sizeof(Node *) * (size_t)between);
+    g_lca.depth = (int *)malloc(sizeof(int) * (size_t)between);
+    g_lca.sparse = (int *)malloc(sizeof(int) * (size_t)between * (size_t)levels);
+    g_lca.log2of = (unsigned char *)malloc((size_t)k + 1);
+    int height = 0, cap = 64, top = 0;
+    Pending *st = (Pending *)malloc(sizeof(Pending) * (size_t)cap);
+    int ok = g_lca.between && g_lca.depth && g_lca.sparse && g_lca.log2of && st &&
+             nm_reserve(&g_lca.pos, (size_t)k);
+
+    int li = 0, mi = 0;
+    Node *cur = g_root;
+    while (ok) {
+        for (; cur->isQuestion; cur = cur->yes, height++) { //down the yes sides
+            if (!cur->yes || !cur->no) { ok = 0; break; }
+            if (top == cap) {
+                Pending *tmp = (Pending *)realloc(st, sizeof(Pending) * (size_t)cap * 2);
+                if (!tmp) { ok = 0; break; }
+                st = tmp;
+                cap *= 2;
+            }
+            st[top++] = (Pending){ cur, height };
+        }
+        if (!ok || li == k) { ok = 0; break; }
+        nm_put(&g_lca.pos, cur)->val = li++;
+        if (top == 0) break; //the last leaf
+        Pending p = st[--top];
+        if (mi == k - 1) { ok = 0; break; }
+        g_lca.between[mi] = p.node;
+        g_lca.depth[mi++] = p.depth;
+        cur = p.node->no;
+        height = p.depth + 1;
+    }
+    free(st);
+    if (!ok || li != k || mi != k - 1) { //not a full tree, or counts out of step
+        lca_free();
+        g_lca.root = g_root; //no tables for this tree: climb until it changes
+        g_lca.version = animal_index_version();
+        return 0;
+    }
+
+    int *prev = NULL;
+    for (int j = 1; j < levels; j++) {
+        int *lev = g_lca.sparse + (size_t)(j - 1) * (size_t)(k - 1), half = 1 << (j - 1);
+        for (int m = 0; m + (1 << j) <= k - 1; m++) {
+            int a = prev ? prev[m] : m, b = prev ? prev[m + half] : m + half;
+            lev[m] = g_lca.depth[b] < g_lca.depth[a] ? b : a;
+        }
+        prev = lev;
+    }
+    g_lca.log2of[1] = 0;
+    for (int len = 2; len <= k; len++) g_lca.log2of[len] = (unsigned char)(g_lca.log2of[len / 2] + 1);
+    g_lca.leaves = k;
+    g_lca.root = g_root;
+    g_lca.version = animal_index_version();
+    return 1;
+}
+
+static int lca_ready(void) {
+    if (g_lca.root && g_lca.root == g_root && g_lca.version == animal_index_version()) return g_lca.leaves > 0;
+    return lca_build();
+}
+
+/* Index of the shallowest of between[i..j]. */
+static int shallowest(int i, int j) {
+    int lg = g_lca.log2of[j - i + 1];
+    if (lg == 0) return i;
+    const int *lev = g_lca.sparse + (size_t)(lg - 1) * (size_t)(g_lca.leaves - 1);
+    int a = lev[i], b = lev[j - (1 << lg) + 1];
+    return g_lca.depth[b] < g_lca.depth[a] ? b : a;
+}
+
+static int leaf_index(int val) {
+    return val >= 0 ? val : -val - 1;
+}
+
+/* Levels from n up to the top of its climb: the root, or with within the
+ * last node whose parent is still in within. */
+static int climb_height(const Node *n, const NodeMap *within) {
+    int h = 0;
+    for (; n->parent && (!within || nm_get(within, n->parent)); n = n->parent) h++;
+    return h;
+}
+
+/* LCA by parent links: even out the heights, then up together. *below is
+ * the LCA's child on a's side (a itself if b is above it, NULL if a is). */
+static Node *climb_lca(Node *a, Node *b, const NodeMap *within, Node **below) {
+    int ha = climb_height(a, within), hb = climb_height(b, within);
+    Node *prevA = NULL;
+    for (; ha > hb; ha--) { prevA = a; a = a->parent; }
+    for (; hb > ha; hb--) b = b->parent;
+    while (a != b) {
+        prevA = a;
+        a = a->parent;
+        b = b->parent;
+    }
+    *below = prevA;
+    return a;
+}
+
+/* The LCA and whether a sits on its yes side. */
+static Node *lca_side(Node *a, Node *b, int *aOnYes) {
+    Node *below = NULL, *lca;
+    NodeMapSlot *sa = NULL, *sb = NULL;
+    if (a != b && lca_ready()) {
+        sa = nm_get(&g_lca.pos, a);
+        sb = nm_get(&g_lca.pos, b);
+    }
+    if (sa && sb && leaf_index(sa->val) != leaf_index(sb->val)) {
+        int ia = leaf_index(sa->val), ib = leaf_index(sb->val);
+        *aOnYes = ia < ib; //the yes side comes first in order
+        return g_lca.between[ia < ib ? shallowest(ia, ib - 1) : shallowest(ib, ia - 1)];
+    }
+    //grown out of the same leaf (a short climb), or no tables
+    lca = climb_lca(a, b, sa && sb ? &g_lca.pos : NULL, &below);
+    *aOnYes = below && lca->yes == below;
+    return lca;
+}
+
+Node *tree_lca(Node *a, Node *b) {
+    int aOnYes;
+    if (tree_is_shared()) return NULL; //a shared node has more than one parent to climb to
+    return a && b ? lca_side(a, b, &aOnYes) : NULL;
+}
+
+/* Keeps the tables of the tree before the edit: a learn files its two new
+ * nodes under the leaf oldLeaf grew out of, undoing one takes them out
+ * again (unless the tables were built with them: then they are rebuilt).
+ * Pairs filed under one leaf are climbed, O(depth) each, so once the
+ * learns filed outnumber half the leaves the tables are dropped and the
+ * next query rebuilds them; the O(leaves) build is spread over those
+ * learns. */
+void lca_update(Node *before, const Edit *e, int applied) {
+    if (!g_lca.root || g_lca.root != before) return;
+    NodeMapSlot *s = nm_get(&g_lca.pos, e->oldLeaf);
+    if (!s) { g_lca.root = NULL; return; }
+    if (applied) {
+        int val = -leaf_index(s->val) - 1;
+        if (!nm_reserve(&g_lca.pos, g_lca.pos.count + 2)) { g_lca.root = NULL; return; }
+        nm_put(&g_lca.pos, e->newQuestion)->val = val;
+        nm_put(&g_lca.pos, e->newLeaf)->val = val;
+        if (++g_lca.filed * 2 > g_lca.leaves) { g_lca.root = NULL; return; } //climbs would outweigh a rebuild
+    } else {
+        NodeMapSlot *q = nm_get(&g_lca.pos, e->newQuestion);
+        if (!q || q->val >= 0) { g_lca.root = NULL; return; }
+        nm_remove(&g_lca.pos, e->newQuestion);
+        nm_remove(&g_lca.pos, e->newLeaf);
+        g_lca.filed--;
+    }
+    g_lca.root = g_root;
+}
+
+/* All pairs against the same tables: two index lookups and one LCA each. */
+int find_paths(PathQuery *queries, int count) {
+    int found = 0;
+    if (tree_is_shared()) return -1; //no single path to a shared leaf
+    for (int i = 0; i < count; i++) {
+        PathQuery *q = &queries[i];
+        q->split = NULL;
+        q->yes1 = 0;
+        AnimalRef r1, r2;
+        int f1 = animal_find(q->animal1, &r1, 1), f2 = animal_find(q->animal2, &r2, 1);
+        if (f1 < 0 || f2 < 0) return -1;
+        if (f1 == 0 || f2 == 0 || r1.leaf == r2.leaf) continue;
+        q->split = lca_side(r1.leaf, r2.leaf, &q->yes1);
+        found++;
+    }
+    return found;
+}
 
 /* TODO 30: Implement find_shortest_path (OPTIONAL CHALLENGE)
  * Find the shortest distinguishing path between two animals
  * 
- * This is an optional challenge problem. If you want to attempt it:
- * 
- * Steps:
- * 1. Use BFS to find paths to both animals
- * 2. Build PathNode structures that track parent and direction
- * 3. Build arrays of PathNodes from each animal to root
- * 4. Find the Lowest Common Ancestor (LCA)
- * 5. Print the questions that distinguish them
- * 
- * Algorithm:
- * - Use BFS with a PathNode array to track the path taken
- * - For each node visited, record its parent and which branch (yes/no)
- * - Once both animals are found, trace back to root for each
- * - Find where the paths diverge (LCA)
- * - Print the distinguishing questions from LCA to each animal
+ * Both leaves come from the animal index and their Lowest Common Ancestor
+ * (LCA) from the tables above (find_paths), so nothing is searched:
+ * 1. Ask find_paths for the pair
+ * 2. Print the distinguishing question at the LCA
+ * 3. Print the questions from the LCA down to each animal with the
+ *    answers that lead there (parent links, up from each animal)
  */
+static int depth_of(const Node *n) {
+    int depth = 0;
+    for (; n->parent; n = n->parent) depth++;
+    return depth;
+}
+
+/* The questions from lca down to leaf, with their answers. */
+static void print_answers_below(const Node *lca, Node *leaf) {
+    int depth = depth_of(leaf) - depth_of(lca);
+    Node **path = (Node **)malloc(sizeof(Node *) * (size_t)(depth + 1));
+    if (!path) return;
+    int i = depth;
+    for (Node *n = leaf; i >= 0; n = n->parent) path[i--] = n;
+    printf("  %s:", leaf->text);
+    for (i = 0; i < depth; i++) {
+        printf(" %s %s", path[i]->text, path[i]->yes == path[i + 1] ? "yes" : "no");
+        if (i + 1 < depth) printf(",");
+    }
+    printf("\n");
+    free(path);
+}
+
 void find_shortest_path(const char *animal1, const char *animal2) {
     if (g_root == NULL) return;
+    if (tree_is_shared()) { printf("Animals in shared subtrees have no single path\n"); return; }
     
-    // TODO: Implement this function (OPTIONAL CHALLENGE)
-    // This is complex and requires careful path tracking
+    AnimalRef ref1, ref2;
+    if (animal_find(animal1, &ref1, 1) <= 0) { printf("I don't know a %s\n", animal1); return; }
+    if (animal_find(animal2, &ref2, 1) <= 0) { printf("I don't know a %s\n", animal2); return; }
+    PathQuery q = { animal1, animal2, NULL, 0 };
+    if (find_paths(&q, 1) <= 0) {
+        printf("%s and %s are the same animal to me\n", animal1, animal2);
+        return;
+    }
     
-    printf("find_shortest_path not yet implemented\n");
+    printf("%s vs %s: \"%s\"\n", ref1.leaf->text, ref2.leaf->text, q.split->text);
+    print_answers_below(q.split, ref1.leaf);
+    print_answers_below(q.split, ref2.leaf);
+}
+
+/* ========== Tree Diff ========== */
+
+typedef struct {
+    Node *a;
+    Node *b;
+    int depth;   /* length of the path to this pair */
+    int viaYes;  /* answer that led here, -1 for the roots */
+} DiffPair;
+
+static int diff_push(DiffPair **stack, int *count, int *cap, DiffPair p) {
+    if (*count == *cap) {
+        int newcap = *cap ? *cap * 2 : 64;
+        DiffPair *tmp = (DiffPair *)realloc(*stack, sizeof(DiffPair) * (size_t)newcap);
+        if (!tmp) return 0;
+        *stack = tmp;
+        *cap = newcap;
+    }
+    (*stack)[(*count)++] = p;
+    return 1;
+}
+
+/* Walks both trees side by side in preorder, yes before no. A pair whose
+ * hashes match is the same subtree on both sides and is never entered. */
+int tree_diff(Node *a, Node *b, DiffReport report, void *ctx) {
+    load_wait(); //a pending load has no final hashes yet
+    DiffPair *stack = NULL;
+    int count = 0, cap = 0, found = 0;
+    int pathCap = 64;
+    char *path = (char *)malloc((size_t)pathCap);
+    if (!path || !diff_push(&stack, &count, &cap, (DiffPair){ node_ready(a), node_ready(b), 0, -1 })) {
+        free(path);
+        free(stack);
+        return -1;
+    }
+    while (count > 0) {
+        DiffPair p = stack[--count];
+        if (p.depth >= pathCap) {
+            char *tmp = (char *)realloc(path, (size_t)pathCap * 2);
+            if (!tmp) { found = -1; break; }
+            path = tmp;
+            pathCap *= 2;
+        }
+        if (p.depth > 0) path[p.depth - 1] = p.viaYes ? 'y' : 'n';
+        path[p.depth] = '\0';
+
+        if (!p.a && !p.b) continue;
+        if (p.a && p.b && p.a->hash == p.b->hash) continue; //same subtree
+        if (!p.a || !p.b || p.a->isQuestion != p.b->isQuestion || strcmp(p.a->text, p.b->text) != 0) {
+            found++;
+            if (report) report(path, p.a, p.b, ctx);
+            continue;
+        }
+        //same node, different children: no is pushed first so yes comes out first
+        if (!diff_push(&stack, &count, &cap, (DiffPair){ node_child(p.a, 0), node_child(p.b, 0), p.depth + 1, 0 }) ||
+            !diff_push(&stack, &count, &cap, (DiffPair){ node_child(p.a, 1), node_child(p.b, 1), p.depth + 1, 1 })) {
+            found = -1;
+            break;
+        }
+    }
+    free(path);
+    free(stack);
+    return found;
+}
+
+static void print_difference(const char *path, const Node *a, const Node *b, void *ctx) {
+    FILE *out = (FILE *)ctx;
+    fprintf(out, "%s: \"%s\" -> \"%s\" (%d -> %d nodes)\n", *path ? path : "(root)",
+            a ? a->text : "(none)", b ? b->text : "(none)", subtree_nodes(a), subtree_nodes(b));
+}
+
+/* Both files are loaded beside the live tree (g_root is put back after each
+ * load), diffed, and freed again. */
+int diff_files(const char *fileA, const char *fileB, FILE *out) {
+    load_wait(); //a paged live tree must be complete before g_root is swapped out
+    Node *live = g_root;
+    Node *trees[2] = { NULL, NULL };
+    const char *files[2] = { fileA, fileB };
+    int ok = 1;
+    for (int i = 0; ok && i < 2; i++) {
+        g_root = NULL; //so the load keeps the live tree
+        ok = load_tree(files[i]) && load_wait();
+        trees[i] = g_root;
+    }
+    g_root = live;
+
+    int found = ok ? tree_diff(trees[0], trees[1], out ? print_difference : NULL, out) : -1;
+    if (trees[0]) free_tree(trees[0]);
+    if (trees[1]) free_tree(trees[1]);
+    return found;
 }
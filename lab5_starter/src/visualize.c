@@ -33,32 +33,91 @@ void add_display_line(const char *text, int indent, int isQuestion) {
     line_count++;
 }
 
+/* Lines for node's subtree in preorder, yes side first. Iterative, with an
+ * explicit stack of pending branches, so long learned chains cannot
+ * overflow the C stack; each level adds two spaces to prefix. */
 void build_tree_display(Node *node, int depth, const char *prefix, int isYesBranch) {
+    typedef struct { Node *node; int depth; int isYes; } Pending;
     if (node == NULL) return;
     
-    char line[256];
-    char branch[64];
-    
-    if (depth == 0) {
-        snprintf(line, sizeof(line), "ROOT: %s", node->text);
-    } else {
-        snprintf(branch, sizeof(branch), "%s", isYesBranch ? "[YES]" : "[NO]");
-        snprintf(line, sizeof(line), "%s%s %s", prefix, branch, node->text);
-    }
-    
-    add_display_line(line, depth, node->isQuestion);
+    int cap = 64, top = 0;
+    Pending *st = (Pending *)malloc(sizeof(Pending) * (size_t)cap);
+    if (!st) return;
+    st[top++] = (Pending){ node, depth, isYesBranch };
     
-    if (node->isQuestion) {
-        char new_prefix[256];
-        snprintf(new_prefix, sizeof(new_prefix), "%s  ", prefix);
+    char line[256];
+    while (top > 0) {
+        Pending p = st[--top];
+        Node *n = node_ready(p.node); //may have been paged out since it was pushed
+        
+        int pad = 2 * (p.depth - depth);
+        if (pad > (int)sizeof(line)) pad = (int)sizeof(line); //the line is cut there anyway
+        if (p.depth == 0) {
+            snprintf(line, sizeof(line), "ROOT: %s", n->text);
+        } else {
+            snprintf(line, sizeof(line), "%s%*s%s %s", prefix, pad, "", p.isYes ? "[YES]" : "[NO]", n->text);
+        }
+        add_display_line(line, p.depth, n->isQuestion);
         
-        if (node->yes) {
-            build_tree_display(node->yes, depth + 1, new_prefix, 1);
+        if (n->isQuestion) {
+            if (top + 2 > cap) {
+                cap *= 2;
+                Pending *tmp = (Pending *)realloc(st, sizeof(Pending) * (size_t)cap);
+                if (!tmp) break;
+                st = tmp;
+            }
+            Node *yes = node_child(n, 1), *no = node_child(n, 0);
+            if (no) st[top++] = (Pending){ no, p.depth + 1, 0 };
+            if (yes) st[top++] = (Pending){ yes, p.depth + 1, 1 }; //popped first
         }
-        if (node->no) {
-            build_tree_display(node->no, depth + 1, new_prefix, 0);
+    }
+    free(st);
+}
+
+static void clear_display_lines(void) {
+    for (int i = 0; i < line_count; i++) {
+        free(lines[i].text);
+    }
+    line_count = 0;
+}
+
+/* Lines for the way from the root down to leaf, in the same format as the
+ * whole-tree view, found by following parent links up. */
+static void build_path_display(Node *leaf) {
+    int depth = 0;
+    for (Node *n = leaf; n->parent; n = n->parent) depth++;
+    Node **path = (Node **)malloc(sizeof(Node *) * (size_t)(depth + 1));
+    if (!path) return;
+    int i = depth;
+    for (Node *n = leaf; n; n = n->parent) path[i--] = n;
+
+    char line[256];
+    for (i = 0; i <= depth; i++) {
+        if (i == 0) {
+            snprintf(line, sizeof(line), "ROOT: %s", path[i]->text);
+        } else {
+            int pad = 2 * i > (int)sizeof(line) ? (int)sizeof(line) : 2 * i;
+            snprintf(line, sizeof(line), "%*s%s %s", pad, "",
+                     path[i - 1]->yes == path[i] ? "[YES]" : "[NO]", path[i]->text);
         }
+        add_display_line(line, i, path[i]->isQuestion);
+    }
+    free(path);
+}
+
+/* Replaces the view with the paths to every animal named name (the animal
+ * index finds them without a walk); 0 if there is none. */
+static int show_animal(const char *name) {
+    enum { MAX_SHOWN = 16 };
+    AnimalRef refs[MAX_SHOWN];
+    int found = animal_find(name, refs, MAX_SHOWN);
+    if (found <= 0) return 0;
+    clear_display_lines();
+    for (int i = 0; i < found && i < MAX_SHOWN; i++) {
+        if (i > 0) add_display_line("", 0, 0);
+        build_path_display(refs[i].leaf);
     }
+    return 1;
 }
 
 void draw_tree() {
@@ -139,7 +198,7 @@ void draw_tree() {
         
         /* Status bar */
         attron(COLOR_PAIR(1));
-        mvprintw(LINES - 2, 2, "Lines %d-%d of %d | Use UP/DOWN arrows or j/k to scroll | Q to exit",
+        mvprintw(LINES - 2, 2, "Lines %d-%d of %d | UP/DOWN or j/k to scroll | F find animal | A all | Q to exit",
                  scroll_offset + 1,
                  (scroll_offset + max_lines < line_count) ? scroll_offset + max_lines : line_count,
                  line_count);
@@ -178,6 +237,22 @@ void draw_tree() {
                     if (scroll_offset < 0) scroll_offset = 0;
                 }
                 break;
+            case 'f':
+            case 'F': {
+                char name[128] = {0};
+                mvprintw(LINES - 1, 40, "Find animal: ");
+                echo();
+                getnstr(name, sizeof(name) - 1);
+                noecho();
+                if (show_animal(name)) scroll_offset = 0;
+                break;
+            }
+            case 'a':
+            case 'A':
+                clear_display_lines();
+                build_tree_display(g_root, 0, "", 0);
+                scroll_offset = 0;
+                break;
             case 'q':
             case 'Q':
                 running = 0;
@@ -186,9 +261,7 @@ void draw_tree() {
     }
     
     /* Cleanup */
-    for (int i = 0; i < line_count; i++) {
-        free(lines[i].text);
-    }
+    clear_display_lines();
     if (lines) {
         free(lines);
         lines = NULL;